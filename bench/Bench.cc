@@ -0,0 +1,399 @@
+/**
+ * @brief Pomiary warstwy Http na lokalnym serwerze (127.0.0.1).
+ * @author Piotr Truszkowski
+ *
+ * Serwer jest w tym samym programie (proces potomny, zeby jego wywolania
+ * systemowe i alokacje nie mieszaly sie z pomiarem), podaje sztuczne
+ * strony i pliki o zadanym rozmiarze, kawalkowaniu, opoznieniu i
+ * przepustowosci. Klient to zwykle Http::get (do pamieci, do Rope i do
+ * pliku), dla kazdego wariantu: przepustowosc, mediana i p99 czasu zadania,
+ * wywolania systemowe na MB i alokacje na zadanie.
+ */
+
+#include <curl/curl.h>
+
+#include <rs/Http.hh>
+#include <rs/Rope.hh>
+
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <dlfcn.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*** Liczniki ***/
+
+static uint64_t Allocs = 0;   // operator new i malloc z curl-a
+static uint64_t Syscalls = 0; // wywolania we/wy (ponizej)
+
+void *operator new(size_t sz) throw(std::bad_alloc)
+{
+  __sync_fetch_and_add(&Allocs, 1);
+  void *p = malloc(sz ? sz : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t sz) throw(std::bad_alloc) { return operator new(sz); }
+
+void *operator new(size_t sz, const std::nothrow_t &) throw()
+{
+  __sync_fetch_and_add(&Allocs, 1);
+  return malloc(sz ? sz : 1);
+}
+
+void *operator new[](size_t sz, const std::nothrow_t &nt) throw() { return operator new(sz, nt); }
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+// Od C++14 kompilator moze wolac wersje z rozmiarem - bez nich szlyby do libstdc++
+void operator delete(void *p, size_t) throw() { free(p); }
+void operator delete[](void *p, size_t) throw() { free(p); }
+void operator delete(void *p, const std::nothrow_t &) throw() { free(p); }
+void operator delete[](void *p, const std::nothrow_t &) throw() { free(p); }
+
+// Alokacje curl-a - curl_global_init_mem musi byc przed pierwszym Http
+static void *c_malloc(size_t sz) { __sync_fetch_and_add(&Allocs, 1); return malloc(sz); }
+static void *c_realloc(void *p, size_t sz) { if (!p) __sync_fetch_and_add(&Allocs, 1); return realloc(p, sz); }
+static void *c_calloc(size_t n, size_t sz) { __sync_fetch_and_add(&Allocs, 1); return calloc(n, sz); }
+static char *c_strdup(const char *s) { __sync_fetch_and_add(&Allocs, 1); return strdup(s); }
+
+// Wywolania systemowe liczymy przechwytujac funkcje libc (tez te wolane
+// z libcurl) - /proc/self/io nie widzi recv/send na gniazdach.
+#define BENCH_SYSCALL(ret, name, params, args) \
+  extern "C" ret name params { \
+    typedef ret (*real_t) params; \
+    static real_t real = NULL; \
+    if (!real) real = (real_t)dlsym(RTLD_NEXT, #name); \
+    __sync_fetch_and_add(&Syscalls, 1); \
+    return real args; \
+  }
+
+BENCH_SYSCALL(ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n))
+BENCH_SYSCALL(ssize_t, write, (int fd, const void *buf, size_t n), (fd, buf, n))
+BENCH_SYSCALL(ssize_t, pwrite64, (int fd, const void *buf, size_t n, off64_t off), (fd, buf, n, off))
+BENCH_SYSCALL(ssize_t, recv, (int fd, void *buf, size_t n, int fl), (fd, buf, n, fl))
+BENCH_SYSCALL(ssize_t, send, (int fd, const void *buf, size_t n, int fl), (fd, buf, n, fl))
+BENCH_SYSCALL(ssize_t, recvfrom, (int fd, void *buf, size_t n, int fl, sockaddr *a, socklen_t *al), (fd, buf, n, fl, a, al))
+BENCH_SYSCALL(ssize_t, sendto, (int fd, const void *buf, size_t n, int fl, const sockaddr *a, socklen_t al), (fd, buf, n, fl, a, al))
+BENCH_SYSCALL(int, poll, (pollfd *fds, nfds_t n, int tmo), (fds, n, tmo))
+BENCH_SYSCALL(int, epoll_wait, (int fd, epoll_event *ev, int max, int tmo), (fd, ev, max, tmo))
+BENCH_SYSCALL(int, epoll_ctl, (int fd, int op, int sfd, epoll_event *ev), (fd, op, sfd, ev))
+BENCH_SYSCALL(int, fdatasync, (int fd), (fd))
+
+static uint64_t usec(void) throw()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/*** Serwer ***/
+
+static char Pattern[64*1024]; // tresc stron i plikow
+
+// Wartosc parametru key=... z zapytania, def - gdy brak
+static long long query(const char *q, const char *key, long long def) throw()
+{
+  size_t kl = strlen(key);
+  for (const char *p = strchr(q, '?'); p; p = strchr(p, '&')) {
+    ++p;
+    if (!strncmp(p, key, kl) && p[kl] == '=') return strtoll(p + kl + 1, NULL, 10);
+  }
+  return def;
+}
+
+static bool send_all(int fd, const char *buf, size_t len) throw()
+{
+  while (len) {
+    ssize_t wr = send(fd, buf, len, MSG_NOSIGNAL);
+    if (wr < 0 && errno == EINTR) continue;
+    if (wr <= 0) return false;
+    buf += wr;
+    len -= wr;
+  }
+  return true;
+}
+
+// Tresc: size bajtow po chunk, nie szybciej niz rate B/s
+static bool respond(int fd, const char *req, bool head) throw()
+{
+  long long size = query(req, "size", 65536), chunk = query(req, "chunk", 16384),
+            delay = query(req, "delay", 0), rate = query(req, "rate", 0), te = query(req, "te", 0);
+  if (chunk <= 0 || chunk > (long long)sizeof(Pattern)) chunk = sizeof(Pattern);
+
+  if (delay > 0) usleep(delay*1000);
+
+  char hdr[256];
+  int hl = te ?
+    snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nTransfer-Encoding: chunked\r\n\r\n") :
+    snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: %lld\r\n\r\n", size);
+  if (!send_all(fd, hdr, hl)) return false;
+  if (head) return true;
+
+  uint64_t start = usec();
+  for (long long sent = 0; sent < size; ) {
+    size_t n = (size_t)std::min(chunk, size - sent);
+    if (te) {
+      int cl = snprintf(hdr, sizeof(hdr), "%zx\r\n", n);
+      if (!send_all(fd, hdr, cl)) return false;
+    }
+    if (!send_all(fd, Pattern, n)) return false;
+    if (te && !send_all(fd, "\r\n", 2)) return false;
+    sent += n;
+
+    if (rate > 0) {
+      uint64_t due = start + (uint64_t)(sent*1000000/rate), now = usec();
+      if (due > now) usleep(due - now);
+    }
+  }
+
+  return !te || send_all(fd, "0\r\n\r\n", 5);
+}
+
+static void *connection(void *data)
+{
+  int fd = (int)(long)data;
+  std::vector<char> buf;
+  char tmp[16384];
+
+  for (;;) {
+    // Naglowki zadania (i ewentualna tresc POST do wyrzucenia)
+    size_t end;
+    std::vector<char>::iterator it;
+    while ((it = std::search(buf.begin(), buf.end(), "\r\n\r\n", "\r\n\r\n" + 4)) == buf.end()) {
+      ssize_t rd = recv(fd, tmp, sizeof(tmp), 0);
+      if (rd <= 0) { close(fd); return NULL; }
+      buf.insert(buf.end(), tmp, tmp + rd);
+    }
+    end = it - buf.begin() + 4;
+
+    std::string req(buf.begin(), buf.begin() + end);
+    buf.erase(buf.begin(), buf.begin() + end);
+
+    const char *cl = strcasestr(req.c_str(), "\r\nContent-Length:");
+    size_t body = cl ? strtoul(cl + 17, NULL, 10) : 0;
+    while (buf.size() < body) {
+      ssize_t rd = recv(fd, tmp, sizeof(tmp), 0);
+      if (rd <= 0) { close(fd); return NULL; }
+      buf.insert(buf.end(), tmp, tmp + rd);
+    }
+    buf.erase(buf.begin(), buf.begin() + body);
+
+    std::string line = req.substr(0, req.find("\r\n"));
+    if (!respond(fd, line.c_str(), !strncmp(line.c_str(), "HEAD ", 5)) ||
+        strcasestr(req.c_str(), "\r\nConnection: close")) break;
+  }
+
+  close(fd);
+  return NULL;
+}
+
+static void serve(int lfd)
+{
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;) {
+    int fd = accept(lfd, NULL, NULL);
+    if (fd < 0) continue;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    pthread_t pth;
+    pthread_attr_t pat;
+    pthread_attr_init(&pat);
+    pthread_attr_setdetachstate(&pat, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&pth, &pat, connection, (void*)(long)fd)) close(fd);
+    pthread_attr_destroy(&pat);
+  }
+}
+
+static int listen_on(int &port) throw()
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0), one = 1;
+  if (fd < 0) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  sockaddr_in sa;
+  socklen_t len = sizeof(sa);
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sa.sin_port = htons(port);
+
+  if (bind(fd, (sockaddr*)&sa, sizeof(sa)) || listen(fd, 128) ||
+      getsockname(fd, (sockaddr*)&sa, &len)) {
+    close(fd);
+    return -1;
+  }
+
+  port = ntohs(sa.sin_port);
+  return fd;
+}
+
+/*** Klient ***/
+
+static std::string Path; // dokad pobierac pliki
+static bool Mapped = false;
+
+typedef bool (*request_fn)(Http &http, const char *url, uint64_t &bytes);
+
+static bool page_req(Http &http, const char *url, uint64_t &bytes)
+{
+  char *page = NULL;
+  size_t len = 0;
+  http.get(page, len, url);
+  delete[] page;
+  bytes += len;
+  return http.error() == Http::Error::None && http.status() == Http::Status::Ok;
+}
+
+static bool rope_req(Http &http, const char *url, uint64_t &bytes)
+{
+  Rope page;
+  http.get(page, url);
+  bytes += page.size();
+  return http.error() == Http::Error::None && http.status() == Http::Status::Ok;
+}
+
+static bool file_req(Http &http, const char *url, uint64_t &bytes)
+{
+  off_t len = http.get(Path.c_str(), url);
+  if (len > 0) bytes += len;
+  return http.error() == Http::Error::None && http.status() == Http::Status::Ok;
+}
+
+static void run(const char *name, request_fn fn, const std::string &url, size_t n, bool pooled)
+{
+  Http http(pooled);
+  http.setMapped(Mapped);
+  std::vector<uint64_t> lat;
+  uint64_t bytes = 0, dummy = 0;
+  size_t fails = 0;
+
+  lat.reserve(n);
+  fn(http, url.c_str(), dummy); // rozgrzewka - polaczenie w puli, DNS itp.
+
+  uint64_t sys = Syscalls, allocs = Allocs, start = usec();
+
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t t = usec();
+    if (!fn(http, url.c_str(), bytes)) ++fails;
+    lat.push_back(usec() - t);
+  }
+
+  uint64_t took = usec() - start;
+  sys = Syscalls - sys;
+  allocs = Allocs - allocs;
+
+  std::sort(lat.begin(), lat.end());
+  double mb = bytes/1048576.0;
+
+  printf("%-6s %6zu %5zu %10.1f %9.2f %9.3f %9.3f %10.1f %9.1f\n", name, n, fails, mb,
+      took ? mb/(took/1e6) : 0.0,
+      lat.empty() ? 0.0 : lat[lat.size()/2]/1000.0,
+      lat.empty() ? 0.0 : lat[std::min(lat.size() - 1, lat.size()*99/100)]/1000.0,
+      mb > 0 ? sys/mb : 0.0, n ? (double)allocs/n : 0.0);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+      "Uzycie: %s [opcje]\n"
+      "  -n N     liczba zadan o strone (200), o plik N/10\n"
+      "  -p B     rozmiar strony (65536)\n"
+      "  -f B     rozmiar pliku (67108864)\n"
+      "  -c B     serwer pisze po tyle bajtow (16384)\n"
+      "  -l MS    opoznienie odpowiedzi serwera (0)\n"
+      "  -b B/S   przepustowosc serwera, 0 - bez limitu (0)\n"
+      "  -t       Transfer-Encoding: chunked\n"
+      "  -1       nowe polaczenie na kazde zadanie (bez HttpPool)\n"
+      "  -m       pliki zapisywane przez mmap (Http::setMapped)\n"
+      "  -o PLIK  dokad pobierac pliki (/tmp/rs-bench.<pid>)\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  size_t n = 200;
+  long long page = 65536, file = 64LL*1024*1024, chunk = 16384, delay = 0, rate = 0;
+  bool te = false, pooled = true;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:p:f:c:l:b:t1mo:h")) != -1) {
+    switch (opt) {
+      case 'n': n = strtoul(optarg, NULL, 10); break;
+      case 'p': page = strtoll(optarg, NULL, 10); break;
+      case 'f': file = strtoll(optarg, NULL, 10); break;
+      case 'c': chunk = strtoll(optarg, NULL, 10); break;
+      case 'l': delay = strtoll(optarg, NULL, 10); break;
+      case 'b': rate = strtoll(optarg, NULL, 10); break;
+      case 't': te = true; break;
+      case '1': pooled = false; break;
+      case 'm': Mapped = true; break;
+      case 'o': Path = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(Pattern); ++i) Pattern[i] = "<p>abcdefghijklmnopqrstuvwxyz</p>\n"[i % 34];
+
+  if (Path.empty()) {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "/tmp/rs-bench.%d", (int)getpid());
+    Path = tmp;
+  }
+
+  int port = 0, lfd = listen_on(port);
+  if (lfd < 0) { perror("listen"); return 1; }
+
+  // Serwer przed pierwszym Http - potomek nie dziedziczy watkow silnika
+  pid_t srv = fork();
+  if (srv < 0) { perror("fork"); return 1; }
+  if (srv == 0) serve(lfd);
+  close(lfd);
+
+  if (curl_global_init_mem(CURL_GLOBAL_ALL, c_malloc, free, c_realloc, c_strdup, c_calloc) != CURLE_OK) {
+    fprintf(stderr, "curl_global_init_mem\n");
+    kill(srv, SIGTERM);
+    return 1;
+  }
+
+  char base[256];
+  snprintf(base, sizeof(base), "http://127.0.0.1:%d/data?chunk=%lld&delay=%lld&rate=%lld&te=%d",
+      port, chunk, delay, rate, te ? 1 : 0);
+  char psize[64], fsize[64];
+  snprintf(psize, sizeof(psize), "&size=%lld", page);
+  snprintf(fsize, sizeof(fsize), "&size=%lld", file);
+
+  printf("# strona %lld B, plik %lld B, kawalki %lld B, opoznienie %lld ms, %lld B/s%s%s%s\n",
+      page, file, chunk, delay, rate, te ? ", chunked" : "", pooled ? ", keep-alive" : "", Mapped ? ", mmap" : "");
+  printf("%-6s %6s %5s %10s %9s %9s %9s %10s %9s\n",
+      "#", "zadan", "bledy", "MB", "MB/s", "p50 ms", "p99 ms", "syscall/MB", "alloc/req");
+
+  run("page", page_req, std::string(base) + psize, n, pooled);
+  run("rope", rope_req, std::string(base) + psize, n, pooled);
+  run("file", file_req, std::string(base) + fsize, n/10 ? n/10 : 1, pooled);
+
+  unlink(Path.c_str());
+  kill(srv, SIGTERM);
+  waitpid(srv, NULL, 0);
+
+  return 0;
+}
+
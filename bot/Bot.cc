@@ -4,11 +4,15 @@
  */
 
 #include <rs/Downloader.hh>
+#include <rs/DownloaderPool.hh>
+#include <rs/SessionArchive.hh>
 #include <rs/Time.hh>
 #include <rs/File.hh>
 
 #include <fstream>
 #include <list>
+#include <map>
+#include <algorithm>
 #include <string>
 #include <cstdio>
 #include <cstdlib>
@@ -23,6 +27,13 @@ static const char *Q_extends = "./extends.queue";
 static const char *Q_raports = "./raports.queue";
 static const char *Q_tempora = "./tempora.queue";
 
+// Ile plikow pobierac naraz, ile nastepnych przygotowywac w tym czasie
+// (etapy 1 i 2 z odliczaniem) i ile zlecen z jednego hosta (darmowe konto
+// dostaje "already downloading" przy zbyt wielu naraz)
+static const unsigned Jobs = 2;
+static const unsigned Lookahead = 1;
+static const unsigned JobsPerHost = 3;
+
 static size_t load_pri(list<string> &queue)
 {
   string url;
@@ -87,14 +98,27 @@ int main(int argc, char **argv)
   
   signal(SIGPIPE, SIG_IGN);
 
-  RSDownloader &rsd = RSDownloader::instance();
+  DownloaderPool &pool = DownloaderPool::instance();
   
   // Podstawowe ustawienia...
 
-  rsd.setDownloadDir("./d/");
-  rsd.setSessionsDir("./s/");
-  rsd.setDiagnostic("./rs.dia");
-  rsd.setSpeedRaporting("./rs.speed", 10);
+  RSDownloader::setDownloadDir("./d/");
+  RSDownloader::setSessionsDir("./s/");
+  RSDownloader::setDiagnostic("./rs.dia");
+  RSDownloader::setSpeedRaporting("./rs.speed", 10);
+  RSDownloader::setKeepAlive(true);
+  RSDownloader::setResume(true);
+  RSDownloader::setPreallocate(true);
+  RSDownloader::setMapped(true);
+  RSDownloader::setDigest("crc32c");
+  RSDownloader::setDns(300, true);
+  RSDownloader::setStall(30, 1024);
+  RSDownloader::setScoreboard("./rs.mirrors", 0.1);
+  RSDownloader::setRetries(40, 6, 60);
+
+  pool.setWorkers(Jobs);
+  pool.setLookahead(Lookahead);
+  pool.setHostLimit(JobsPerHost);
 
   // Kolejka url-i do pobrania...
   list<string> queue;
@@ -111,7 +135,10 @@ int main(int argc, char **argv)
   load_ext(queue);
   update_pri(queue);
 
-  // Pobieranie plikow z kolejki
+  // Pobieranie plikow z kolejki. Pobierane pliki zostaja w kolejce az do
+  // konca, wiec po przerwaniu programu zaczna sie od nowa.
+
+  map<DownloaderPool::Job, string> running;
 
   while (true) {
     load_ext(queue);
@@ -119,26 +146,43 @@ int main(int argc, char **argv)
 
     if (queue.empty()) break;
     
-    string url = queue.front();
-    try { rsd.download(url.c_str()); }
-    catch (const EInvalid &) {
-      fprintf(stderr, "%s - RSB - Niepoprawny wpis '%s'...\n", Time::stamp(), url.c_str());
-      fstream qrap(Q_raports, ios::out|ios::app);
-      qrap << "INVALID " << url.c_str() << endl;
-      queue.pop_front();
-      continue;
+    // Dokladamy zlecen do Jobs + Lookahead naraz, kolejno z poczatku kolejki
+    for (list<string>::iterator i = queue.begin(); i != queue.end() && running.size() < Jobs + Lookahead; ) {
+      string url = *i;
+      bool taken = false;
+      for (map<DownloaderPool::Job, string>::iterator r = running.begin(); r != running.end() && !taken; ++r)
+        taken = (r->second == url);
+      if (taken) { ++i; continue; }
+
+      try { running[pool.download(url)] = url; }
+      catch (const EInvalid &) {
+        fprintf(stderr, "%s - RSB - Niepoprawny wpis '%s'...\n", Time::stamp(), url.c_str());
+        fstream qrap(Q_raports, ios::out|ios::app);
+        qrap << "INVALID " << url.c_str() << endl;
+        i = queue.erase(i);
+        continue;
+      }
+      catch (const EAlready &) { ++i; continue; } // ten sam url drugi raz w kolejce
+
+      fprintf(stderr, "\n%s - RSB - Pobieramy plik '%s'...\n", Time::stamp(), url.c_str());
+      ++i;
     }
-    fprintf(stderr, "%s - RSB - Pobieramy plik '%s'...\n", Time::stamp(), url.c_str());
 
-    while (true) {
+    // Patrzymy na postepu sciagania...
+    string line;
+    list<DownloaderPool::Job> done;
+
+    for (map<DownloaderPool::Job, string>::iterator r = running.begin(); r != running.end(); ++r) {
       RSDownloader::Status status;
-      string url2;
+      string url2, digest;
       uint64_t bytes, usecs, size;
       long double speed;
       size_t waiting;
+      const char *url = r->second.c_str();
+      char buf[256];
 
-      // Patrzymy na postepu sciagania...
-      rsd.getProgress(status, url2, bytes, usecs, size, speed, waiting);
+      if (!pool.getProgress(r->first, status, url2, bytes, usecs, size, speed, waiting, digest))
+        throw EInternal("Brak zlecenia: %u", r->first);
 
       assert(status != RSDownloader::None);
       bool toBreak = false;
@@ -147,53 +191,68 @@ int main(int argc, char **argv)
         case RSDownloader::Downloaded: 
           { // Sciagnieto plik
             toBreak = true;
+            if (!usecs) usecs = 1;
             fprintf(stderr, "\n"
-                "%s - RSB - Plik zostal pobrany, %6llu.%.3llu KB w %llu:%.2llu:%.2llu sek (%4llu.%.3llu KB/s)\n",
-                Time::stamp(), bytes/1000, bytes%1000, usecs/3600000000ULL, (usecs/60000000)%60, (usecs/1000000)%60,
+                "%s - RSB - Plik '%s' zostal pobrany, %6llu.%.3llu KB w %llu:%.2llu:%.2llu sek (%4llu.%.3llu KB/s)\n",
+                Time::stamp(), url, bytes/1000, bytes%1000, usecs/3600000000ULL, (usecs/60000000)%60, (usecs/1000000)%60,
                 (1000 * bytes / usecs), (1000000 * bytes / usecs)%1000);
 
             fstream qrap(Q_raports, ios::out|ios::app);
-            qrap << "OK " << url.c_str() << endl;
+            qrap << "OK " << url;
+            if (!digest.empty()) qrap << " " << digest.c_str(); // np. crc32c:1a2b3c4d
+            qrap << endl;
           }
           break;
         case RSDownloader::Canceled:
           { // Anulowano sciaganie pliku
             toBreak = true;
             fprintf(stderr, "\n"
-                "%s - RSB - Anulowano pobieranie tego pliku...\n",
-                Time::stamp());
+                "%s - RSB - Anulowano pobieranie pliku '%s'...\n",
+                Time::stamp(), url);
 
             fstream qrap(Q_raports, ios::out|ios::app);
-            qrap << "CANCEL " << url.c_str() << endl;
+            qrap << "CANCEL " << url << endl;
           }
           break;
         case RSDownloader::NotFound:
           { // Nie znaleziono pliku
             toBreak = true;
             fprintf(stderr, "\n"
-                "%s - RSB - Nie znaleziono takiego pliku w serwisie...\n",
-                Time::stamp());
+                "%s - RSB - Nie znaleziono pliku '%s' w serwisie...\n",
+                Time::stamp(), url);
+
+            fstream qrap(Q_raports, ios::out|ios::app);
+            qrap << "NOTFOUND " << url << endl;
+          }
+          break;
+        case RSDownloader::NoSpace:
+          { // Plik nie zmiesci sie na dysku
+            toBreak = true;
+            fprintf(stderr, "\n"
+                "%s - RSB - Brak miejsca na dysku na plik '%s'...\n",
+                Time::stamp(), url);
 
             fstream qrap(Q_raports, ios::out|ios::app);
-            qrap << "NOTFOUND " << url.c_str() << endl;
+            qrap << "NOSPACE " << url << endl;
           }
           break;
         case RSDownloader::Downloading:
           { // Plik jest pobierany
             uint64_t eta = (bytes) ? ((size*1000ULL - bytes) * usecs / bytes / 1000000ULL ) : 0ULL,
-                     v1 = usecs ? (1000ULL*bytes/usecs) : 0ULL, v2 = usecs ? ((1000000ULL*bytes/usecs)%1000ULL) : 0ULL,
-                     th = usecs/3600000000ULL, tm = (usecs/60000000ULL)%60, ts = (usecs/1000000ULL)%60,
                      eh = eta/3600ULL, em = (eta/60ULL)%60ULL, es = eta%60ULL;
-            fprintf(stderr, 
-                "%s - RSB - Postep: %6llu.%.3llu KB %llu:%.2llu:%.2llu (srd: %4llu.%.3llu KB/s chw: %4llu.%.3llu KB/s roz: %6llu KB ETA: %llu:%.2llu:%.2llu)   \r",
-                Time::stamp(), bytes/1000ULL, bytes%1000ULL, th, tm, ts, v1, v2, ((uint64_t)speed)/1000ULL, ((uint64_t)speed)%1000ULL, size, eh, em, es);
+            snprintf(buf, sizeof(buf), "[#%u %llu KB %llu KB/s ETA %llu:%.2llu:%.2llu] ",
+                r->first, (unsigned long long)bytes/1000ULL, ((unsigned long long)speed)/1000ULL, 
+                (unsigned long long)eh, (unsigned long long)em, (unsigned long long)es);
+            line += buf;
           }
           break;
+        case RSDownloader::Queued:
+        case RSDownloader::Ready:
+        case RSDownloader::Paused:
         case RSDownloader::Preparing:
           { // Trwaja przygotowania
-            fprintf(stderr,
-                "%s - RSB - Przygotowania do pobierania pliku...                                                                               \r",
-                Time::stamp());
+            snprintf(buf, sizeof(buf), "[#%u %s] ", r->first, RSDownloader::descr(status));
+            line += buf;
           }
           break;
         case RSDownloader::Waiting:
@@ -202,9 +261,8 @@ int main(int argc, char **argv)
         case RSDownloader::Limit:
         case RSDownloader::Busy:
           {
-            fprintf(stderr, 
-                "%s - RSB - Status: '%s' , oczekuje: %u sek                                                                                    \r",
-                Time::stamp(), RSDownloader::descr(status), waiting);
+            snprintf(buf, sizeof(buf), "[#%u %s, %u sek] ", r->first, RSDownloader::descr(status), (unsigned)waiting);
+            line += buf;
           }
           break;
         default:
@@ -212,14 +270,29 @@ int main(int argc, char **argv)
               status, RSDownloader::descr(status));
       };
 
-      if (toBreak) { queue.pop_front(); break; }
+      if (toBreak) {
+        list<string>::iterator q = find(queue.begin(), queue.end(), r->second);
+        if (q != queue.end()) queue.erase(q);
+        done.push_back(r->first);
+      }
+    }
 
-      usleep(250000);
+    for (list<DownloaderPool::Job>::iterator d = done.begin(); d != done.end(); ++d) {
+      pool.forget(*d);
+      running.erase(*d);
     }
+
+    if (!done.empty()) { update_pri(queue); continue; } // od razu nastepne
+
+    fprintf(stderr, "%s - RSB - %s          \r", Time::stamp(), line.c_str());
+
+    usleep(250000);
   }
 
   // Kolejka jest pusta
 
+  SessionArchive::instance().flush(); // strony z ostatnich pobran na dysk
+
   fprintf(stderr, 
       "%s - RSB - Brak plikow do pobierania. Koniec !!\n",
       Time::stamp());
@@ -0,0 +1,335 @@
+/**
+ * @brief Zapis do pliku w tle - duze bufory oddawane watkowi dyskowemu.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/AsyncWriter.hh>
+#include <rs/Exception.hh>
+
+#include <deque>
+#include <cstring>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/**
+ * Jeden watek dla wszystkich pisarzy - bufory sa zapisywane w kolejnosci
+ * oddania, wiec bufory jednego pisarza wracaja do niego po kolei.
+ */
+class DiskThread {
+  public:
+    static DiskThread &instance(void)
+    {
+      static DiskThread disk;
+      return disk;
+    }
+
+    void push(AsyncWriter::Buffer *b) throw()
+    {
+      {
+        Lock l(m_lock);
+        m_queue.push_back(b);
+      }
+      if (sem_post(&m_ready))
+        throw EInternal("sem_post: %d, %s", errno, strerror(errno));
+    }
+
+  private:
+    DiskThread(void) throw()
+    {
+      if (sem_init(&m_ready, 0, 0))
+        throw EInternal("sem_init: %d, %s", errno, strerror(errno));
+
+      pthread_attr_t pat;
+      int ret;
+
+      if ((ret = pthread_attr_init(&pat)) != 0)
+        throw EInternal("pthread_attr_init: %d, %s", ret, strerror(ret));
+      if ((ret = pthread_create(&m_pth, &pat, DiskThread::s_thread_fn, this)) != 0)
+        throw EInternal("pthread_create: %d, %s", ret, strerror(ret));
+      if ((ret = pthread_attr_destroy(&pat)) != 0)
+        throw EInternal("pthread_attr_destroy: %d, %s", ret, strerror(ret));
+    }
+
+    ~DiskThread(void) throw()
+    {
+      int ret;
+
+      if ((ret = pthread_cancel(m_pth)) != 0)
+        throw EInternal("pthread_cancel: %d, %s", ret, strerror(ret));
+    }
+
+    DiskThread(const DiskThread &);
+
+    static void *s_thread_fn(void *ptr)
+    {
+      ((DiskThread*)ptr)->thread_fn();
+      return NULL;
+    }
+
+    // Bez throw() - pthread_cancel przy wyjsciu przechodzi przez sem_wait
+    void thread_fn(void)
+    {
+      int old;
+
+      for (;;) {
+        while (sem_wait(&m_ready))
+          if (errno != EINTR) throw EInternal("sem_wait: %d, %s", errno, strerror(errno));
+
+        // Zaczetego bufora nie przerywamy
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &old);
+
+        AsyncWriter::Buffer *b;
+        {
+          Lock l(m_lock);
+          b = m_queue.front();
+          m_queue.pop_front();
+        }
+
+        b->owner->done(b, flush(b));
+
+        pthread_setcancelstate(old, NULL);
+      }
+    }
+
+    static bool flush(AsyncWriter::Buffer *b) throw()
+    {
+      AsyncWriter *w = b->owner;
+      size_t done = 0;
+
+      if (w->m_failed) return false;
+
+      while (done < b->len) {
+        ssize_t wr = w->m_positional ?
+          pwrite(w->m_fd, b->data + done, b->len - done, b->pos + done) :
+          ::write(w->m_fd, b->data + done, b->len - done);
+        if (wr < 0) {
+          if (errno == EINTR || errno == EAGAIN) continue;
+          return false;
+        }
+        done += wr;
+      }
+
+      return true;
+    }
+
+    pthread_t m_pth;
+    sem_t m_ready;
+    Mutex m_lock;
+    std::deque<AsyncWriter::Buffer*> m_queue;
+};
+
+static AsyncWriter::Policy s_policy = { AsyncWriter::MinBuffer, 2, 0 };
+
+void AsyncWriter::setPolicy(const Policy &p) throw()
+{
+  s_policy = p;
+  if (s_policy.buffer) {
+    if (s_policy.buffer < MinBuffer) s_policy.buffer = MinBuffer;
+    if (s_policy.buffer > MaxBuffer) s_policy.buffer = MaxBuffer;
+  }
+  if (s_policy.buffers < 2) s_policy.buffers = 2;
+}
+
+AsyncWriter::Policy AsyncWriter::policy(void) throw()
+{
+  return s_policy;
+}
+
+AsyncWriter::AsyncWriter(void) throw()
+  : m_bufs(NULL), m_count(0), m_cur(0), m_held(false), m_spare(false), m_fd(-1),
+  m_positional(false), m_failed(false), m_pos(0), m_written(0), m_unsynced(0),
+  m_busy(0), m_waiting(false), m_wake(NULL), m_drained(NULL), m_wdata(NULL), m_ddata(NULL)
+{
+  m_policy = s_policy;
+}
+
+AsyncWriter::~AsyncWriter(void) throw()
+{
+  if (m_fd >= 0) end();
+  release();
+}
+
+void AsyncWriter::release(void) throw()
+{
+  // Wszystkie bufory wolne - zabieramy je z semafora
+  for (unsigned i = 0; i < m_count; ++i) {
+    m_free.p();
+    free(m_bufs[i].data);
+  }
+  delete[] m_bufs;
+  m_bufs = NULL;
+  m_count = m_cur = 0;
+}
+
+bool AsyncWriter::begin(int fd, off_t pos, bool positional) throw()
+{
+  if (m_fd >= 0) end();
+
+  // Zmiana polityki - nowe bufory
+  Policy p = s_policy;
+  if (m_bufs && (p.buffer != m_policy.buffer || p.buffers != m_policy.buffers)) release();
+  m_policy = p;
+
+  if (!m_bufs) {
+    if (!m_policy.buffer) return false;
+    if (!(m_bufs = new(std::nothrow) Buffer[m_policy.buffers])) return false;
+
+    for (m_count = 0; m_count < m_policy.buffers; ++m_count) {
+      void *mem;
+      if (posix_memalign(&mem, 4096, m_policy.buffer)) {
+        for (unsigned i = 0; i < m_count; ++i) free(m_bufs[i].data);
+        delete[] m_bufs;
+        m_bufs = NULL;
+        m_count = 0;
+        return false;
+      }
+      m_bufs[m_count].owner = this;
+      m_bufs[m_count].data = (char*)mem;
+      m_bufs[m_count].len = 0;
+      m_free.v();
+    }
+    m_cur = 0;
+  }
+
+  DiskThread::instance(); // watek startuje przy pierwszym pisarzu
+
+  m_fd = fd;
+  m_positional = positional;
+  m_failed = false;
+  m_pos = m_written = pos;
+  m_unsynced = 0;
+  m_held = m_spare = m_waiting = false;
+  m_drained = NULL;
+
+  return true;
+}
+
+bool AsyncWriter::write(const char *buf, size_t len) throw()
+{
+  while (len) {
+    if (m_failed) return false;
+
+    if (!m_held) { // Czekamy az dysk odda najstarszy bufor (chyba ze room())
+      if (m_spare) m_spare = false;
+      else m_free.p();
+      m_held = true;
+      m_bufs[m_cur].len = 0;
+      m_bufs[m_cur].pos = m_pos;
+    }
+
+    Buffer &b = m_bufs[m_cur];
+    size_t n = m_policy.buffer - b.len;
+    if (n > len) n = len;
+
+    memcpy(b.data + b.len, buf, n);
+    b.len += n;
+    m_pos += n;
+    buf += n;
+    len -= n;
+
+    if (b.len == m_policy.buffer && !submit()) return false;
+  }
+
+  return !m_failed;
+}
+
+bool AsyncWriter::room(size_t len) throw()
+{
+  if (m_failed || m_spare) return true; // bledem zajmie sie write()
+  if (m_held && m_policy.buffer - m_bufs[m_cur].len >= len) return true;
+
+  // Pod blokada - done() nie moze zwolnic bufora miedzy proba a m_waiting
+  Lock l(m_lock);
+  if (m_free.tryp()) {
+    m_spare = true;
+    return true;
+  }
+  m_waiting = true;
+  return false;
+}
+
+bool AsyncWriter::submit(void) throw()
+{
+  Buffer *b = &m_bufs[m_cur];
+
+  {
+    Lock l(m_lock);
+    ++m_busy;
+  }
+  m_held = false;
+  m_cur = (m_cur + 1) % m_count;
+  DiskThread::instance().push(b);
+
+  return !m_failed;
+}
+
+bool AsyncWriter::end(void) throw()
+{
+  if (m_fd < 0) return !m_failed;
+
+  if (m_spare) { m_spare = false; m_free.v(); }
+  if (m_held) {
+    if (m_bufs[m_cur].len) submit();
+    else { m_held = false; m_free.v(); }
+  }
+
+  // Wszystkie bufory z powrotem u nas = wszystko zapisane
+  for (unsigned i = 0; i < m_count; ++i) m_free.p();
+  for (unsigned i = 0; i < m_count; ++i) m_free.v();
+
+  Lock l(m_lock); // done() moze jeszcze trzymac blokade po ostatnim v()
+  m_fd = -1;
+  return !m_failed;
+}
+
+bool AsyncWriter::drain(wake_fn fn, void *data) throw()
+{
+  if (m_fd < 0) return true;
+
+  if (m_spare) { m_spare = false; m_free.v(); }
+  if (m_held) {
+    if (m_bufs[m_cur].len) submit();
+    else { m_held = false; m_free.v(); }
+  }
+
+  Lock l(m_lock);
+  if (!m_busy) return true;
+  m_drained = fn;
+  m_ddata = data;
+  return false;
+}
+
+off_t AsyncWriter::written(void) throw()
+{
+  Lock l(m_lock);
+  return m_written;
+}
+
+void AsyncWriter::done(Buffer *b, bool ok) throw()
+{
+  if (ok && m_policy.sync && (m_unsynced += b->len) >= m_policy.sync) {
+    ok = fdatasync(m_fd) == 0;
+    m_unsynced = 0;
+  }
+
+  // Budzimy pod blokada - room() i drain() widza bufor i funkcje razem,
+  // a kolejnosc wywolan (wake przed drained) jest zachowana
+  Lock l(m_lock);
+  if (ok) m_written = b->pos + b->len;
+  else m_failed = true;
+
+  m_free.v();
+  --m_busy;
+
+  if (m_waiting) {
+    m_waiting = false;
+    if (m_wake) m_wake(m_wdata);
+  }
+  if (!m_busy && m_drained) {
+    wake_fn fn = m_drained;
+    m_drained = NULL;
+    fn(m_ddata);
+  }
+}
+
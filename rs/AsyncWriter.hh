@@ -0,0 +1,118 @@
+/**
+ * @brief Zapis do pliku w tle - duze bufory oddawane watkowi dyskowemu.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_ASYNC_WRITER_HH__
+#define __RS_ASYNC_WRITER_HH__
+
+#ifndef _FILE_OFFSET_BITS
+# define _FILE_OFFSET_BITS 64
+#elif _FILE_OFFSET_BITS != 64
+# error "_FILE_OFFSET_BITS != 64"
+#endif
+
+#include <sys/types.h>
+#include <cstdlib>
+
+#include <rs/Mutex.hh>
+#include <rs/Semaphore.hh>
+
+/**
+ * Dane z sieci sa dopisywane do biezacego bufora, a pelny bufor idzie do
+ * kolejki jednego, wspolnego watku dyskowego (write/pwrite). Kazdy pisarz
+ * ma pierscien kilku buforow - gdy wszystkie czekaja na dysk, room() mowi
+ * "nie" (watek HttpEngine wstrzymuje wtedy transfer zamiast czekac), a gdy
+ * dysk odda bufor, wolana jest funkcja z setWake(). Koniec tez bez czekania:
+ * drain() wola swoja funkcje z watku dyskowego po ostatnim buforze.
+ *
+ * Bufory sa wyrownane do strony i zostaja miedzy kolejnymi begin().
+ */
+class AsyncWriter {
+  public:
+    struct Policy {
+      size_t buffer;    // rozmiar bufora, 0 - bez pisarza (zwykly write)
+      unsigned buffers; // ile buforow w pierscieniu (>= 2)
+      off_t sync;       // fdatasync co tyle bajtow, 0 - zostawiamy jadru
+    };
+
+    static const size_t MinBuffer = 1024*1024, MaxBuffer = 8*1024*1024;
+
+    // Polityka dla nowych pisarzy (bufor przycinany do [MinBuffer, MaxBuffer])
+    static void setPolicy(const Policy &p) throw();
+    static Policy policy(void) throw();
+
+    AsyncWriter(void) throw();
+    ~AsyncWriter(void) throw();
+
+    /**
+     * @brief Zacznij pisac do fd od pos (positional - pwrite, inaczej write
+     * tam gdzie stoi fd). fd nie jest zamykany. false - brak pamieci.
+     */
+    bool begin(int fd, off_t pos, bool positional) throw();
+
+    // Funkcja wolana z watku dyskowego (pod blokada pisarza - bez czekania)
+    typedef void (*wake_fn)(void *data);
+
+    // Kogo obudzic, gdy room() powiedzialo "nie", a dysk oddal bufor
+    void setWake(wake_fn fn, void *data) throw() { m_wake = fn; m_wdata = data; }
+
+    /**
+     * @brief Czy write(len) zmiesci sie bez czekania na dysk. Wolny bufor
+     * jest od razu odkladany dla write(). false - po zwolnieniu bufora
+     * przyjdzie setWake().
+     */
+    bool room(size_t len) throw();
+
+    // Dopisz dane, bez room() moze czekac na wolny bufor. false - blad zapisu.
+    bool write(const char *buf, size_t len) throw();
+
+    /**
+     * @brief Oddaj resztke dyskowi bez czekania. true - wszystko juz w
+     * pliku, inaczej fn(data) przyjdzie z watku dyskowego po ostatnim
+     * buforze. Potem end() juz nie czeka.
+     */
+    bool drain(wake_fn fn, void *data) throw();
+
+    // Oddaj resztke i poczekaj na wszystko. false - ktorys zapis sie nie udal.
+    bool end(void) throw();
+
+    // Do kad dane sa juz w pliku (oddane jadru)
+    off_t written(void) throw();
+    bool failed(void) const { return m_failed; }
+
+  private:
+    AsyncWriter(const AsyncWriter &);
+    friend class DiskThread; // AsyncWriter.cc
+
+    struct Buffer {
+      AsyncWriter *owner;
+      char *data;
+      size_t len;
+      off_t pos;
+    };
+
+    Policy m_policy;
+    Buffer *m_bufs;
+    unsigned m_count, m_cur; // liczba buforow i ten, ktory wypelniamy
+    bool m_held;             // czy m_cur jest nasz (wziety z m_free)
+    bool m_spare;            // nastepny bufor juz wziety przez room()
+    Semaphore m_free;        // wolne bufory
+    Mutex m_lock;
+    int m_fd;
+    bool m_positional;
+    volatile bool m_failed;
+    off_t m_pos;             // gdzie trafi nastepny bajt
+    off_t m_written, m_unsynced;
+    unsigned m_busy;         // bufory u dysku
+    bool m_waiting;          // room() powiedzialo "nie"
+    wake_fn m_wake, m_drained;
+    void *m_wdata, *m_ddata;
+
+    bool submit(void) throw();
+    void done(Buffer *b, bool ok) throw(); // z watku dyskowego
+    void release(void) throw();
+};
+
+#endif
+
@@ -0,0 +1,70 @@
+/**
+ * @brief Zmienna warunkowa (na zegarze monotonicznym)
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_CONDITION_HH__
+#define __RS_CONDITION_HH__
+
+#include <pthread.h>
+#include <ctime>
+#include <stdint.h>
+#include <rs/Mutex.hh>
+
+class Condition {
+  public:
+    Condition(void) throw()
+    {
+      pthread_condattr_t attr;
+      int p = pthread_condattr_init(&attr);
+      if (!p) p = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+      if (!p) p = pthread_cond_init(&c, &attr);
+      pthread_condattr_destroy(&attr);
+      if (p) throw EInternal("Condition::Condition(): Error: %d, %s", p, strerror(p));
+    }
+
+    ~Condition(void) throw()
+    {
+      int p = pthread_cond_destroy(&c);
+      if (p) throw EInternal("Condition::~Condition(): Error: %d, %s", p, strerror(p));
+    }
+
+    // Czekaj (m zablokowany przez wolajacego)
+    void wait(Mutex &m) throw()
+    {
+      int p = pthread_cond_wait(&c, &m.m);
+      if (p) throw EInternal("Condition::wait(): Error: %d, %s", p, strerror(p));
+    }
+
+    // Czekaj najdalej do until (Time::mono_msec()), false - minal czas
+    bool wait(Mutex &m, uint64_t until) throw()
+    {
+      timespec ts;
+      ts.tv_sec = until/1000;
+      ts.tv_nsec = (until%1000)*1000000;
+
+      int p = pthread_cond_timedwait(&c, &m.m, &ts);
+      if (p == ETIMEDOUT) return false;
+      if (p) throw EInternal("Condition::wait(): Error: %d, %s", p, strerror(p));
+      return true;
+    }
+
+    void signal(void) throw()
+    {
+      int p = pthread_cond_signal(&c);
+      if (p) throw EInternal("Condition::signal(): Error: %d, %s", p, strerror(p));
+    }
+
+    void broadcast(void) throw()
+    {
+      int p = pthread_cond_broadcast(&c);
+      if (p) throw EInternal("Condition::broadcast(): Error: %d, %s", p, strerror(p));
+    }
+
+  private:
+    Condition(const Condition &); /* non-copyable */
+    pthread_cond_t c;
+};
+
+#endif
+
@@ -0,0 +1,190 @@
+/**
+ * @brief Ciasteczka http - wspolne dla wielu obiektow Http i watkow.
+ * @author Piotr Truszkowski
+ */
+
+#include <curl/curl.h>
+
+#include <rs/CookieJar.hh>
+
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+bool CookieJar::split(const char *url, std::string &host, std::string &path, bool &secure)
+{
+  const char *bgn = strstr(url, "://");
+  secure = bgn && (bgn - url) == 5 && strncasecmp(url, "https", 5) == 0;
+  bgn = bgn ? bgn + 3 : url;
+
+  const char *end = bgn;
+  while (*end && *end != '/' && *end != '?' && *end != '#' && *end != ':') ++end;
+  if (end == bgn) return false;
+
+  host.assign(bgn, end - bgn);
+  for (size_t i = 0; i < host.size(); ++i) host[i] = tolower(host[i]);
+
+  while (*end && *end != '/' && *end != '?' && *end != '#') ++end; // port
+  const char *pend = end;
+  while (*pend && *pend != '?' && *pend != '#') ++pend;
+
+  path.assign(end, pend - end);
+  if (path.empty()) path = "/";
+
+  return true;
+}
+
+static const char *skip_blank(const char *p)
+{
+  while (*p == ' ' || *p == '\t') ++p;
+  return p;
+}
+
+// Czy sciezka zadania pasuje do sciezki ciastka (RFC 6265, 5.1.4)
+static bool path_match(const std::string &req, const std::string &cpath)
+{
+  if (req.compare(0, cpath.size(), cpath) != 0) return false;
+  return req.size() == cpath.size() || cpath[cpath.size()-1] == '/' || req[cpath.size()] == '/';
+}
+
+void CookieJar::set(const char *url, const char *setcookie) throw()
+{
+  std::string host, rpath;
+  bool rsecure;
+
+  if (!split(url, host, rpath, rsecure)) return;
+
+  Cookie c;
+  c.expires = 0;
+  c.secure = false;
+  c.hostonly = true;
+
+  // "nazwa=wartosc" do pierwszego ';'
+  const char *p = skip_blank(setcookie), *eq = strchr(p, '='), *sc = strchr(p, ';');
+  if (!eq || (sc && sc < eq) || eq == p) return;
+
+  c.name.assign(p, eq - p);
+  c.value.assign(eq + 1, sc ? sc - eq - 1 : strlen(eq + 1));
+
+  std::string domain = host;
+  bool remove = false, maxage = false;
+
+  // Atrybuty
+  while (sc) {
+    p = skip_blank(sc + 1);
+    sc = strchr(p, ';');
+
+    const char *aend = sc ? sc : p + strlen(p);
+    const char *aeq = (const char*)memchr(p, '=', aend - p);
+    size_t nlen = (aeq ? aeq : aend) - p;
+    while (nlen && (p[nlen-1] == ' ' || p[nlen-1] == '\t')) --nlen;
+    std::string val = aeq ? std::string(skip_blank(aeq + 1), aend) : std::string();
+
+    if (nlen == 6 && strncasecmp(p, "Domain", 6) == 0 && !val.empty()) {
+      if (val[0] == '.') val.erase(0, 1);
+      for (size_t i = 0; i < val.size(); ++i) val[i] = tolower(val[i]);
+      // Domena musi obejmowac hosta, inaczej ciastko odrzucamy
+      if (host != val && (host.size() <= val.size() ||
+            host.compare(host.size() - val.size(), val.size(), val) != 0 ||
+            host[host.size() - val.size() - 1] != '.')) return;
+      domain = val;
+      c.hostonly = false;
+    } else if (nlen == 4 && strncasecmp(p, "Path", 4) == 0 && !val.empty() && val[0] == '/') {
+      c.path = val;
+    } else if (nlen == 7 && strncasecmp(p, "Expires", 7) == 0 && !maxage) {
+      time_t t = curl_getdate(val.c_str(), NULL);
+      if (t > 0) { c.expires = t; remove = t <= time(NULL); }
+    } else if (nlen == 7 && strncasecmp(p, "Max-Age", 7) == 0) {
+      long age = strtol(val.c_str(), NULL, 10);
+      remove = age <= 0;
+      maxage = true; // Max-Age ma pierwszenstwo przed Expires
+      c.expires = time(NULL) + age;
+    } else if (nlen == 6 && strncasecmp(p, "Secure", 6) == 0) {
+      c.secure = true;
+    }
+  }
+
+  if (c.path.empty()) { // Domyslnie katalog sciezki zadania
+    size_t slash = rpath.rfind('/');
+    c.path = (slash == 0 || slash == std::string::npos) ? "/" : rpath.substr(0, slash);
+  }
+
+  Lock l(m_lock);
+  std::vector<Cookie> &v = m_domains[domain];
+
+  for (size_t i = 0; i < v.size(); ++i) {
+    if (v[i].name != c.name || v[i].path != c.path) continue;
+    if (remove) v.erase(v.begin() + i);
+    else v[i] = c;
+    return;
+  }
+
+  if (!remove) v.push_back(c);
+}
+
+bool CookieJar::header(const char *url, std::string &out) throw()
+{
+  std::string host, path;
+  bool secure;
+
+  out.clear();
+  if (!split(url, host, path, secure)) return false;
+
+  time_t now = time(NULL);
+  Lock l(m_lock);
+
+  // Host i kolejne domeny nadrzedne: a.b.c, b.c, c
+  for (size_t pos = 0; ; ) {
+    Domains::iterator d = m_domains.find(host.substr(pos));
+
+    if (d != m_domains.end()) {
+      std::vector<Cookie> &v = d->second;
+      for (size_t i = 0; i < v.size(); ++i) {
+        const Cookie &c = v[i];
+        if (c.hostonly && pos) continue;
+        if (c.expires && c.expires <= now) continue;
+        if (c.secure && !secure) continue;
+        if (!path_match(path, c.path)) continue;
+
+        if (!out.empty()) out += "; ";
+        out += c.name;
+        out += '=';
+        out += c.value;
+      }
+    }
+
+    size_t dot = host.find('.', pos);
+    if (dot == std::string::npos) break;
+    pos = dot + 1;
+  }
+
+  return !out.empty();
+}
+
+void CookieJar::expire(void) throw()
+{
+  time_t now = time(NULL);
+  Lock l(m_lock);
+
+  for (Domains::iterator d = m_domains.begin(); d != m_domains.end(); ++d) {
+    std::vector<Cookie> &v = d->second;
+    for (size_t i = 0; i < v.size(); )
+      if (v[i].expires && v[i].expires <= now) v.erase(v.begin() + i);
+      else ++i;
+  }
+}
+
+void CookieJar::clear(void) throw()
+{
+  Lock l(m_lock);
+  m_domains.clear();
+}
+
+size_t CookieJar::size(void) throw()
+{
+  Lock l(m_lock);
+  size_t n = 0;
+  for (Domains::iterator d = m_domains.begin(); d != m_domains.end(); ++d) n += d->second.size();
+  return n;
+}
+
@@ -0,0 +1,57 @@
+/**
+ * @brief Ciasteczka http - wspolne dla wielu obiektow Http i watkow.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_COOKIE_JAR_HH__
+#define __RS_COOKIE_JAR_HH__
+
+#include <rs/Mutex.hh>
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+class CookieJar {
+  public:
+    CookieJar(void) throw() { }
+    ~CookieJar(void) throw() { }
+
+    /**
+     * @brief Zapamietaj ciastko z naglowka "Set-Cookie:" odpowiedzi na url.
+     * Ciastko z data w przeszlosci (lub Max-Age <= 0) jest usuwane.
+     */
+    void set(const char *url, const char *setcookie) throw();
+
+    /**
+     * @brief Ciastka do wyslania pod url, w postaci "a=b; c=d".
+     * false - nie ma zadnych.
+     */
+    bool header(const char *url, std::string &out) throw();
+
+    // Usun przeterminowane ciastka
+    void expire(void) throw();
+    void clear(void) throw();
+    size_t size(void) throw();
+
+  private:
+    CookieJar(const CookieJar &);
+
+    struct Cookie {
+      std::string name, value, path;
+      time_t expires; // 0 - do konca sesji
+      bool secure, hostonly;
+    };
+
+    // Po domenie (bez kropki na poczatku), w niej po sciezce i nazwie
+    typedef std::tr1::unordered_map<std::string, std::vector<Cookie> > Domains;
+
+    Mutex m_lock;
+    Domains m_domains;
+
+    static bool split(const char *url, std::string &host, std::string &path, bool &secure);
+};
+
+#endif
+
@@ -0,0 +1,408 @@
+/**
+ * @brief Skroty pobieranych danych liczone w locie (CRC32C, xxHash64, SHA-256).
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/Digest.hh>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <nmmintrin.h>
+# define RS_CRC32C_HW 1
+#endif
+
+bool Digest::read(int fd, off_t from, off_t to) throw()
+{
+  static const size_t bsize = 256*1024;
+  char *buf = new(std::nothrow) char[bsize];
+  if (!buf) return false;
+
+  while (from < to) {
+    size_t want = (to - from) < (off_t)bsize ? (size_t)(to - from) : bsize;
+    ssize_t rd = pread(fd, buf, want, from);
+    if (rd < 0 && errno == EINTR) continue;
+    if (rd <= 0) { delete[] buf; return false; }
+    update(buf, rd);
+    from += rd;
+  }
+
+  delete[] buf;
+  return true;
+}
+
+Digest *Digest::create(const char *name) throw()
+{
+  if (!name) return NULL;
+  if (!strcmp(name, "crc32c")) return new(std::nothrow) Crc32c();
+  if (!strcmp(name, "xxh64")) return new(std::nothrow) XXHash64();
+  if (!strcmp(name, "sha256")) return new(std::nothrow) Sha256();
+  return NULL;
+}
+
+/* CRC32C (Castagnoli), odwrocony wielomian 0x82f63b78 */
+
+static const uint32_t Crc32cPoly = 0x82f63b78;
+
+// Programowo - po 8 bajtow naraz (slicing-by-8)
+static uint32_t crc32c_table[8][256];
+
+static bool crc32c_init(void) throw()
+{
+  for (uint32_t n = 0; n < 256; ++n) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ Crc32cPoly : c >> 1;
+    crc32c_table[0][n] = c;
+  }
+  for (uint32_t n = 0; n < 256; ++n)
+    for (int k = 1; k < 8; ++k)
+      crc32c_table[k][n] = (crc32c_table[k-1][n] >> 8) ^ crc32c_table[0][crc32c_table[k-1][n] & 0xff];
+  return true;
+}
+
+static const bool crc32c_inited = crc32c_init();
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) throw()
+{
+  while (len && ((uintptr_t)p & 7)) {
+    crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    --len;
+  }
+
+  while (len >= 8) {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+      crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+      crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+      crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+
+  while (len--) crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+#ifdef RS_CRC32C_HW
+// Instrukcja crc32 z SSE4.2 - kompilowana zawsze, wolana gdy procesor ja ma
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char *p, size_t len) throw()
+{
+  while (len && ((uintptr_t)p & 7)) { crc = _mm_crc32_u8(crc, *p++); --len; }
+
+# ifdef __x86_64__
+  uint64_t c = crc;
+  while (len >= 8) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)c;
+# endif
+  while (len >= 4) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    crc = _mm_crc32_u32(crc, v);
+    p += 4;
+    len -= 4;
+  }
+
+  while (len--) crc = _mm_crc32_u8(crc, *p++);
+
+  return crc;
+}
+#endif
+
+bool Crc32c::hardware(void) throw()
+{
+#ifdef RS_CRC32C_HW
+  static const bool hw = __builtin_cpu_supports("sse4.2");
+  return hw;
+#else
+  return false;
+#endif
+}
+
+void Crc32c::update(const char *buf, size_t len)
+{
+#ifdef RS_CRC32C_HW
+  if (hardware()) { m_crc = crc32c_hw(m_crc, (const unsigned char*)buf, len); return; }
+#endif
+  m_crc = crc32c_sw(m_crc, (const unsigned char*)buf, len);
+}
+
+std::string Crc32c::hex(void) const
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%08x", value());
+  return buf;
+}
+
+// Mnozenie macierzy nad GF(2) - jak crc32_combine z zlib
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec) throw()
+{
+  uint32_t sum = 0;
+  for (; vec; vec >>= 1, ++mat) if (vec & 1) sum ^= *mat;
+  return sum;
+}
+
+static void gf2_square(uint32_t *sq, const uint32_t *mat) throw()
+{
+  for (int n = 0; n < 32; ++n) sq[n] = gf2_times(mat, mat[n]);
+}
+
+bool Crc32c::combine(const Digest &next, off_t len)
+{
+  const Crc32c *n = dynamic_cast<const Crc32c*>(&next);
+  if (!n) return false;
+  if (len <= 0) return true;
+
+  uint32_t crc1 = value(), even[32], odd[32], row = 1;
+
+  // Operator dopisania jednego zerowego bitu, potem 2, 4, ... bajtow
+  odd[0] = Crc32cPoly;
+  for (int k = 1; k < 32; ++k, row <<= 1) odd[k] = row;
+  gf2_square(even, odd);
+  gf2_square(odd, even);
+
+  do {
+    gf2_square(even, odd);
+    if (len & 1) crc1 = gf2_times(even, crc1);
+    len >>= 1;
+    if (!len) break;
+    gf2_square(odd, even);
+    if (len & 1) crc1 = gf2_times(odd, crc1);
+    len >>= 1;
+  } while (len);
+
+  m_crc = ~(crc1 ^ n->value());
+  return true;
+}
+
+/* xxHash64 */
+
+static const uint64_t P64_1 = 11400714785074694791ULL;
+static const uint64_t P64_2 = 14029467366897019727ULL;
+static const uint64_t P64_3 = 1609587929392839161ULL;
+static const uint64_t P64_4 = 9650029242287828579ULL;
+static const uint64_t P64_5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t read64(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint32_t read32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in)
+{
+  acc += in * P64_2;
+  acc = rotl64(acc, 31);
+  return acc * P64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val)
+{
+  acc ^= xxh_round(0, val);
+  return acc * P64_1 + P64_4;
+}
+
+void XXHash64::reset(void)
+{
+  m_v[0] = m_seed + P64_1 + P64_2;
+  m_v[1] = m_seed + P64_2;
+  m_v[2] = m_seed;
+  m_v[3] = m_seed - P64_1;
+  m_total = 0;
+  m_memlen = 0;
+}
+
+void XXHash64::update(const char *buf, size_t len)
+{
+  const unsigned char *p = (const unsigned char*)buf, *end = p + len;
+  m_total += len;
+
+  if (m_memlen + len < 32) {
+    memcpy(m_mem + m_memlen, p, len);
+    m_memlen += len;
+    return;
+  }
+
+  if (m_memlen) { // Dopelnij zaczety blok
+    size_t n = 32 - m_memlen;
+    memcpy(m_mem + m_memlen, p, n);
+    for (int i = 0; i < 4; ++i) m_v[i] = xxh_round(m_v[i], read64(m_mem + 8*i));
+    p += n;
+    m_memlen = 0;
+  }
+
+  uint64_t v1 = m_v[0], v2 = m_v[1], v3 = m_v[2], v4 = m_v[3];
+  for (; p + 32 <= end; p += 32) {
+    v1 = xxh_round(v1, read64(p));
+    v2 = xxh_round(v2, read64(p + 8));
+    v3 = xxh_round(v3, read64(p + 16));
+    v4 = xxh_round(v4, read64(p + 24));
+  }
+  m_v[0] = v1; m_v[1] = v2; m_v[2] = v3; m_v[3] = v4;
+
+  m_memlen = end - p;
+  memcpy(m_mem, p, m_memlen);
+}
+
+uint64_t XXHash64::value(void) const
+{
+  uint64_t h;
+
+  if (m_total >= 32) {
+    h = rotl64(m_v[0], 1) + rotl64(m_v[1], 7) + rotl64(m_v[2], 12) + rotl64(m_v[3], 18);
+    for (int i = 0; i < 4; ++i) h = xxh_merge(h, m_v[i]);
+  } else {
+    h = m_seed + P64_5;
+  }
+
+  h += m_total;
+
+  const unsigned char *p = m_mem, *end = m_mem + m_memlen;
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxh_round(0, read64(p));
+    h = rotl64(h, 27) * P64_1 + P64_4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)read32(p) * P64_1;
+    h = rotl64(h, 23) * P64_2 + P64_3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= (*p) * P64_5;
+    h = rotl64(h, 11) * P64_1;
+  }
+
+  h ^= h >> 33;
+  h *= P64_2;
+  h ^= h >> 29;
+  h *= P64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+std::string XXHash64::hex(void) const
+{
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)value());
+  return buf;
+}
+
+/* SHA-256 (FIPS 180-4) */
+
+static const uint32_t Sha256K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr32(uint32_t x, int r) { return (x >> r) | (x << (32 - r)); }
+
+void Sha256::reset(void)
+{
+  static const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(m_h, init, sizeof(m_h));
+  m_total = 0;
+  m_blen = 0;
+}
+
+void Sha256::transform(uint32_t *h, const unsigned char *block) throw()
+{
+  uint32_t w[64];
+
+  for (int i = 0; i < 16; ++i)
+    w[i] = ((uint32_t)block[4*i] << 24) | ((uint32_t)block[4*i+1] << 16) |
+      ((uint32_t)block[4*i+2] << 8) | block[4*i+3];
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = rotr32(w[i-15], 7) ^ rotr32(w[i-15], 18) ^ (w[i-15] >> 3);
+    uint32_t s1 = rotr32(w[i-2], 17) ^ rotr32(w[i-2], 19) ^ (w[i-2] >> 10);
+    w[i] = w[i-16] + s0 + w[i-7] + s1;
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+
+  for (int i = 0; i < 64; ++i) {
+    uint32_t t1 = k + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + Sha256K[i] + w[i];
+    uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    k = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+  h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void Sha256::update(const char *buf, size_t len)
+{
+  const unsigned char *p = (const unsigned char*)buf;
+  m_total += len;
+
+  if (m_blen) {
+    size_t n = 64 - m_blen < len ? 64 - m_blen : len;
+    memcpy(m_block + m_blen, p, n);
+    m_blen += n;
+    p += n;
+    len -= n;
+    if (m_blen < 64) return;
+    transform(m_h, m_block);
+    m_blen = 0;
+  }
+
+  for (; len >= 64; p += 64, len -= 64) transform(m_h, p);
+
+  memcpy(m_block, p, len);
+  m_blen = len;
+}
+
+std::string Sha256::hex(void) const
+{
+  // Konczymy na kopii - obiekt moze liczyc dalej
+  uint32_t h[8];
+  unsigned char block[128];
+  uint64_t bits = m_total*8;
+  size_t n = m_blen < 56 ? 64 : 128;
+
+  memcpy(h, m_h, sizeof(h));
+  memset(block, 0, sizeof(block));
+  memcpy(block, m_block, m_blen);
+  block[m_blen] = 0x80;
+  for (int i = 0; i < 8; ++i) block[n-1-i] = (unsigned char)(bits >> (8*i));
+
+  transform(h, block);
+  if (n == 128) transform(h, block + 64);
+
+  char buf[72];
+  for (int i = 0; i < 8; ++i) snprintf(buf + 8*i, 9, "%08x", h[i]);
+  return buf;
+}
+
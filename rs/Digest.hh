@@ -0,0 +1,106 @@
+/**
+ * @brief Skroty pobieranych danych liczone w locie (CRC32C, xxHash64, SHA-256).
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_DIGEST_HH__
+#define __RS_DIGEST_HH__
+
+#ifndef _FILE_OFFSET_BITS
+# define _FILE_OFFSET_BITS 64
+#elif _FILE_OFFSET_BITS != 64
+# error "_FILE_OFFSET_BITS != 64"
+#endif
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <cstdlib>
+#include <string>
+
+/**
+ * Ujscie dla skrotu - Http karmi je tym, co przyszlo z sieci, wiec po
+ * pobraniu nie trzeba czytac pliku drugi raz.
+ */
+class Digest {
+  public:
+    virtual ~Digest(void) { }
+
+    virtual const char *name(void) const = 0;
+    virtual void reset(void) = 0;
+    virtual void update(const char *buf, size_t len) = 0;
+    // Wynik szesnastkowo (bez konczenia - mozna dalej dopisywac)
+    virtual std::string hex(void) const = 0;
+    // Nowy, wyzerowany skrot tego samego rodzaju
+    virtual Digest *clone(void) const = 0;
+
+    /**
+     * @brief Doklej skrot kolejnych len bajtow (liczony osobno, np. przez
+     * inny kawalek HttpSegments). false - ten rodzaj tak nie potrafi.
+     */
+    virtual bool combine(const Digest &, off_t) { return false; }
+
+    // Dopisz zakres [from, to) z pliku (pread). false - blad odczytu.
+    bool read(int fd, off_t from, off_t to) throw();
+
+    // "crc32c", "xxh64", "sha256", NULL - nieznany rodzaj
+    static Digest *create(const char *name) throw();
+};
+
+class Crc32c : public Digest {
+  public:
+    Crc32c(void) { reset(); }
+
+    const char *name(void) const { return "crc32c"; }
+    void reset(void) { m_crc = 0xffffffff; }
+    void update(const char *buf, size_t len);
+    std::string hex(void) const;
+    Digest *clone(void) const { return new(std::nothrow) Crc32c(); }
+    bool combine(const Digest &next, off_t len);
+
+    uint32_t value(void) const { return ~m_crc; }
+    // Czy liczymy instrukcja crc32 (SSE4.2)
+    static bool hardware(void) throw();
+
+  private:
+    uint32_t m_crc;
+};
+
+class XXHash64 : public Digest {
+  public:
+    XXHash64(uint64_t seed = 0) : m_seed(seed) { reset(); }
+
+    const char *name(void) const { return "xxh64"; }
+    void reset(void);
+    void update(const char *buf, size_t len);
+    std::string hex(void) const;
+    Digest *clone(void) const { return new(std::nothrow) XXHash64(m_seed); }
+
+    uint64_t value(void) const;
+
+  private:
+    uint64_t m_seed, m_v[4], m_total;
+    unsigned char m_mem[32];
+    size_t m_memlen;
+};
+
+class Sha256 : public Digest {
+  public:
+    Sha256(void) { reset(); }
+
+    const char *name(void) const { return "sha256"; }
+    void reset(void);
+    void update(const char *buf, size_t len);
+    std::string hex(void) const;
+    Digest *clone(void) const { return new(std::nothrow) Sha256(); }
+
+  private:
+    uint32_t m_h[8];
+    uint64_t m_total;
+    unsigned char m_block[64];
+    size_t m_blen;
+
+    static void transform(uint32_t *h, const unsigned char *block) throw();
+};
+
+#endif
+
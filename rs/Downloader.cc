@@ -7,8 +7,15 @@
 #include <rs/File.hh>
 #include <rs/Time.hh>
 #include <rs/Http.hh>
-
-#include <pthread.h>
+#include <rs/HttpSegments.hh>
+#include <rs/Rope.hh>
+#include <rs/Limiter.hh>
+#include <rs/Digest.hh>
+#include <rs/Resolver.hh>
+#include <rs/Matcher.hh>
+#include <rs/Scoreboard.hh>
+#include <rs/SessionArchive.hh>
+#include <rs/RetryPolicy.hh>
 
 #define rs_fprintf(f, fmt, args...) do { \
   fprintf((f), (fmt), ##args); fflush((f)); } while (0)
@@ -16,58 +23,149 @@
 static const size_t PathMaxLen = 1024;
 
 static char Ddir[PathMaxLen]; // pobieranie plikow
-static char Sdir[PathMaxLen]; // pobieranie sesji (naglowni http i pliki html)
+static char Sdir[PathMaxLen]; // archiwum sesji (naglowki http i strony html)
 
 static bool D_inited = false, S_inited = false;
 static FILE *dia;
 static FILE *vtmp;
 static uint64_t difvtmp_sec = 10000000;
+static bool keepalive = false;
+static unsigned segments = 1;
+static bool resume = false;
+static bool prealloc = false;
+static bool mapped = false;
+static std::string digest; // rodzaj skrotu, pusty - bez
+static unsigned stall_secs = 0; // okno pilnowania zastoju, 0 - bez
+static uint64_t stall_bps = 0;
 
 #include <string>
 #include <vector>
 #include <boost/regex.hpp>
 // Tutaj sprawdzamy czy url jest poprawny
 static const boost::regex Reg_CorrectUrl("http://rapidshare.com/files/[0-9]*/[a-zA-Z0-9._\\-]*");
-// Tutaj szukamy tylko tekstu
-static const boost::regex Reg_NotAvailable("This file has been deleted");
-static const boost::regex Reg_IllegalFile("This file is suspected to contain illegal content and has been blocked.");
-static const boost::regex Reg_NotFound("The file could not be found.");
-static const boost::regex Reg_TryLater("Or try again in about ");
-static const boost::regex Reg_ServerBusy("Currently a lot of users are downloading files");
-static const boost::regex Reg_AlreadyDownloading("is already downloading a file.");
-static const boost::regex Reg_ReachedLimit("You have reached the download limit for free-users");
-// Tutaj szukamy urla, rozmiaru i czasu oczekiwania
+// Znaczniki na stronach - cala strona jest czytana raz przez automat
+// (Matcher), wyrazenia z nawiasami ida tylko od miejsca swojego znacznika
+enum Mark {
+  // Tutaj szukamy tylko tekstu
+  M_NotAvailable, M_IllegalFile, M_NotFound, M_TryLater, M_ServerBusy, 
+  M_AlreadyDownloading, M_ReachedLimit,
+  // Poczatki wyrazen ponizej
+  M_Url, M_Size, M_Time, M_Server,
+  M_Count
+};
+
+static const char *Marks[M_Count] = {
+  /* M_NotAvailable       */ "This file has been deleted",
+  /* M_IllegalFile        */ "This file is suspected to contain illegal content and has been blocked.",
+  /* M_NotFound           */ "The file could not be found.",
+  /* M_TryLater           */ "Or try again in about ",
+  /* M_ServerBusy         */ "Currently a lot of users are downloading files",
+  /* M_AlreadyDownloading */ "is already downloading a file.",
+  /* M_ReachedLimit       */ "You have reached the download limit for free-users",
+  /* M_Url                */ "<form id=\"ff\" action=\"",
+  /* M_Size               */ "<p class=\"downloadlink\">",
+  /* M_Time               */ "var c=",
+  /* M_Server             */ "onclick=\"document.dlf.action="
+};
+
+static Matcher Marks_build(void)
+{
+  Matcher m;
+  for (size_t i = 0; i < M_Count; ++i) m.add(Marks[i]);
+  m.compile();
+  return m;
+}
+
+static const Matcher Marks_matcher = Marks_build();
+
+// Tutaj szukamy urla, rozmiaru i czasu oczekiwania (kazde od swojego znacznika)
 static const boost::regex Reg_Url(
     "<form id=\"ff\" action=\"(http://[a-zA-Z0-9._/\\-]*)\" method=\"post\">");
 static const boost::regex Reg_Size(
     "<p class=\"downloadlink\">http://rapidshare.com/files/[0-9]*/[a-zA-Z0-9._\\-]* <font style=\"[a-zA-Z0-9._;:,#\\- ]*\">\\| ([0-9]*) KB</font></p>");
 static const boost::regex Reg_Time(
     "var c=([0-9]*);");
+static const boost::regex Reg_Later(
+    "Or try again in about ([0-9]*) minute");
 // Tutaj szukamy dwoch wartosci, adresu url do pliku i nazwy serwera na ktorym jest plik
 static const boost::regex Reg_Server(
-    "onclick=\"document.dlf.action=\\\\'(http://[a-zA-Z0-9._/\\-]*)\\\\';\" /> ([a-zA-Z0-9._\\-# ]*)<br />");
+    "onclick=\"document.dlf.action=\\\\'(http://[a-zA-Z0-9._/\\-]*)\\\\';\" /> ([a-zA-Z0-9._\\-#() ]*)<br />");
 
-static bool Reg_find(const char *str, const boost::regex &reg) throw()
-{
-  return boost::regex_search(str, reg);
-}
+/**
+ * Strona po jednym przejsciu automatu: ktore znaczniki sa i gdzie.
+ * Wyrazenie jest dopasowywane od miejsca znacznika (match_continuous), na
+ * co najwyzej Region bajtach - nie przeszukuje juz calej strony.
+ */
+class PageMarks {
+  public:
+    static const size_t Region = 2048;
+
+    PageMarks(const Rope &page) throw() : m_page(page)
+    {
+      unsigned state = 0;
+      size_t pos = 0;
+      for (size_t i = 0, len; i < page.spans(); ++i) {
+        const char *span = page.span(i, len);
+        Marks_matcher.scan(span, len, m_hits, state, pos);
+      }
+    }
 
-static bool Reg_find(const char *str, const boost::regex &reg, std::string &s1) throw()
-{
-  boost::cmatch what;
-  if (!boost::regex_search(str, what, reg)) return false;
-  s1 = what[1];
-  return true;
-}
+    bool has(Mark m) const throw()
+    {
+      for (size_t i = 0; i < m_hits.size(); ++i)
+        if (m_hits[i].id == (unsigned)m) return true;
+      return false;
+    }
+
+    // Pierwsze dopasowanie wyrazenia od znacznika m, s1 - pierwszy nawias
+    bool find(Mark m, const boost::regex &reg, std::string &s1) const throw()
+    {
+      boost::cmatch what;
+      for (size_t i = 0; i < m_hits.size(); ++i) {
+        if (m_hits[i].id != (unsigned)m || !match(m_hits[i].offset, reg, what)) continue;
+        s1 = what[1];
+        return true;
+      }
+      return false;
+    }
+
+    // Wszystkie dopasowania od znacznikow m (nawiasy 1 i 2), po kolei
+    void findAll(Mark m, const boost::regex &reg, std::vector<std::pair<std::string, std::string> > &v) const throw()
+    {
+      boost::cmatch what;
+      for (size_t i = 0; i < m_hits.size(); ++i) 
+        if (m_hits[i].id == (unsigned)m && match(m_hits[i].offset, reg, what))
+          v.push_back(std::make_pair<std::string, std::string>(what[2], what[1]));
+    }
+
+  private:
+    const Rope &m_page;
+    std::vector<Matcher::Hit> m_hits;
+    mutable std::string m_tmp; // fragment strony z kilku kawalkow
+
+    bool match(size_t off, const boost::regex &reg, boost::cmatch &what) const throw()
+    {
+      size_t len = std::min(Region, m_page.size() - off);
+      const char *str = m_page.contiguous();
+
+      if (!str) { // Strona w kawalkach - kopiujemy tylko fragment
+        m_tmp.clear();
+        for (size_t i = 0, at = 0, slen; i < m_page.spans() && m_tmp.size() < len; ++i, at += slen) {
+          const char *span = m_page.span(i, slen);
+          if (at + slen <= off) continue;
+          size_t from = (off > at) ? off - at : 0;
+          m_tmp.append(span + from, std::min(slen - from, len - m_tmp.size()));
+        }
+        str = m_tmp.data() - off;
+      }
+
+      return boost::regex_search(str + off, str + off + len, what, reg, boost::match_continuous);
+    }
+};
 
 //static const char *RS_ServerBusy2 = "We regret that currently we have no available slots for free users";
 //static const char *RS_ActionUrl2 = "<form name=\"dlf\" action=\"";
 
-static const size_t WaitingForLater    =  60;
-static const size_t WaitingForBusy     = 120;
-static const size_t WaitingForRivalry  =  60;
-static const size_t WaitingForLimit    = 120;
-
 /*** Wyjatki, przy pobieraniu plikow ***/
 
 class DEXC : public std::exception {
@@ -77,20 +175,49 @@ class DEXC : public std::exception {
     const char *what(void) const throw() { return "DEXC"; }
 };
 
-class DAgain : public DEXC {
+class DPark : public DEXC {
+  public:
+    DPark(void) throw() { }
+    ~DPark(void) throw() { }
+    const char *what(void) const throw() { return "DPark"; }
+};
+
+// Wstrzymane albo anulowane przez control()
+class DHold : public DEXC {
   public:
-    DAgain(void) throw() { }
-    ~DAgain(void) throw() { }
-    const char *what(void) const throw() { return "DAgain"; }
+    DHold(void) throw() { }
+    ~DHold(void) throw() { }
+    const char *what(void) const throw() { return "DHold"; }
 };
 
+// Do ponowienia - odstep wedlug rodzaju bledu (RetryPolicy)
 class DBreak : public DEXC {
   public:
-    DBreak(void) throw() { }
+    DBreak(RetryPolicy::Class cls, const std::string &host = "", unsigned hint = 0) throw() 
+      : cls(cls), host(host), hint(hint) { }
     ~DBreak(void) throw() { }
     const char *what(void) const throw() { return "DBreak"; }
+
+    RetryPolicy::Class cls;
+    std::string host; // komu liczyc ponowienie, pusty - serwis (url zadania)
+    unsigned hint;    // podpowiedz ze strony (sek)
 };
 
+static RetryPolicy::Class failure_of(Http::Error::Type err) throw()
+{
+  if (err == Http::Error::Timeout) return RetryPolicy::Timeout;
+  if (err == Http::Error::Stalled) return RetryPolicy::Stall;
+  return RetryPolicy::HttpError;
+}
+
+static std::string host_of(const char *url) throw()
+{
+  std::string host;
+  int port;
+  if (!url || !Resolver::split(url, host, port)) return "";
+  return host;
+}
+
 class DAbort : public DEXC {
   public:
     DAbort(void) throw() { }
@@ -111,8 +238,8 @@ void RSDownloader::setDownloadDir(const std::string &path) throw()
   D_inited = true;
 }
 
-// Ustaw katalog do ktorego zapisywac strony
-void RSDownloader::setSessionsDir(const std::string &path) throw()
+// Ustaw katalog archiwum stron (SessionArchive)
+void RSDownloader::setSessionsDir(const std::string &path, uint64_t segment, unsigned keep) throw()
 {
   int sn = snprintf(Sdir, PathMaxLen, "%s", path.c_str());
   if (sn < 0 || sn >= (int)PathMaxLen)
@@ -121,6 +248,7 @@ void RSDownloader::setSessionsDir(const std::string &path) throw()
   if (mkdir(Sdir, 0755) && errno != EEXIST) 
     throw EInternal("mkdir: %d, %s", errno, strerror(errno));
 
+  SessionArchive::instance().open(Sdir, segment, keep);
   S_inited = true;
 }
 
@@ -137,128 +265,285 @@ void RSDownloader::setSpeedRaporting(const std::string &path, uint32_t difsec) t
   difvtmp_sec = difsec*1000000;
 }
 
-// Pobranie instancji
-RSDownloader &RSDownloader::instance(void)
+// Wlacz pule polaczen keep-alive
+void RSDownloader::setKeepAlive(bool on) throw()
 {
-  static RSDownloader rsd;
-  return rsd;
+  keepalive = on;
+}
+
+// Na ile rownoleglych kawalkow dzielic pobierany plik
+void RSDownloader::setSegments(unsigned n) throw()
+{
+  segments = n ? n : 1;
 }
-  
-static pthread_t pth;
 
-RSDownloader::RSDownloader(void) throw() 
+// Wznawiaj pobieranie z pliku *.part i dziennika
+void RSDownloader::setResume(bool on) throw()
 {
-  m_status  = None;
-  m_bytes   = 0;
-  m_usecs   = 0;
-  m_size    = 0;
-  m_speed   = 0;
-  m_waiting = 0;
+  resume = on;
+}
 
-  pthread_attr_t pat;
-  int ret;
+// Rezerwuj miejsce na pobierany plik
+void RSDownloader::setPreallocate(bool on) throw()
+{
+  prealloc = on;
+}
 
-  if ((ret = pthread_attr_init(&pat)) != 0) 
-    throw EInternal("pthread_attr_init: %d, %s", ret, strerror(ret));
-  if ((ret = pthread_create(&pth, &pat, RSDownloader::s_thread_fn, NULL)) != 0)
-    throw EInternal("pthread_create: %d, %s", ret, strerror(ret));
-  if ((ret = pthread_attr_destroy(&pat)) != 0) 
-    throw EInternal("pthread_attr_destroy: %d, %s", ret, strerror(ret));
+// Zapis przez mmap
+void RSDownloader::setMapped(bool on) throw()
+{
+  mapped = on;
+}
 
-  sleep(1);
+// Globalny limit predkosci (Limiter dzieli go miedzy transfery)
+void RSDownloader::setRateLimit(uint64_t bps) throw()
+{
+  Limiter::instance().setRate(bps);
 }
 
-RSDownloader::~RSDownloader(void) throw()
+uint64_t RSDownloader::getRateLimit(void) throw()
 {
-  int ret;
+  return Limiter::instance().rate();
+}
 
-  if ((ret = pthread_cancel(pth)) != 0)
-    throw EInternal("pthread_cancel: %d, %s", ret, strerror(ret));
+// Skrot pobieranego pliku
+void RSDownloader::setDigest(const char *name) throw()
+{
+  digest = name ? name : "";
 }
 
-void *RSDownloader::s_thread_fn(void *) 
+// Cache DNS i laczenie na wyscigi (Resolver wspolny dla wszystkich Http)
+void RSDownloader::setDns(unsigned ttl, bool racing) throw()
 {
-  RSDownloader &rsd = RSDownloader::instance();
+  Resolver::instance().setTtl(ttl);
+  Resolver::instance().setRacing(racing);
+}
 
-  rsd.thread_fn();
+// Pilnowanie zastoju i przelaczanie serwerow w etapie 3
+void RSDownloader::setStall(unsigned secs, uint64_t bps) throw()
+{
+  stall_secs = secs;
+  stall_bps = bps;
+}
 
-  return NULL;
+// Limity ponowien (zasady dla rodzajow bledow - RetryPolicy::setRule)
+void RSDownloader::setRetries(unsigned job, unsigned host_tries, unsigned host_secs) throw()
+{
+  RetryPolicy::instance().setJobBudget(job);
+  RetryPolicy::instance().setHostBudget(host_tries, host_secs);
 }
 
-void RSDownloader::thread_fn(void) throw()
+// Wyniki serwerow miedzy uruchomieniami i jak czesto probowac innych
+void RSDownloader::setScoreboard(const std::string &path, double explore) throw()
 {
-  std::string url;
+  Scoreboard::instance().setPath(path);
+  Scoreboard::instance().setExplore(explore);
+}
 
-Wait_for:
+RSDownloader::RSDownloader(const std::string &url) throw() 
+  : m_url(url)
+{
+  status(Queued); // reszta Progress wyzerowana przez SeqLock
+  m_vbgn    = 0;
+  m_vlst    = 0;
+  m_vbytes  = 0;
+  m_start   = 0;
+  m_ttfb    = 0;
+  m_weight  = Limiter::DefWeight;
+  m_cap     = 0;
+  m_gate    = NULL;
+  m_gdata   = NULL;
+  m_phase   = Fresh;
+  m_retries = 0;
+  memset(m_fails, 0, sizeof(m_fails));
+  m_post    = Preparing;
+  m_park    = 0;
+  m_control = Run;
+  m_held    = false;
+  m_hstatus = Queued;
+  m_hleft   = 0;
+}
 
-  m_wait.p();
-  
-  if (dia) rs_fprintf(dia, "%s - RSD - Zabieramy sie do pobrania pliku '%s'...\n", Time::stamp(), m_url.c_str());
 
-  m_status = Preparing;
+// Etap 3 miedzy wejsciem i wyjsciem przez bramke (takze gdy leci wyjatek)
+class TransferGate {
+  public:
+    TransferGate(RSDownloader::gate_fn fn, const RSDownloader *rsd, void *data) throw()
+      : m_fn(fn), m_rsd(rsd), m_data(data), m_in(true)
+    {
+      if (m_fn) m_in = m_fn(true, m_rsd, m_data);
+    }
+    ~TransferGate(void) throw() { if (m_fn && m_in) m_fn(false, m_rsd, m_data); }
 
-Download_it:
-  
-  for (int tries = 0; tries < 5; ++tries) {
+    bool entered(void) const throw() { return m_in; }
+
+  private:
+    RSDownloader::gate_fn m_fn;
+    const RSDownloader *m_rsd;
+    void *m_data;
+    bool m_in;
+};
+
+bool RSDownloader::run(uint64_t &park) throw()
+{
+  std::string &url = m_next;
 
-    try { 
+  if (getControl() != Run) return suspend(park);
+
+  if (m_held) { // Wznowione - najpierw reszta przerwanego odczekania
+    m_held = false;
+    if (m_hleft) {
+      wait(m_hstatus, m_post, m_hleft, m_phase != Transfer);
+      park = m_park;
+      return false;
+    }
+  }
+
+  if (m_phase == Fresh) {
+    if (dia) rs_fprintf(dia, "%s - RSD - Zabieramy sie do pobrania pliku '%s'...\n", Time::stamp(), m_url.c_str());
+    status(Preparing);
+    m_phase = Stages;
+  } else { // Po odczekaniu
+    Progress &p = m_progress.begin();
+    p.status = m_post;
+    p.until = 0;
+    m_progress.end();
+  }
+
+  try { 
+    if (m_phase == Stages) {
       d_stage_1(url); // Ustawimy url na nastepna strone www
       d_stage_2(url); // Ustawimy url na nastepna strone www
-      d_stage_3(url); // Sciagamy plik spod url.
     }
-    catch (DAgain) { goto Download_it; } // A jeszcze z raz
-    catch (DAbort) { goto Aborted; } // Oj, cos powaznego:(
-    catch (DBreak) { continue; } // Moze nastepnym razem...
+    m_phase = Stages; // kolejna proba od poczatku
 
-    if (dia) rs_fprintf(dia, "%s - RSD - Pobrano plik '%s', %lluB w %llu.%.3llu sek (%.3f KB/s)\n", 
-        Time::stamp(), m_url.c_str(), m_bytes, m_usecs/1000000, (m_usecs/1000)%1000,
-        1.0e3*(((double)m_bytes)/((double)m_usecs)));
+    if (m_gate) status(Ready);
+    TransferGate gate(m_gate, this, m_gdata); // czekamy na wolne lacze
+    if (!gate.entered() || getControl() != Run) { // wstrzymane w czasie czekania na lacze
+      wait(Ready, Ready, 0, false);
+      throw DHold();
+    }
+    d_stage_3(url); // Sciagamy plik spod url.
+  }
+  catch (const DPark &) { return suspend(park); } // Wrocimy tu po odczekaniu
+  catch (const DHold &) { return suspend(park); } // ... albo po control(Run)
+  catch (DAbort) { goto Aborted; } // Oj, cos powaznego:(
+  catch (const DBreak &b) { // Moze nastepnym razem...
+    if (!retry(b.cls, b.host.empty() ? host_of(m_url.c_str()) : b.host, b.hint)) goto Too_many_tries;
+    return suspend(park);
+  }
 
-    m_status = Downloaded; // Ok.
-    goto Wait_for;
+  {
+    const Progress &p = m_progress.get();
+    if (dia) rs_fprintf(dia, "%s - RSD - Pobrano plik '%s', %lluB w %llu.%.3llu sek (%.3f KB/s)\n", 
+        Time::stamp(), m_url.c_str(), p.bytes, p.usecs/1000000, (p.usecs/1000)%1000,
+        1.0e3*(((double)p.bytes)/((double)p.usecs)));
   }
 
-//Too_many_tries:
+  status(Downloaded); // Ok.
+  return true;
+
+Too_many_tries:
 
   if (dia) rs_fprintf(dia, "%s - RSD - Nie udalo sie pobrac pliku '%s', wyczerpano limit prob\n", Time::stamp(), m_url.c_str());
-  m_status = Canceled; // sorry ;P
+  status(Canceled); // sorry ;P
   
-  goto Wait_for;
+  return true;
 
 Aborted:
 
   if (dia) rs_fprintf(dia, "%s - RSD - Nie udalo sie pobrac pliku '%s', odrzucono zadanie pobierania\n", Time::stamp(), m_url.c_str());
-  m_status = Canceled; // sorry ;P
-  
-  goto Wait_for;
+  if (m_progress.get().status != NoSpace) status(Canceled); // sorry ;P
+
+  return true;
+}
+
+// Koniec run() bez pobranego pliku: odczekanie (park ms), chyba ze
+// w miedzyczasie zadanie wstrzymano (park == Held) albo anulowano
+bool RSDownloader::suspend(uint64_t &park) throw()
+{
+  if (getControl() == Cancel) {
+    if (dia) rs_fprintf(dia, "%s - RSD - Anulowano pobieranie pliku '%s'\n", Time::stamp(), m_url.c_str());
+    m_held = false;
+    status(Canceled);
+    return true;
+  }
+
+  if (getControl() == Pause) {
+    if (!m_held && dia) rs_fprintf(dia, "%s - RSD - Wstrzymano pobieranie pliku '%s'\n", Time::stamp(), m_url.c_str());
+    hold();
+    park = Held;
+    return false;
+  }
+
+  park = m_park;
+  return false;
 }
 
-void RSDownloader::download(const std::string &url) throw(EAlready, EInvalid)
+void RSDownloader::settle(void) throw()
 {
-  Lock l(m_lock);
+  uint64_t park;
+  suspend(park);
+}
+
+// Status Paused, a status i pozostale odczekanie na potem (m_phase,
+// m_post i m_next juz wskazuja, od czego zaczac)
+void RSDownloader::hold(void) throw()
+{
+  Progress &p = m_progress.begin();
+
+  if (!m_held) {
+    uint64_t now = Time::mono_msec();
+    m_hstatus = p.status;
+    m_hleft = (p.until > now) ? p.until - now : 0;
+  }
+
+  p.status = Paused;
+  p.until = 0;
+  p.speed = 0;
+  m_progress.end();
 
+  m_held = true;
+}
+
+// Ponowienie od etapu 1 po odstepie z RetryPolicy, false - koniec prob
+// (limit tego rodzaju bledu albo calego zadania)
+bool RSDownloader::retry(RetryPolicy::Class cls, const std::string &host, unsigned hint) throw()
+{
+  RetryPolicy &policy = RetryPolicy::instance();
+  unsigned attempt = ++m_fails[cls];
+  uint64_t delay;
+
+  if (++m_retries > policy.jobBudget() || !policy.next(cls, attempt, host, hint, delay)) {
+    if (dia) rs_fprintf(dia, "%s - RSD - Koniec prob po %s (%u raz, razem %u)\n", 
+        Time::stamp(), RetryPolicy::name(cls), attempt, m_retries);
+    return false;
+  }
+
+  // Status na czas odczekania - jak dawniej dla stron serwisu
+  static const Status pre[RetryPolicy::Classes] = {
+    /* HttpError */ Later, /* Timeout */ Later, /* Stall */ Later, 
+    /* Later */ Waiting, /* Busy */ Busy, /* Limit */ Limit, /* Rivalry */ Rivalry
+  };
+
+  if (dia) rs_fprintf(dia, "%s - RSD - Ponowie za %llu.%.3llu sek (%s, %u raz, host '%s')\n", 
+      Time::stamp(), (unsigned long long)delay/1000, (unsigned long long)delay%1000,
+      RetryPolicy::name(cls), attempt, host.c_str());
+
+  wait(pre[cls], Preparing, delay, true);
+  return true;
+}
+
+void RSDownloader::validate(const std::string &url) throw(EInvalid)
+{
   if (!D_inited || !S_inited) 
     throw EExternal("Nie podano katalogow dokad sciagac dane");
 
-  if (m_status != None && m_status != Downloaded && 
-      m_status != Canceled && m_status != NotFound)
-    throw EAlready();
-
   // Gdy brak nazwy pliku lub plik nie pochodzi z http://rapidshare.com
   if (!boost::regex_match(url, Reg_CorrectUrl)) {
     if (dia) rs_fprintf(dia, "%s - RSD - Nieprawidlowy url: %s\n", Time::stamp(), url.c_str());
     throw EInvalid();
   } // Sprawdzamy poprawnosc urla
-
-  m_status = Preparing;
-  m_url = url;
-  m_bytes = 0;
-  m_usecs = 0;
-  m_size = 0;
-  m_speed = 0.0;
-  m_waiting = 0;
-  
-  m_wait.v();
 }
 
 const char *RSDownloader::descr(Status s) throw()
@@ -275,12 +560,16 @@ const char *RSDownloader::descr(Status s) throw()
     /* Rivalry     */ "ktos inny probuje pobierac pliki",
     /* Limit       */ "wyczerpany limit pobieranych danych",
     /* Busy        */ "serwery sa przeciazone",
-    /* Unknown     */ "nieznany blad"
+    /* Unknown     */ "nieznany blad",
+    /* NoSpace     */ "brak miejsca na dysku",
+    /* Queued      */ "czeka w kolejce na wolny watek",
+    /* Ready       */ "przygotowany, czeka na wolne lacze",
+    /* Paused      */ "wstrzymany, czeka na wznowienie"
   };
 
   size_t idx = (size_t)s;
   
-  return (idx > Unknown) ? tab[((size_t)Unknown)] : tab[idx];
+  return (idx > Paused) ? tab[((size_t)Unknown)] : tab[idx];
 }
 
 static const char *d_name(const char *url)
@@ -288,12 +577,11 @@ static const char *d_name(const char *url)
   return strrchr(url, '/') + 1;
 }
 
-static const char *d_download_path(const char *url)
+// Sciezki skladane na kazde wywolanie - zadania ida rownolegle na kilku watkach
+
+static std::string d_download_path(const char *url)
 {
-  // Tylko jeden watek bedzie korzystal z tej funkcji, zatem
-  // jest zmienne statyczne w niej sa bezpieczne.
-  
-  static char path[PathMaxLen];
+  char path[PathMaxLen];
   int sn = snprintf(path, PathMaxLen, "%s/%s", 
       Ddir, d_name(url));
   if (sn < 0 || sn >= (int)PathMaxLen) throw EInternal("snprintf");
@@ -301,50 +589,61 @@ static const char *d_download_path(const char *url)
   return path;
 }
 
-static const char *d_sessions_path(const char *url, const char *suffix)
+void RSDownloader::status(Status s) throw()
 {
-  // Tylko jeden watek bedzie korzystal z tej funkcji, zatem
-  // jest zmienne statyczne w niej sa bezpieczne.
-  
-  static char path[PathMaxLen];
-  int sn = snprintf(path, PathMaxLen, "%s/%s%s", 
-      Sdir, d_name(url), suffix);
-  if (sn < 0 || sn >= (int)PathMaxLen) throw EInternal("snprintf");
-  
-  return path;
+  m_progress.begin().status = s;
+  m_progress.end();
 }
 
-void RSDownloader::wait(Status pre, Status post, size_t secs)
+// Odczekanie bez watku: stan zostaje w obiekcie, run() wychodzi (DPark)
+// i jest wolany ponownie po ms. again - potem od etapu 1, inaczej dalej
+// (etap 3).
+void RSDownloader::wait(Status pre, Status post, uint64_t ms, bool again) throw()
 {
-  m_lock.lock();
-  m_status = pre;
-  m_waiting = secs + 1;
-  m_lock.unlock();
+  Progress &p = m_progress.begin();
+  p.status = pre;
+  p.until = Time::mono_msec() + ms;
+  m_progress.end();
+
+  m_post = post;
+  m_park = ms;
+  m_phase = again ? Stages : Transfer;
+}
 
-  while (--m_waiting) sleep(1);
+void RSDownloader::park(Status pre, Status post, uint64_t ms, bool again)
+{
+  wait(pre, post, ms, again);
+  throw DPark();
+}
 
-  m_lock.lock();
-  m_status = post;
-  m_lock.unlock();
+size_t RSDownloader::left(uint64_t until) throw()
+{
+  uint64_t now = Time::mono_msec();
+  return (until > now) ? (until - now + 999)/1000 : 0;
 }
 
-static void chooseServerFrom(char *buffer, std::string &url)
+// Serwery od najlepszego: wedlug zmierzonych wynikow (Scoreboard), bez
+// nich - najpierw ulubione, potem reszta tak jak na stronie
+static void chooseServerFrom(const PageMarks &page, uint64_t size, const std::string &host,
+    std::string &url, std::vector<std::string> &mirrors, std::vector<std::string> &names)
 {
-  // Priorytety, ktory serwer najpierw wybrac chcemy:
+  // Priorytety, ktory serwer najpierw wybrac chcemy (gdy brak pomiarow):
   static const char *RS_Favorites[] = {
     "TeliaSonera", "Cogent", "GlobalCrossing", "Teleglobe", "Deutsche Telekom", "TeliaSonera #2", 
     "GlobalCrossing #2", "Cogent #2", "Level(3)", "Level(3) #2", "Level(3) #3", "Level(3) #4", NULL
   };
 
   std::vector<std::pair<std::string, std::string> > srvs;
-  for (boost::cregex_iterator it(buffer, buffer+strlen(buffer), Reg_Server), end; it != end; ++it) 
-    srvs.push_back(std::make_pair<std::string, std::string>((*it)[2], (*it)[1]));
+  page.findAll(M_Server, Reg_Server, srvs);
 
   if (srvs.size() == 0) {
     if (dia) rs_fprintf(dia, "%s - RSD - Brak serwerow, przerywam... (poziom 2)\n", Time::stamp());
-    throw DBreak();
+    throw DBreak(RetryPolicy::HttpError, host);
   }
 
+  std::vector<size_t> prior; // numery w srvs: ulubione, potem reszta
+  std::vector<bool> taken(srvs.size(), false);
+
   for (size_t i = 0; RS_Favorites[i]; ++i) { 
     size_t found = 0, end = srvs.size();
 
@@ -358,65 +657,82 @@ static void chooseServerFrom(char *buffer, std::string &url)
       continue;
     }
 
-    if (dia) rs_fprintf(dia, "%s - RSD - Znalazlem i wybralem serwer: '%s' (poziom 2)\n", Time::stamp(), RS_Favorites[i]);
-    url = srvs[found].second;
+    if (dia) rs_fprintf(dia, "%s - RSD - Znalazlem serwer: '%s' (poziom 2)\n", Time::stamp(), RS_Favorites[i]);
+    prior.push_back(found);
+    taken[found] = true;
+  }
+
+  if (prior.empty() && dia) 
+    rs_fprintf(dia, "%s - RSD - Nie znalazlem zadnego z ulubionych serwerow, wybieram pierwszy z proponowanych: '%s'... (poziom 2)\n", Time::stamp(), srvs[0].first.c_str());
+
+  // Reszta na zapas, gdyby lepsze stanely w trakcie pobierania
+  for (size_t i = 0; i < srvs.size(); ++i)
+    if (!taken[i]) prior.push_back(i);
+
+  std::vector<std::string> pnames;
+  for (size_t i = 0; i < prior.size(); ++i) pnames.push_back(srvs[prior[i]].first);
 
-    return;
+  std::vector<size_t> order;
+  Scoreboard::instance().rank(pnames, size, order);
+
+  mirrors.clear();
+  names.clear();
+  for (size_t i = 0; i < order.size(); ++i) {
+    mirrors.push_back(srvs[prior[order[i]]].second);
+    names.push_back(srvs[prior[order[i]]].first);
   }
 
-  url = srvs[0].second;
+  url = mirrors[0];
 
-  if (dia) rs_fprintf(dia, "%s - RSD - Nie znalazlem zadnego z ulubionych serwerow, wybieram pierwszy z proponowanych: '%s'... (poziom 2)\n", Time::stamp(), srvs[0].first.c_str());
+  if (dia) rs_fprintf(dia, "%s - RSD - Wybralem serwer '%s' (%s), zapasowych: %u (poziom 2)\n", 
+      Time::stamp(), names[0].c_str(), url.c_str(), (unsigned)mirrors.size() - 1);
 }
 
 void RSDownloader::d_stage_1(std::string &url) 
 {
   if (dia) rs_fprintf(dia, "%s - RSD - Lacze sie z '%s' (poziom 1)\n", Time::stamp(), m_url.c_str());
 
-  char *buffer = NULL;
-  size_t buflen = 0;
-  Http http;
+  const std::string host = host_of(m_url.c_str()); // komu liczyc ponowienia
+  Rope page;
+  Http http(keepalive);
+  http.setCookieJar(&m_jar);
   
-  http.get(buffer, buflen, m_url.c_str());
+  http.get(page, m_url.c_str());
+
+  if (dia && http.length() > 0) 
+    rs_fprintf(dia, "%s - RSD - Strona: %lld B, z sieci %lld B (poziom 1)\n", 
+        Time::stamp(), (long long)http.length(), (long long)http.wireLength());
   
-  try { 
-    File body(d_sessions_path(m_url.c_str(), "-body-1.html"));
-    body.write(buffer, buflen);
-  } catch (...) { }
-  try {
-    File head(d_sessions_path(m_url.c_str(), "-head-1.html"));
-    head.write(http.header(), http.header() ? strlen(http.header()) : 0);
-  } catch (...) { }
-
-  if (buffer == NULL || http.error() != Http::Error::None) { // spr bledy
+  // Do archiwum w tle - bez czekania na dysk
+  SessionArchive &archive = SessionArchive::instance();
+  archive.add(m_url, 1, SessionArchive::Body, page);
+  archive.add(m_url, 1, SessionArchive::Head, http.header(), http.header() ? strlen(http.header()) : 0);
+
+  if (page.empty() || http.error() != Http::Error::None) { // spr bledy
     if (dia) rs_fprintf(dia, "%s - RSD - Blad HTTP: %s (poziom 1)\n", Time::stamp(), http.error());
-    if (buffer) delete[] buffer;
-    throw DBreak();
+    throw DBreak(failure_of(http.error()), host);
   }
 
   if (http.status() != Http::Status::Ok) { // spr status
     if (dia) rs_fprintf(dia, "%s - RSD - Niepoprawny kod HTTP: %d, (poziom 1)\n", Time::stamp(), http.status());
-    delete[] buffer;
-    throw DBreak();
+    throw DBreak(RetryPolicy::HttpError, host);
   }
 
-  if (Reg_find(buffer, Reg_IllegalFile) ||
-      Reg_find(buffer, Reg_NotAvailable) ||
-      Reg_find(buffer, Reg_NotFound)) {
+  PageMarks marks(page); // jedno przejscie po stronie
+
+  if (marks.has(M_IllegalFile) ||
+      marks.has(M_NotAvailable) ||
+      marks.has(M_NotFound)) {
     if (dia) rs_fprintf(dia, "%s - RSD - Plik nie jest dostepny\n", Time::stamp());
-    delete[] buffer;
-    m_status = NotFound;
+    status(NotFound);
     throw DAbort();
   }
 
-  if (!Reg_find(buffer, Reg_Url, url)) {
+  if (!marks.find(M_Url, Reg_Url, url)) {
     if (dia) rs_fprintf(dia, "%s - RSD - Nie znaleziono url-a (poziom 1)\n", Time::stamp());
-    delete[] buffer;
-    throw DBreak();
+    throw DBreak(RetryPolicy::HttpError, host);
   }
 
-  delete[] buffer;
-
   // OK!! Na url mamy link do nastepnej strony!!!
 }
 
@@ -424,65 +740,63 @@ void RSDownloader::d_stage_2(std::string &url)
 {
   if (dia) rs_fprintf(dia, "%s - RSD - Lacze sie z '%s' (poziom 2)\n", Time::stamp(), url.c_str());
   
-  char *buffer = NULL;
-  size_t buflen = 0;
-  Http http;
+  const std::string host = host_of(url.c_str()); // url zaraz wskaze serwer etapu 3
+  Rope page;
+  Http http(keepalive);
+  http.setCookieJar(&m_jar);
   
-  http.get(buffer, buflen, url.c_str(), "dl.start=Free");
+  http.get(page, url.c_str(), "dl.start=Free");
 
-  try { 
-    File body(d_sessions_path(m_url.c_str(), "-body-2.html"));
-    body.write(buffer, buflen);
-  } catch (...) { }
-  try {
-    File head(d_sessions_path(m_url.c_str(), "-head-2.html"));
-    head.write(http.header(), http.header() ? strlen(http.header()) : 0);
-  } catch (...) { }
-
-  if (buffer == NULL || http.error() != Http::Error::None) { // spr bledy
+  if (dia && http.length() > 0) 
+    rs_fprintf(dia, "%s - RSD - Strona: %lld B, z sieci %lld B (poziom 2)\n", 
+        Time::stamp(), (long long)http.length(), (long long)http.wireLength());
+
+  // Do archiwum w tle - bez czekania na dysk
+  SessionArchive &archive = SessionArchive::instance();
+  archive.add(m_url, 2, SessionArchive::Body, page);
+  archive.add(m_url, 2, SessionArchive::Head, http.header(), http.header() ? strlen(http.header()) : 0);
+
+  if (page.empty() || http.error() != Http::Error::None) { // spr bledy
     if (dia) rs_fprintf(dia, "%s - RSD - Blad HTTP: %s (poziom 2)\n", Time::stamp(), http.error());
-    if (buffer) delete[] buffer;
-    throw DBreak();
+    throw DBreak(failure_of(http.error()), host);
   }
 
   if (http.status() != Http::Status::Ok) { // spr status
     if (dia) rs_fprintf(dia, "%s - RSD - Niepoprawny kod HTTP: %d (poziom 2)\n", Time::stamp(), http.status());
-    delete[] buffer;
-    throw DBreak();
+    throw DBreak(RetryPolicy::HttpError, host);
   }
 
-  if (Reg_find(buffer, Reg_TryLater)) {
-    if (dia) rs_fprintf(dia, "%s - RSD - Trzeba poczekac chwile... (poziom 2)\n", Time::stamp());
-    wait(Waiting, Preparing, WaitingForLater);
-    delete[] buffer;
-    throw DAgain();
+  PageMarks marks(page); // jedno przejscie po stronie
+
+  // "Or try again in about N minutes" - na stronach limitu i "sprobuj pozniej"
+  unsigned hint = 0;
+  std::string slater;
+  if (marks.find(M_TryLater, Reg_Later, slater)) hint = strtoul(slater.c_str(), 0, 10)*60;
+
+  if (marks.has(M_ReachedLimit)) {
+    if (dia) rs_fprintf(dia, "%s - RSD - Wykorzystany limit pobierania plikow, podpowiedz %u sek (poziom 2)\n", Time::stamp(), hint);
+    throw DBreak(RetryPolicy::Limit, host, hint);
   }
 
-  if (Reg_find(buffer, Reg_ReachedLimit)) {
-    if (dia) rs_fprintf(dia, "%s - RSD - Wykorzystany limit pobierania plikow (poziom 2)\n", Time::stamp());
-    wait(Limit, Preparing, WaitingForLimit);
-    delete[] buffer;
-    throw DAgain();
+  if (marks.has(M_TryLater)) {
+    if (dia) rs_fprintf(dia, "%s - RSD - Trzeba poczekac chwile, podpowiedz %u sek (poziom 2)\n", Time::stamp(), hint);
+    throw DBreak(RetryPolicy::Later, host, hint);
   }
 
-  if (Reg_find(buffer, Reg_ServerBusy)) {
+  if (marks.has(M_ServerBusy)) {
     if (dia) rs_fprintf(dia, "%s - RSD - Serwery sa przypchane (poziom 2)\n", Time::stamp());
-    wait(Busy, Preparing, WaitingForBusy);
-    delete[] buffer;
-    throw DAgain();
+    throw DBreak(RetryPolicy::Busy, host);
   }
 
-  if (Reg_find(buffer, Reg_AlreadyDownloading)) {
+  if (marks.has(M_AlreadyDownloading)) {
     if (dia) rs_fprintf(dia, "%s - RSD - Ktos blockuje, ktos teraz pobiera cos... (poziom 2)\n", Time::stamp());
-    wait(Rivalry, Preparing, WaitingForRivalry);
-    delete[] buffer;
-    throw DAgain();
+    throw DBreak(RetryPolicy::Rivalry, host);
   }
   
   size_t wait_for = 0;
   std::string swait_for;
 
-  if (Reg_find(buffer, Reg_Time, swait_for)) {
+  if (marks.find(M_Time, Reg_Time, swait_for)) {
     wait_for = strtoul(swait_for.c_str(), 0, 10) + 5;
     if (dia) rs_fprintf(dia, "%s - RSD - Odczekuje %u sek... (poziom 2)\n", Time::stamp(), wait_for);
   } else {
@@ -492,108 +806,174 @@ void RSDownloader::d_stage_2(std::string &url)
 
   std::string ssize;
 
-  if (!Reg_find(buffer, Reg_Size, ssize)) { 
+  if (!marks.find(M_Size, Reg_Size, ssize)) { 
     if (dia) rs_fprintf(dia, "%s - RSD - Nie moge znalezc rozmiaru pliku... :( (poziom 2)\n", Time::stamp());
-    delete[] buffer;
-    throw DBreak();
+    throw DBreak(RetryPolicy::HttpError, host);
   }
 
-  m_size = strtoul(ssize.c_str(), 0, 10);
+  m_progress.begin().size = strtoul(ssize.c_str(), 0, 10);
+  m_progress.end();
 
   // Teraz wybierzmy serwer z ktorego chcemy sciagac !
   
-  try { chooseServerFrom(buffer, url); } // throw DBreak // 
-  catch (DBreak) { delete[] buffer; throw; }
-  catch (DEXC &e) { delete[] buffer; throw e; }
+  chooseServerFrom(marks, m_progress.get().size*1000, host, url, m_mirrors, m_names); // throw DBreak // 
   
-  if (dia) rs_fprintf(dia, "%s - RSD - Czekam %u sekund przed pobraniem... (poziom 2)\n", Time::stamp(), wait_for);
-  wait(Waiting, Preparing, wait_for);
+  // Ok!! na url mamy nastepny url, etap 3 po odczekaniu
 
-  // Ok!! na url mamy nastepny url
+  if (dia) rs_fprintf(dia, "%s - RSD - Czekam %u sekund przed pobraniem... (poziom 2)\n", Time::stamp(), wait_for);
+  park(Waiting, Preparing, wait_for*1000ULL, false);
 }
 
-static uint64_t progress_bgn = 0;
-static uint64_t progress_lst = 0;
-static uint64_t progress_bytes = 0;
-
-static void progress_fn_begin(void)
+// Raporty predkosci chwilowej - kazde zadanie liczy swoja, w pliku
+// kolejne pole to url zadania
+void RSDownloader::progress_begin(void) throw()
 {
-  if (vtmp) rs_fprintf(vtmp, "%s 0.000 KB/s\n", Time::stamp());
+  if (vtmp) rs_fprintf(vtmp, "%s 0.000 KB/s %s\n", Time::stamp(), m_url.c_str());
   
   uint64_t now = Time::in_usec();
-  progress_bgn = now;
-  progress_lst = now;
-  progress_bytes = 0;
+  m_vbgn = now;
+  m_vlst = now;
+  m_vbytes = 0;
 }
 
-static void progress_fn_end(void)
+void RSDownloader::progress_end(void) throw()
 {
   uint64_t now = Time::in_usec();
   
-  if (progress_bytes > 0 && progress_lst + 1000000 < now) {
-    long double sp = ((long double)progress_bytes) / ((long double)(now-progress_lst)) * 1.0e6;
-    if (vtmp) rs_fprintf(vtmp, "%s %7u.%.3u KB/s\n", Time::stamp(),((uint32_t)sp)/1000, ((uint32_t)sp)%1000);
+  if (m_vbytes > 0 && m_vlst + 1000000 < now) {
+    long double sp = ((long double)m_vbytes) / ((long double)(now-m_vlst)) * 1.0e6;
+    if (vtmp) rs_fprintf(vtmp, "%s %7u.%.3u KB/s %s\n", Time::stamp(),((uint32_t)sp)/1000, ((uint32_t)sp)%1000, m_url.c_str());
   }
   
-  if (vtmp) rs_fprintf(vtmp, "%s 0.000 KB/s\n", Time::stamp());
+  if (vtmp) rs_fprintf(vtmp, "%s 0.000 KB/s %s\n", Time::stamp(), m_url.c_str());
 }
 
-bool RSDownloader::progress_fn(const char *, size_t len, void *) 
+bool RSDownloader::progress_fn(const char *buf, size_t len, void *data) 
 {
-  RSDownloader &rsd = RSDownloader::instance();
+  RSDownloader &rsd = *(RSDownloader*)data;
+
+  if (!buf) { // Wznowienie - tyle bylo juz pobrane wczesniej
+    rsd.m_progress.begin().bytes += len;
+    rsd.m_progress.end();
+    return true;
+  }
   
   uint64_t now = Time::in_usec(), 
-           dif = now - progress_bgn;
+           dif = now - rsd.m_vbgn;
+
+  if (!rsd.m_ttfb) rsd.m_ttfb = now - rsd.m_start;
   
-  progress_bgn = now;
-  progress_bytes += len;
-
-  rsd.m_bytes += len;
-  rsd.m_usecs += dif;
-  rsd.m_speed = ((long double)len) / ((long double)dif) * 1.0e6;
-
-  if (progress_lst + difvtmp_sec < now) {
-    long double sp = ((long double)progress_bytes) / ((long double)(now-progress_lst)) * 1.0e6;
-    if (vtmp) rs_fprintf(vtmp, "%s %7u.%.3u KB/s\n", Time::stamp(), ((uint32_t)sp)/1000, ((uint32_t)sp)%1000);
-    progress_bytes = 0;
-    progress_lst = now;
+  rsd.m_vbgn = now;
+  rsd.m_vbytes += len;
+
+  Progress &p = rsd.m_progress.begin();
+  p.bytes += len;
+  p.usecs += dif;
+  p.speed = ((long double)len) / ((long double)dif) * 1.0e6;
+  rsd.m_progress.end();
+
+  if (rsd.m_vlst + difvtmp_sec < now) {
+    long double sp = ((long double)rsd.m_vbytes) / ((long double)(now-rsd.m_vlst)) * 1.0e6;
+    if (vtmp) rs_fprintf(vtmp, "%s %7u.%.3u KB/s %s\n", Time::stamp(), ((uint32_t)sp)/1000, ((uint32_t)sp)%1000, rsd.m_url.c_str());
+    rsd.m_vbytes = 0;
+    rsd.m_vlst = now;
   } 
 
-  return true;
+  return rsd.getControl() == Run; // false - curl przerywa pobieranie (Error::Cancel)
+}
+
+// Wyniki serwerow z etapu 3: te, z ktorych uciekl (failovers), stanely,
+// ostatni pobral bytes w czasie od pierwszego bajtu (albo tez zawiodl)
+void RSDownloader::score(unsigned failovers, bool ok, uint64_t bytes) throw()
+{
+  Scoreboard &sb = Scoreboard::instance();
+  uint64_t took = Time::in_usec() - m_start;
+
+  for (size_t i = 0; i < failovers && i < m_names.size(); ++i) sb.failure(m_names[i]);
+  if (failovers >= m_names.size()) return;
+
+  const std::string &last = m_names[failovers];
+  if (ok && m_ttfb && took > m_ttfb) sb.success(last, bytes, took - m_ttfb, m_ttfb);
+  else if (!ok) sb.failure(last);
 }
 
 void RSDownloader::d_stage_3(std::string &url) 
 {
   if (dia) rs_fprintf(dia, "%s - RSD - Laczenie z '%s' (poziom 3)\n", Time::stamp(), url.c_str());
   
-  m_status = Downloading;
-  progress_fn_begin();
-  Http http;
-
-  m_bytes = 0; // Na wszelki wypadek tutaj tez zerujemy dane
-  m_usecs = 0; // gdy np wczesniej zerwalo polaczenie podczas
-  m_speed = 0; // pobieranie pliku, czy cos tam...
-
-  http.get(d_download_path(m_url.c_str()), url.c_str(), "mirror=", NULL, progress_fn, NULL);
+  status(Downloading);
+  progress_begin();
+  HttpSegments http(keepalive); // dla segments <= 1 zwykle Http::get
+  http.setResume(resume);
+  http.setCookieJar(&m_jar);
+  uint64_t size = m_progress.get().size;
+  http.setPreallocate(prealloc, size*1000); // size w KB, gdy brak Content-Length
+  http.setMapped(mapped);
+  http.setShare(__sync_fetch_and_add(&m_weight, 0), __sync_fetch_and_add(&m_cap, 0));
+  Digest *dg = Digest::create(digest.c_str());
+  http.setDigest(dg);
+  // Stanie serwer - reszta pliku z nastepnego z listy, bez powtarzania etapow 1 i 2
+  http.setStall(stall_secs, stall_bps);
+  http.setMirrors(m_mirrors);
+
+  Progress &p = m_progress.begin();
+  p.bytes = 0; // Na wszelki wypadek tutaj tez zerujemy dane
+  p.usecs = 0; // gdy np wczesniej zerwalo polaczenie podczas
+  p.speed = 0; // pobieranie pliku, czy cos tam...
+  m_progress.end();
+
+  m_start = Time::in_usec();
+  m_ttfb = 0;
+
+  http.get(d_download_path(m_url.c_str()).c_str(), url.c_str(), "mirror=", NULL, segments, progress_fn, this);
+
+  SessionArchive::instance().add(m_url, 3, SessionArchive::Head, 
+      http.header(), http.header() ? strlen(http.header()) : 0);
+
+  progress_end();
+
+  if (dia && http.failovers()) 
+    rs_fprintf(dia, "%s - RSD - Zmieniono serwer %u raz(y), ostatni: '%s' (poziom 3)\n", Time::stamp(), http.failovers(), http.url());
+
+  // Przerwane przez control() - serwer nic nie zawinil, plik zostaje w *.part
+  bool held = http.error() == Http::Error::Cancel && getControl() != Run;
+
+  if (http.error() != Http::Error::NoSpace && !held) // brak miejsca to nie wina serwera
+    score(http.failovers(), http.error() == Http::Error::None && http.status() == Http::Status::Ok,
+        m_progress.get().bytes - http.resumed());
+
+  if (dg) {
+    if (http.error() == Http::Error::None) {
+      snprintf(m_progress.begin().digest, DigestMaxLen, "%s:%s", dg->name(), dg->hex().c_str());
+      m_progress.end();
+    }
+    delete dg;
+  }
 
-  try {
-    File head(d_sessions_path(m_url.c_str(), "-head-3.html"));
-    head.write(http.header(), http.header() ? strlen(http.header()) : 0);
-  } catch (...) { }
+  if (held) { // pobieranie dalej po control(Run) - od razu etap 3
+    if (dia) rs_fprintf(dia, "%s - RSD - Przerwano pobieranie na %llu B (poziom 3)\n", 
+        Time::stamp(), (unsigned long long)m_progress.get().bytes);
+    wait(Ready, Ready, 0, false);
+    throw DHold();
+  }
 
-  progress_fn_end();
+  if (http.error() == Http::Error::NoSpace) { // ponawianie nic nie da
+    if (dia) rs_fprintf(dia, "%s - RSD - Brak miejsca na dysku na %llu KB (poziom 3)\n", Time::stamp(), (unsigned long long)size);
+    status(NoSpace);
+    throw DAbort();
+  }
 
   if (http.error() != Http::Error::None) { // spr bledy
     if (dia) rs_fprintf(dia, "%s - RSD - Blad HTTP: %s (poziom 3)\n", Time::stamp(), http.error());
-    throw DBreak();
+    throw DBreak(failure_of(http.error()), host_of(http.url()));
   }
 
   if (http.status() != Http::Status::Ok) {
     if (dia) rs_fprintf(dia, "%s - RSD - Nieprawidlowy kod HTTP: %d (poziom 3)\n", Time::stamp(), http.status());
-    throw DBreak();
+    throw DBreak(RetryPolicy::HttpError, host_of(http.url()));
   }
 
-  m_status = Downloaded;
+  status(Downloaded);
 
   // Ok!! Ok!! Ok!!
 }
@@ -7,29 +7,90 @@
 #define __RS_DOWNLOADER_HH__
 
 #include <string>
+#include <vector>
 #include <rs/Exception.hh>
-#include <rs/Mutex.hh>
-#include <rs/Semaphore.hh>
+#include <rs/SeqLock.hh>
+#include <rs/CookieJar.hh>
+#include <rs/RetryPolicy.hh>
 #include <stdint.h>
 
 class RSDownloader {
   public:
     /**
-     * Klasa singleton - istnieje tylko jeden obiekt tej klasy.
-     * Z RapidShare.com mozna sciagac tylko jeden plik naraz.
+     * Jedno zadanie pobrania pliku (etapy 1, 2 i 3, z ponawianiem). Zadania
+     * tworzy i uruchamia na swoich watkach DownloaderPool, tu sa jeszcze
+     * ustawienia wspolne dla wszystkich zadan (metody statyczne).
      */
-    static RSDownloader &instance(void);
+    RSDownloader(const std::string &url) throw();
+    ~RSDownloader(void) throw() { }
 
     /** 
-     * @brief Zadanie sciagniecia pliku z zapodanego url-a.
+     * @brief Sprawdzenie, czy mozna pobierac z zapodanego url-a.
      * 
      * @param url  url do pliku
      *
      * @throw 
-     * EAlready - jest juz sciagany jakis plik.
      * EInvalid - niepoprawny url
      */
-    void download(const std::string &url) throw(EAlready, EInvalid);
+    static void validate(const std::string &url) throw(EInvalid);
+
+    /**
+     * @brief Pobieraj plik (status koncowy w getStatus).
+     *
+     * false - zadanie musi odczekac (serwery zajete, odliczanie przed
+     * pobieraniem): run() trzeba wolac ponownie za park ms, watek jest w tym
+     * czasie wolny. Status i pozostaly czas sa w getProgress.
+     */
+    bool run(uint64_t &park) throw();
+
+    // park z run(): zadanie wstrzymane, czeka na control(Run), nie na czas
+    static const uint64_t Held = ~0ULL;
+
+    enum Control {
+      Run    = 0, // pobieraj
+      Pause  = 1, // wstrzymaj, stan zostaje (plik *.part i dziennik zakresow)
+      Cancel = 2  // zakoncz ze statusem Canceled
+    };
+
+    /**
+     * @brief Wstrzymanie, wznowienie albo anulowanie zadania (z dowolnego
+     * watku). Pobieranie przerywa ujscie curl-a przy najblizszym kawalku
+     * danych - lacze, polaczenie i udzial w limicie predkosci sa zwalniane,
+     * a run() konczy sie z park == Held (albo zadaniem Canceled). Po
+     * control(Run) kolejne run() pobiera dalej od miejsca, w ktorym
+     * stanelo (z setResume(true), bez niego - od poczatku) albo odczekuje
+     * reszte przerwanego odczekania.
+     */
+    void control(Control c) throw() { __sync_lock_test_and_set(&m_control, (int)c); }
+    Control getControl(void) const throw() { return (Control)__sync_fetch_and_add(&m_control, 0); }
+    /**
+     * @brief Jak run() przy control() innym niz Run, dla zadania bez watku
+     * (jeszcze nie uruchomione albo odczekujace) - bez czekania na run().
+     */
+    void settle(void) throw();
+
+    /**
+     * @brief Wejscie do etapu 3 (enter == true, moze blokowac) i wyjscie z
+     * niego. Etapy 1 i 2 (z odliczaniem) ida bez tego, wiec zadanie moze
+     * przygotowac sie zawczasu, gdy lacze zajmuja inne. Wejscie zwraca
+     * false, gdy w czasie czekania control() zmienilo sie z Run - wtedy
+     * bez wyjscia, a run() konczy sie jak przy wstrzymaniu.
+     */
+    typedef bool (*gate_fn)(bool enter, const RSDownloader *rsd, void *data);
+    void setGate(gate_fn fn, void *data) throw() { m_gate = fn; m_gdata = data; }
+
+    /**
+     * @brief Udzial zadania w limicie predkosci (setRateLimit): waga wobec
+     * innych pobieran (domyslnie Limiter::DefWeight, jak kazde) i wlasny
+     * limit w B/s (0 - brak). Z dowolnego watku, dziala od nastepnego
+     * etapu 3 (takze po wznowieniu). Kawalki (setSegments) dziela go miedzy
+     * siebie.
+     */
+    void setShare(unsigned weight, uint64_t cap = 0) throw()
+    {
+      __sync_lock_test_and_set(&m_weight, weight);
+      __sync_lock_test_and_set(&m_cap, cap);
+    }
 
     enum Status {
       None         =  0,  // Nic do roboty
@@ -43,34 +104,71 @@ class RSDownloader {
       Rivalry      =  8,  // Ktos rowniez probuje sciagac
       Limit        =  9,  // Wyczerpany limit
       Busy         =  10, // Serwery zajete
-      Unknown      =  11  // ?
+      Unknown      =  11, // ?
+      NoSpace      =  12, // Brak miejsca na dysku
+      Queued       =  13, // Czeka na wolny watek w puli
+      Ready        =  14, // Przygotowany, czeka na wolne lacze
+      Paused       =  15  // Wstrzymany, czeka na wznowienie
     };
 
     /** 
      * @brief Funkcja zwracajaca opis statusu.
      */
     static const char *descr(Status s) throw();
+    /**
+     * @brief Czy zadanie z tym statusem juz sie zakonczylo
+     */
+    static bool finished(Status s) throw()
+    {
+      return s == Downloaded || s == Canceled || s == NotFound || s == NoSpace;
+    }
 
     static const size_t UrlMaxLen = 1024;
 
+    static const size_t DigestMaxLen = 80; // "sha256:" + 64 znaki hex
+
+    /**
+     * Stan zadania. Publikowany przez SeqLock - watek pobierajacy (i ujscie
+     * curl-a) nigdy nie czeka na czytajacych, a odczyt jest zawsze spojny.
+     */
+    struct Progress {
+      Status status;
+      uint64_t bytes;    // Ile bajtow juz pobrano
+      uint64_t usecs;    // Ile czasu trwa pobieranie
+      uint64_t size;     // Rozmiar pobieranego pliku (KB, ze strony)
+      long double speed; // Chwilowa predkosc sciagania
+      size_t waiting;    // Czas oczekiwania (sek, liczony przy odczycie z until)
+      uint64_t until;    // Do kiedy czeka (Time::mono_msec()), 0 - nie czeka
+      char digest[DigestMaxLen]; // "rodzaj:hex", pusty gdy brak
+    };
+
     /**
      * @brief Pobranie aktualnego statusu
      */
-    Status getStatus(void) throw() 
+    Status getStatus(void) const throw() 
     { 
-      Lock l(m_lock); 
-      return m_status; 
+      Progress p;
+      m_progress.read(p);
+      return p.status; 
     }
 
     /**
      * @brief Pobranie url-a do aktualnie sciaganego pliku.
      */
-    void getUrl(std::string &url) throw() 
+    void getUrl(std::string &url) const throw() 
     { 
-      Lock l(m_lock); 
-      url = m_url;
+      url = m_url; // stale od konstrukcji
     };
 
+    /**
+     * @brief Spojna kopia stanu zadania (bez blokad, z dowolnego watku).
+     */
+    void getProgress(Progress &p) const throw()
+    {
+      m_progress.read(p);
+      p.waiting = left(p.until);
+    }
+
     /**
      * @brief Pobranie postepu sciaganego pliku.
      */
@@ -82,56 +180,158 @@ class RSDownloader {
         uint64_t &size,     // Rozmiar pobieranego pliku
         long double &speed, // Chwilowa predkosc sciagania
         size_t &waiting     // Czas oczekiwania
-        ) throw()
+        ) const throw()
     {
-      Lock l(m_lock);
-      status = m_status;
+      Progress p;
+      getProgress(p);
+      status = p.status;
       url = m_url;
-      bytes = m_bytes;
-      usecs = m_usecs;
-      size = m_size;
-      speed = m_speed;
-      waiting = m_waiting;
+      bytes = p.bytes;
+      usecs = p.usecs;
+      size = p.size;
+      speed = p.speed;
+      waiting = p.waiting;
+    }
+
+    /**
+     * @brief Jak wyzej, dodatkowo skrot pobranego pliku w postaci
+     * "rodzaj:hex" (pusty, gdy jeszcze nie ma albo skroty sa wylaczone).
+     */
+    void getProgress(Status &status, std::string &url, uint64_t &bytes, 
+        uint64_t &usecs, uint64_t &size, long double &speed, size_t &waiting,
+        std::string &digest) const throw()
+    {
+      Progress p;
+      getProgress(p);
+      status = p.status;
+      url = m_url;
+      bytes = p.bytes;
+      usecs = p.usecs;
+      size = p.size;
+      speed = p.speed;
+      waiting = p.waiting;
+      digest = p.digest;
     }
 
     /**
      * @brief Ustaw katalog do ktorego zapisywac pliki
      */
-    void setDownloadDir(const std::string &path) throw();
+    static void setDownloadDir(const std::string &path) throw();
     /**
-     * @brief Ustaw katalog do ktorego zapisywac strony
+     * @brief Ustaw katalog archiwum stron i naglowkow (SessionArchive):
+     * nowy segment co segment bajtow, keep - ile segmentow trzymac (0 - wszystkie)
      */
-    void setSessionsDir(const std::string &path) throw();
+    static void setSessionsDir(const std::string &path, 
+        uint64_t segment = 64*1024*1024, unsigned keep = 0) throw();
     /**
      * @brief Ustaw plik diagnostyczny
      */
-    void setDiagnostic(const std::string &path) throw();
+    static void setDiagnostic(const std::string &path) throw();
     /**
      * @brief Ustaw plik z raportami predkosci chwilowej
      */
-    void setSpeedRaporting(const std::string &path, uint32_t difsec = 10) throw();
+    static void setSpeedRaporting(const std::string &path, uint32_t difsec = 10) throw();
+    /**
+     * @brief Wlacz pule polaczen keep-alive (HttpPool) dla wszystkich etapow
+     */
+    static void setKeepAlive(bool on) throw();
+    /**
+     * @brief Pobieraj plik n rownoleglymi polaczeniami (Range), 1 - jednym
+     */
+    static void setSegments(unsigned n) throw();
+    /**
+     * @brief Wznawiaj przerwane pobieranie (plik *.part i dziennik zakresow)
+     */
+    static void setResume(bool on) throw();
+    /**
+     * @brief Rezerwuj miejsce na caly plik przed pobieraniem (fallocate),
+     * gdy sie nie zmiesci - status NoSpace zamiast zapychania dysku
+     */
+    static void setPreallocate(bool on) throw();
+    /**
+     * @brief Zapis pobieranego pliku przez mmap, gdy znamy jego rozmiar
+     * (Content-Length albo rozmiar ze strony)
+     */
+    static void setMapped(bool on) throw();
+    /**
+     * @brief Limit predkosci wszystkich pobieran w B/s (0 - bez limitu),
+     * mozna zmieniac w trakcie pobierania
+     */
+    static void setRateLimit(uint64_t bps) throw();
+    /**
+     * @brief Licz skrot pobieranego pliku w locie: "crc32c", "xxh64",
+     * "sha256", NULL - bez skrotu
+     */
+    static void setDigest(const char *name) throw();
+    /**
+     * @brief Jak dlugo pamietac adresy serwerow (0 - pytaj DNS zawsze) i czy
+     * laczyc sie rownolegle z kilkoma adresami (IPv6/IPv4) jednego serwera
+     */
+    static void setDns(unsigned ttl, bool racing) throw();
+    /**
+     * @brief Gdy przez secs sekund plik idzie wolniej niz bps B/s, pobieranie
+     * przechodzi na nastepny serwer z listy i kontynuuje od miejsca, gdzie
+     * stanelo. secs == 0 - bez pilnowania.
+     */
+    static void setStall(unsigned secs, uint64_t bps) throw();
+    /**
+     * @brief Najwyzej job ponowien jednego zadania i host_tries ponowien do
+     * jednego hosta w host_secs sekund (0 - bez limitu hosta). Odstepy dla
+     * rodzajow bledow - RetryPolicy::setRule.
+     */
+    static void setRetries(unsigned job, unsigned host_tries, unsigned host_secs) throw();
+    /**
+     * @brief Plik z wynikami serwerow (predkosc, czas do pierwszego bajtu,
+     * awarie) - serwer jest wybierany wedlug nich, ulubione tylko gdy brak
+     * pomiarow. explore - jak czesto (0..1) probowac innego serwera.
+     */
+    static void setScoreboard(const std::string &path, double explore = 0.1) throw();
+    static uint64_t getRateLimit(void) throw();
 
   private:
-    RSDownloader(void) throw();
     RSDownloader(const RSDownloader &);
-    ~RSDownloader(void) throw();
-
-    Mutex m_lock;
-    Semaphore m_wait;
-    Status m_status;
-    std::string m_url;
-    uint64_t m_bytes, m_usecs, m_size;
-    long double m_speed;
-    size_t m_waiting;
-
-    void thread_fn(void) throw();
-    static void *s_thread_fn(void *);
+
+    const std::string m_url;
+    SeqLock<Progress> m_progress; // pisze tylko watek zadania albo jego ujscie
+    CookieJar m_jar; // ciastka przechodza z etapu na etap
+    std::vector<std::string> m_mirrors; // serwery z etapu 2, od najlepszego
+    std::vector<std::string> m_names;   // ich nazwy (Scoreboard)
+    uint64_t m_vbgn, m_vlst, m_vbytes; // do raportow predkosci chwilowej
+    uint64_t m_start, m_ttfb; // poczatek etapu 3 i pierwszy bajt po (us)
+    unsigned m_weight; // udzial w limicie predkosci (setShare) - tylko przez __sync_*
+    uint64_t m_cap;
+    gate_fn m_gate;
+    void *m_gdata;
+
+    // Stan miedzy kolejnymi run() (zadanie odczekuje bez watku)
+    enum Phase { Fresh, Stages, Transfer };
+    Phase m_phase;    // od czego zaczac
+    unsigned m_retries;                      // ponowienia razem
+    unsigned m_fails[RetryPolicy::Classes];  // ponowienia wedlug rodzaju bledu
+    std::string m_next; // url nastepnego etapu
+    Status m_post;    // status po odczekaniu
+    uint64_t m_park;  // ile odczekac (ms)
+    mutable int m_control; // Control, zmieniany z innych watkow - tylko przez __sync_*
+    bool m_held;      // wstrzymane (status Paused)
+    Status m_hstatus; // status sprzed wstrzymania
+    uint64_t m_hleft; // ile zostalo do odczekania przy wstrzymaniu (ms)
+
+    static size_t left(uint64_t until) throw();
+
     static bool progress_fn(const char *buf, size_t len, void *data);
+    void progress_begin(void) throw();
+    void progress_end(void) throw();
+    void score(unsigned failovers, bool ok, uint64_t bytes) throw();
+    void status(Status s) throw();
 
     void d_stage_1(std::string &url);
     void d_stage_2(std::string &url);
     void d_stage_3(std::string &url);
-    void wait(Status pre, Status post, size_t secs);
+    void wait(Status pre, Status post, uint64_t ms, bool again) throw();
+    void park(Status pre, Status post, uint64_t ms, bool again);
+    void hold(void) throw();
+    bool suspend(uint64_t &park) throw();
+    bool retry(RetryPolicy::Class cls, const std::string &host, unsigned hint) throw();
 };
 
 #endif
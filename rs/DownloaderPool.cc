@@ -0,0 +1,392 @@
+/**
+ * @brief Pula watkow pobierajacych kilka plikow naraz.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/DownloaderPool.hh>
+#include <rs/Resolver.hh>
+
+#include <algorithm>
+#include <pthread.h>
+
+DownloaderPool &DownloaderPool::instance(void)
+{
+  // Nigdy nie niszczona - watki czekaja na m_ready az do konca procesu
+  static DownloaderPool *pool = new DownloaderPool();
+  return *pool;
+}
+
+DownloaderPool::DownloaderPool(void) throw()
+  : m_next(1), m_workers(0), m_lookahead(0), m_threads(0), m_host_limit(0),
+    m_nslots(0), m_busy(0), m_active(0) { }
+
+void DownloaderPool::spawn(void) throw()
+{
+  pthread_attr_t pat;
+  pthread_t pth;
+  int ret;
+
+  if ((ret = pthread_attr_init(&pat)) != 0)
+    throw EInternal("pthread_attr_init: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_attr_setdetachstate(&pat, PTHREAD_CREATE_DETACHED)) != 0)
+    throw EInternal("pthread_attr_setdetachstate: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_create(&pth, &pat, DownloaderPool::s_thread_fn, this)) != 0)
+    throw EInternal("pthread_create: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_attr_destroy(&pat)) != 0)
+    throw EInternal("pthread_attr_destroy: %d, %s", ret, strerror(ret));
+
+  ++m_threads;
+}
+
+void DownloaderPool::setWorkers(unsigned n) throw()
+{
+  Lock l(m_lock);
+  m_workers = n ? n : 1;
+  resize();
+}
+
+void DownloaderPool::setLookahead(unsigned n) throw()
+{
+  Lock l(m_lock);
+  m_lookahead = n;
+  if (m_workers) resize();
+}
+
+// Watki: pobierajace i przygotowujace, lacza: tylko pobierajace
+// (wolane pod m_lock)
+void DownloaderPool::resize(void) throw()
+{
+  unsigned threads = m_workers + m_lookahead;
+
+  while (m_threads < threads) spawn();
+
+  // Nadmiarowe watki wezma 0 przed kolejnymi zleceniami i skoncza
+  while (m_threads > threads) {
+    m_run.push_front(0);
+    m_ready.v();
+    --m_threads;
+  }
+
+  // Zajetych ponad nowa liczbe laczy nie odbieramy - nikt nie wejdzie,
+  // az zejdzie ponizej
+  m_nslots = m_workers;
+  m_slot.broadcast();
+}
+
+bool DownloaderPool::s_gate_fn(bool enter, const RSDownloader *rsd, void *data)
+{
+  DownloaderPool &pool = *(DownloaderPool*)data;
+  Lock l(pool.m_lock);
+
+  if (!enter) {
+    --pool.m_busy;
+    pool.m_slot.broadcast(); // czekajacy moga byc wstrzymani - budzimy wszystkich
+    return true;
+  }
+
+  // Czeka az inne zlecenie skonczy etap 3 - albo az pause()/cancel()
+  while (pool.m_busy >= pool.m_nslots && rsd->getControl() == RSDownloader::Run)
+    pool.m_slot.wait(pool.m_lock);
+  if (rsd->getControl() != RSDownloader::Run) return false;
+
+  ++pool.m_busy;
+  return true;
+}
+
+void DownloaderPool::setHostLimit(unsigned n) throw()
+{
+  Lock l(m_lock);
+  m_host_limit = n;
+  dispatch();
+}
+
+// Zlecenia z kolejki, ktorych host ma jeszcze miejsce, ida do watkow
+// (wolane pod m_lock)
+void DownloaderPool::dispatch(void) throw()
+{
+  for (std::deque<Job>::iterator it = m_queue.begin(); it != m_queue.end(); ) {
+    // Odczekujace nie zajmuja watkow - bez tego przygotowywalaby sie cala kolejka
+    if (m_active >= m_workers + m_lookahead) break;
+
+    Entry &e = m_jobs[*it];
+    unsigned &running = m_hosts[e.host];
+
+    if (m_host_limit && running >= m_host_limit) { ++it; continue; }
+
+    ++running;
+    ++m_active;
+    e.queued = false;
+    m_run.push_back(*it);
+    m_ready.v();
+    it = m_queue.erase(it);
+  }
+}
+
+DownloaderPool::Job DownloaderPool::download(const std::string &url) throw(EAlready, EInvalid)
+{
+  RSDownloader::validate(url);
+
+  Lock l(m_lock);
+
+  // Dwa zlecenia tego samego pliku pisalyby do jednego pliku
+  for (Jobs::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it) {
+    if (it->second.done) continue;
+    std::string u;
+    it->second.rsd->getUrl(u);
+    if (u == url) throw EAlready();
+  }
+
+  int port;
+  Entry e;
+  e.rsd = new RSDownloader(url);
+  e.rsd->setGate(s_gate_fn, this);
+  e.done = false;
+  e.queued = true;
+  e.paused = false;
+  e.held = false;
+  e.timer = 0;
+  if (!Resolver::split(url.c_str(), e.host, port)) e.host = url;
+
+  Job job = m_next++;
+  if (!m_next) m_next = 1; // 0 jest zarezerwowane dla watkow
+  m_jobs[job] = e;
+  m_queue.push_back(job);
+
+  if (!m_threads) {
+    if (!m_workers) m_workers = 1;
+    resize();
+  }
+
+  dispatch();
+
+  return job;
+}
+
+// Zlecenie przestaje zajmowac miejsce (wolane pod m_lock)
+void DownloaderPool::release(Entry &e) throw()
+{
+  --m_active;
+  if (!--m_hosts[e.host]) m_hosts.erase(e.host);
+}
+
+// Zlecenie bez watku (w kolejce, odczekujace albo wstrzymane) zdjete z
+// kolejki i Scheduler-a, nie zajmuje miejsca. false - ma watek albo zaraz
+// go dostanie, zmiane stanu zrobi run() (wolane pod m_lock)
+bool DownloaderPool::idle(Job job, Entry &e) throw()
+{
+  if (e.held) return true;
+
+  if (e.queued) {
+    m_queue.erase(std::find(m_queue.begin(), m_queue.end(), job));
+    e.queued = false;
+    return true;
+  }
+
+  // Nie da sie odwolac - s_wake_fn juz czeka na m_lock
+  if (e.timer && Scheduler::instance().cancel(e.timer)) {
+    e.timer = 0;
+    release(e);
+    return true;
+  }
+
+  return false;
+}
+
+bool DownloaderPool::pause(Job job) throw()
+{
+  Lock l(m_lock);
+  Jobs::iterator it = m_jobs.find(job);
+  if (it == m_jobs.end() || it->second.done) return false;
+
+  Entry &e = it->second;
+  if (e.paused) return true;
+
+  e.paused = true;
+  e.rsd->control(RSDownloader::Pause); // pobierane - przerwie ujscie curl-a
+  m_slot.broadcast();                  // czekajace na lacze - wyjdzie z s_gate_fn
+
+  if (idle(job, e)) {
+    e.rsd->settle();
+    e.held = true;
+    dispatch(); // miejsce dla nastepnych
+  }
+
+  return true;
+}
+
+bool DownloaderPool::resume(Job job) throw()
+{
+  Lock l(m_lock);
+  Jobs::iterator it = m_jobs.find(job);
+  if (it == m_jobs.end() || it->second.done || !it->second.paused) return false;
+
+  Entry &e = it->second;
+  e.paused = false;
+  e.rsd->control(RSDownloader::Run);
+
+  // Jeszcze nie wstrzymane - watek zobaczy Run (albo odda je w thread_fn)
+  if (e.held) {
+    e.held = false;
+    e.queued = true;
+    m_queue.push_front(job);
+    dispatch();
+  }
+
+  return true;
+}
+
+bool DownloaderPool::cancel(Job job) throw()
+{
+  Lock l(m_lock);
+  Jobs::iterator it = m_jobs.find(job);
+  if (it == m_jobs.end() || it->second.done) return false;
+
+  Entry &e = it->second;
+  e.paused = false;
+  e.rsd->control(RSDownloader::Cancel);
+  m_slot.broadcast();
+
+  if (idle(job, e)) {
+    e.rsd->settle(); // status Canceled
+    e.held = false;
+    e.done = true;
+    dispatch();
+  }
+
+  return true;
+}
+
+bool DownloaderPool::setShare(Job job, unsigned weight, uint64_t cap) throw()
+{
+  Lock l(m_lock);
+  Jobs::iterator it = m_jobs.find(job);
+  if (it == m_jobs.end() || it->second.done) return false;
+
+  it->second.rsd->setShare(weight, cap);
+  return true;
+}
+
+RSDownloader::Status DownloaderPool::getStatus(Job job) throw()
+{
+  Lock l(m_lock);
+  Jobs::iterator it = m_jobs.find(job);
+  return (it == m_jobs.end()) ? RSDownloader::None : it->second.rsd->getStatus();
+}
+
+bool DownloaderPool::getProgress(Job job, RSDownloader::Status &status, std::string &url,
+    uint64_t &bytes, uint64_t &usecs, uint64_t &size, long double &speed,
+    size_t &waiting, std::string &digest) throw()
+{
+  Lock l(m_lock);
+  Jobs::iterator it = m_jobs.find(job);
+  if (it == m_jobs.end()) return false;
+
+  it->second.rsd->getProgress(status, url, bytes, usecs, size, speed, waiting, digest);
+  return true;
+}
+
+bool DownloaderPool::getProgress(Job job, RSDownloader::Progress &p) throw()
+{
+  Lock l(m_lock); // tylko na szukanie w mapie, ujscia curl-a go nie biora
+  Jobs::iterator it = m_jobs.find(job);
+  if (it == m_jobs.end()) return false;
+
+  it->second.rsd->getProgress(p);
+  return true;
+}
+
+bool DownloaderPool::forget(Job job) throw()
+{
+  Lock l(m_lock);
+  Jobs::iterator it = m_jobs.find(job);
+  if (it == m_jobs.end() || !it->second.done) return false;
+
+  delete it->second.rsd;
+  m_jobs.erase(it);
+  return true;
+}
+
+size_t DownloaderPool::pending(void) throw()
+{
+  Lock l(m_lock);
+  size_t n = 0;
+  for (Jobs::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+    if (!it->second.done) ++n;
+  return n;
+}
+
+// Zlecenie odczekalo - z powrotem do watkow (z watku Scheduler-a)
+void DownloaderPool::s_wake_fn(void *data)
+{
+  DownloaderPool &pool = DownloaderPool::instance();
+  Job job = (Job)(uintptr_t)data;
+
+  Lock l(pool.m_lock);
+  Jobs::iterator it = pool.m_jobs.find(job);
+  if (it == pool.m_jobs.end()) return;
+
+  it->second.timer = 0;
+  pool.m_run.push_back(job);
+  pool.m_ready.v();
+}
+
+void *DownloaderPool::s_thread_fn(void *ptr)
+{
+  ((DownloaderPool*)ptr)->thread_fn();
+  return NULL;
+}
+
+void DownloaderPool::thread_fn(void) throw()
+{
+  while (true) {
+    m_ready.p();
+
+    Job job;
+    RSDownloader *rsd;
+
+    {
+      Lock l(m_lock);
+      job = m_run.front();
+      m_run.pop_front();
+      if (!job) return; // setWorkers zmniejszylo pule
+      rsd = m_jobs[job].rsd;
+    }
+
+    uint64_t park;
+    bool done = rsd->run(park); // Bez m_lock - trwa godzinami
+
+    {
+      Lock l(m_lock);
+      Entry &e = m_jobs[job];
+
+      // pause()/cancel() po suspend() w run(), a przed m_lock - dla idle()
+      // zadanie jeszcze mialo watek, wiec wstrzymujemy (anulujemy) je tu
+      if (!done && park != RSDownloader::Held && rsd->getControl() != RSDownloader::Run) {
+        rsd->settle();
+        if (rsd->getControl() == RSDownloader::Cancel) done = true;
+        else park = RSDownloader::Held;
+      }
+
+      if (!done && park == RSDownloader::Held) { // wstrzymane - zwalnia miejsce
+        release(e);
+        if (e.paused) e.held = true;
+        else { // wznowione, zanim run() wrocilo
+          e.queued = true;
+          m_queue.push_front(job);
+        }
+        dispatch();
+        continue;
+      }
+
+      if (!done) { // odczeka bez watku
+        e.timer = Scheduler::instance().add(park, s_wake_fn, (void*)(uintptr_t)job);
+        continue;
+      }
+
+      e.done = true;
+      release(e);
+      dispatch();
+    }
+  }
+}
+
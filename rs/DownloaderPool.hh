@@ -0,0 +1,168 @@
+/**
+ * @brief Pula watkow pobierajacych kilka plikow naraz.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_DOWNLOADER_POOL_HH__
+#define __RS_DOWNLOADER_POOL_HH__
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <map>
+
+#include <rs/Downloader.hh>
+#include <rs/Exception.hh>
+#include <rs/Mutex.hh>
+#include <rs/Semaphore.hh>
+#include <rs/Condition.hh>
+#include <rs/Scheduler.hh>
+
+/**
+ * Kazde zlecenie to osobny RSDownloader (wlasny status, ciastka, postep)
+ * z numerem Job. Zlecenia czekaja w kolejce (status Queued), az zwolni sie
+ * watek i host zlecenia ma wolne miejsce (setHostLimit). Watki sa tworzone
+ * przy setWorkers, a bez niego - jeden, przy pierwszym zleceniu.
+ *
+ * Pobieraja naraz (etap 3) najwyzej setWorkers zlecen. Kolejne setLookahead
+ * zlecen przechodzi w tym czasie etapy 1 i 2 (z odliczaniem) i czeka ze
+ * statusem Ready - gdy lacze sie zwolni, pobieranie rusza od razu.
+ * Razem w toku jest najwyzej setWorkers + setLookahead zlecen.
+ *
+ * Zlecenie, ktore musi odczekac (serwery zajete, limit, odliczanie przed
+ * pobieraniem), oddaje watek - czeka jako wpis w Scheduler i po czasie
+ * wraca do kolejki watkow.
+ *
+ * Zlecenie mozna wstrzymac (pause), wznowic (resume) albo anulowac
+ * (cancel) w kazdej chwili. Wstrzymane nie zajmuje watku, lacza ani
+ * miejsca hosta - pilny plik moze ruszyc od razu, bez czekania az skonczy
+ * sie inne, wielkie pobieranie.
+ *
+ * Zakonczone zlecenia zostaja w puli (status do odczytania), az do forget().
+ */
+class DownloaderPool {
+  public:
+    typedef uint32_t Job;
+
+    static DownloaderPool &instance(void);
+
+    /**
+     * @brief Zlecenie sciagniecia pliku z zapodanego url-a.
+     *
+     * @param url  url do pliku
+     * @return numer zlecenia (nigdy 0)
+     *
+     * @throw
+     * EAlready - ten url jest juz w puli (niezakonczony).
+     * EInvalid - niepoprawny url
+     */
+    Job download(const std::string &url) throw(EAlready, EInvalid);
+
+    /**
+     * @brief Ile zlecen pobiera naraz. Mniej - nadmiarowe watki koncza po
+     * biezacym zleceniu.
+     */
+    void setWorkers(unsigned n) throw();
+    /**
+     * @brief Ile zlecen przygotowywac zawczasu (etapy 1 i 2), gdy wszystkie
+     * lacza sa zajete, 0 - wcale
+     */
+    void setLookahead(unsigned n) throw();
+    /**
+     * @brief Ile zlecen naraz z jednego hosta (z url-a), 0 - bez limitu
+     */
+    void setHostLimit(unsigned n) throw();
+
+    /**
+     * @brief Wstrzymaj zlecenie (status Paused). Pobierane przerywa sie przy
+     * najblizszym kawalku danych, zwalniajac lacze, polaczenie i udzial w
+     * limicie predkosci. false - nie ma takiego albo juz sie zakonczylo.
+     */
+    bool pause(Job job) throw();
+    /**
+     * @brief Wznow wstrzymane zlecenie - przed czekajacymi w kolejce.
+     * Pobieranie idzie dalej od miejsca, gdzie stanelo (z
+     * RSDownloader::setResume), odczekiwanie - przez reszte czasu.
+     * false - nie ma takiego albo nie jest wstrzymane.
+     */
+    bool resume(Job job) throw();
+    /**
+     * @brief Anuluj zlecenie (status Canceled), takze wstrzymane. Pobierane
+     * konczy sie przy najblizszym kawalku danych. false - nie ma takiego
+     * albo juz sie zakonczylo.
+     */
+    bool cancel(Job job) throw();
+    /**
+     * @brief Udzial zlecenia w limicie predkosci (RSDownloader::setShare) -
+     * np. wieksza waga dla pilnego pliku. Pobierane dostaje go przy
+     * kolejnym etapie 3, np. po pause() i resume(). false - nie ma takiego
+     * albo juz sie zakonczylo.
+     */
+    bool setShare(Job job, unsigned weight, uint64_t cap = 0) throw();
+
+    /**
+     * @brief Status zlecenia, None - nie ma takiego
+     */
+    RSDownloader::Status getStatus(Job job) throw();
+
+    /**
+     * @brief Postep zlecenia (jak RSDownloader::getProgress).
+     * false - nie ma takiego zlecenia.
+     */
+    bool getProgress(Job job, RSDownloader::Status &status, std::string &url,
+        uint64_t &bytes, uint64_t &usecs, uint64_t &size, long double &speed,
+        size_t &waiting, std::string &digest) throw();
+
+    bool getProgress(Job job, RSDownloader::Progress &p) throw();
+
+    /**
+     * @brief Usun zakonczone zlecenie. false - nie ma albo jeszcze trwa.
+     */
+    bool forget(Job job) throw();
+
+    /**
+     * @brief Ile zlecen jeszcze sie nie zakonczylo (w kolejce i pobieranych)
+     */
+    size_t pending(void) throw();
+
+  private:
+    DownloaderPool(void) throw();
+    DownloaderPool(const DownloaderPool &);
+
+    struct Entry {
+      RSDownloader *rsd;
+      std::string host;
+      bool done;
+      bool queued;            // w m_queue
+      bool paused;            // pause() bez resume()
+      bool held;              // wstrzymane - poza m_queue, nie liczy sie do m_active
+      Scheduler::Timer timer; // odczekuje, 0 - nie
+    };
+
+    typedef std::map<Job, Entry> Jobs;
+
+    Mutex m_lock;
+    Semaphore m_ready;        // tyle, ile w m_run
+    Condition m_slot;         // zwolnilo sie lacze albo control() (pod m_lock)
+    Jobs m_jobs;
+    std::deque<Job> m_queue;  // czekajace na miejsce u hosta
+    std::deque<Job> m_run;    // do wziecia przez watek, 0 - watek ma skonczyc
+    std::map<std::string, unsigned> m_hosts; // ile zlecen hosta poza m_queue
+    Job m_next;
+    unsigned m_workers, m_lookahead, m_threads, m_host_limit;
+    unsigned m_nslots, m_busy; // ile laczy, ile zajetych (etap 3)
+    unsigned m_active;         // zlecenia w toku (poza m_queue, niezakonczone)
+
+    void dispatch(void) throw();
+    bool idle(Job job, Entry &e) throw();
+    void release(Entry &e) throw();
+    void resize(void) throw();
+    void spawn(void) throw();
+    static bool s_gate_fn(bool enter, const RSDownloader *rsd, void *data);
+    static void s_wake_fn(void *data);
+    void thread_fn(void) throw();
+    static void *s_thread_fn(void *);
+};
+
+#endif
+
@@ -6,6 +6,15 @@
 #include <curl/curl.h>
 
 #include <rs/Http.hh>
+#include <rs/HttpPool.hh>
+#include <rs/HttpEngine.hh>
+#include <rs/Semaphore.hh>
+#include <rs/Rope.hh>
+#include <rs/CookieJar.hh>
+#include <rs/AsyncWriter.hh>
+#include <rs/MapWriter.hh>
+#include <rs/Digest.hh>
+#include <rs/Resolver.hh>
 #include <rs/Exception.hh>
 
 #include <iostream>
@@ -13,6 +22,8 @@
 #include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/statvfs.h>
+#include <sys/socket.h>
 using std::cerr;
 using std::endl;
 
@@ -25,109 +36,112 @@ const Http::Error::Type Http::Error::NoWrite = "Cannot write buffer to file";
 const Http::Error::Type Http::Error::NoAccess = "Cannot open file";
 const Http::Error::Type Http::Error::Timeout = "Timeout on connect";
 const Http::Error::Type Http::Error::NotConnect = "Couldn't connect";
+const Http::Error::Type Http::Error::NoSpace = "Not enough disk space";
+const Http::Error::Type Http::Error::Stalled = "Transfer stalled";
 
 unsigned Http::_timeout_ms = 10000;
+uint64_t Http::_traffic_wire = 0, Http::_traffic_decoded = 0;
+
+Http::Http(bool pooled) throw()
+  : _err(Error::None), _st(Status::None), _pooled(pooled), _jar(NULL), 
+  _curl(NULL), _slist(NULL), _resolve(NULL), _racefd(-1), _page(NULL), _plen(NULL), _preal(0), _rope(NULL), _fd(-1), _fdown(true),
+  _writer(NULL), _prealloc(false), _allocd(false), _mapped(false), _map(NULL), _phint(-1),
+  _digest(NULL), _weight(Limiter::DefWeight), _cap(0),
+    _pos(0), _end(-1), _cut(false), _head(false), _total(-1), _compressed(true),
+  _stall(0), _stall_bps(1), _msec(-1), _code(0), _len(0), _wire(0),
+  _fn(NULL), _data(NULL), _done(NULL), _ddata(NULL) { }
+
+Http::~Http(void) throw() 
+{ 
+  clear(); 
+  delete _writer;
+  delete _map;
+}
 
-Http::Http(void) throw()
-  : _header(NULL), _redirect(NULL), 
-  _err(Error::None), _st(Status::None), 
-  _hlen(0), _hreal(0) { _cookies[0] = 0; }
-
-Http::~Http(void) throw() { clear(); }
-
-struct buffer_task {
-  Http *http;
-  char **page;
-  size_t &len;
-  size_t real;
-  Http::progress_fn fn;
-  void *data;
-  
-  buffer_task(Http *http, char **page, size_t &len, Http::progress_fn fn, void *data)
-    : http(http), page(page), len(len), real(0), fn(fn), data(data) { }
-  ~buffer_task(void) { }
-};
-
-struct stream_task {
-  Http *http;
-  int fd;
-  Http::progress_fn fn;
-  void *data;
-  off_t len;
-
-  stream_task(Http *http, int fd, Http::progress_fn fn, void *data)
-    : http(http), fd(fd), fn(fn), data(data), len(0) { }
-  ~stream_task(void) throw() 
-  {
-    if (fd >= 0 && close(fd)) throw EInternal(strerror(errno));
-  }
-};
-
-size_t def_real_header = 4096,
-       def_real_data = 16384;
+size_t def_real_data = 16384;
 
 size_t Http::header_fn(void *buf, size_t size, size_t nmemb, void *data) {
   size_t sz = size*nmemb;
   Http *h = (Http*)data;
-  
-  if (h->_hreal == 0) {
-    size_t max = def_real_header < sz+1 ? sz+1 : def_real_header;
-
-    char *ptr = (char *)malloc(max);
-    if (!ptr) { h->set(Error::NoMemory); return CURLE_WRITE_ERROR; }
 
-    h->_header = ptr;
-    h->_hreal = max;
-  } else if (h->_hlen + sz + 1 > h->_hreal) {
-    size_t df = h->_hlen + sz + 1 > h->_hreal;
-    size_t max = h->_hreal + (h->_hreal < df ? df : h->_hreal);
-  
-    char *ptr = (char*)realloc(h->_header, max);
-    if (!ptr) { h->set(Error::NoMemory); return CURLE_WRITE_ERROR; }
-    
-    h->_header = ptr;
-    h->_hreal = max;
+  // curl podaje naglowki po jednej linii - od razu je rozbieramy
+  if (!h->_headers.feed((const char*)buf, sz)) { 
+    h->set(Error::NoMemory); 
+    return CURLE_WRITE_ERROR; 
   }
-  
-  memcpy(h->_header + h->_hlen, buf, sz);
-  h->_hlen += sz;
-  h->_header[h->_hlen] = 0;
 
   return sz;
 }
 
 size_t Http::buffer_fn(void *buf, size_t size, size_t nmemb, void *data) {
   size_t sz = size*nmemb;
-  buffer_task *tsk = (buffer_task*)data;
+  Http *h = (Http*)data;
+
+  // Ponad limit - curl wstrzymuje czytanie z gniazda az Limiter wznowi
+  if (!Limiter::instance().take(&h->_flow, sz)) return CURL_WRITEFUNC_PAUSE;
+  char *&page = *h->_page;
+  size_t &len = *h->_plen;
   
-  if (tsk->real == 0) {
+  if (h->_preal == 0) {
     size_t max = def_real_data < sz+1 ? sz+1 : def_real_data;
     
-    if (!((*tsk->page) = new(std::nothrow) char[max])) {
-      tsk->http->set(Error::NoMemory); 
+    if (!(page = new(std::nothrow) char[max])) {
+      h->set(Error::NoMemory); 
       return CURLE_WRITE_ERROR; 
     }
     
-    tsk->real = max;
-  } else if (tsk->len + sz + 1 > tsk->real) {
-    size_t df = tsk->len + sz + 1 > tsk->real;
-    size_t max = tsk->real + (tsk->real < df ? df : tsk->real);
+    h->_preal = max;
+  } else if (len + sz + 1 > h->_preal) {
+    size_t df = len + sz + 1 - h->_preal;
+    size_t max = h->_preal + (h->_preal < df ? df : h->_preal);
   
     char *ptr = new(std::nothrow) char[max];
-    if (!ptr) { tsk->http->set(Error::NoMemory); return CURLE_WRITE_ERROR; }
-    memcpy(ptr, *tsk->page, tsk->len);
-    delete[] (*tsk->page);
+    if (!ptr) { h->set(Error::NoMemory); return CURLE_WRITE_ERROR; }
+    memcpy(ptr, page, len);
+    delete[] page;
     
-    (*tsk->page) = ptr;
-    tsk->real = max;
+    page = ptr;
+    h->_preal = max;
   }
   
-  memcpy((*tsk->page) + tsk->len, buf, sz);
-  tsk->len += sz;
-  (*tsk->page)[tsk->len] = 0;
+  memcpy(page + len, buf, sz);
+  len += sz;
+  page[len] = 0;
+  h->_len += sz;
+  if (h->_digest) h->_digest->update((const char*)buf, sz);
   
-  if (tsk->fn && !tsk->fn((const char*)buf, sz, tsk->data)) {
-    tsk->http->set(Error::Cancel);
+  if (h->_fn && !h->_fn((const char*)buf, sz, h->_data)) {
+    h->set(Error::Cancel);
+    return CURLE_WRITE_ERROR;
+  }
+
+  return sz;
+}
+
+size_t Http::rope_fn(void *buf, size_t size, size_t nmemb, void *data) {
+  size_t sz = size*nmemb;
+  Http *h = (Http*)data;
+
+  // Ponad limit - curl wstrzymuje czytanie z gniazda az Limiter wznowi
+  if (!Limiter::instance().take(&h->_flow, sz)) return CURL_WRITEFUNC_PAUSE;
+
+  if (h->_len == 0) { // Znamy rozmiar - cala strona w jednym kawalku
+    off_t cl = h->_headers.contentLength();
+    if (cl > 0 && !h->_rope->reserve(cl)) {
+      h->set(Error::NoMemory);
+      return CURLE_WRITE_ERROR;
+    }
+  }
+
+  if (!h->_rope->append((const char*)buf, sz)) {
+    h->set(Error::NoMemory);
+    return CURLE_WRITE_ERROR;
+  }
+  h->_len += sz;
+  if (h->_digest) h->_digest->update((const char*)buf, sz);
+
+  if (h->_fn && !h->_fn((const char*)buf, sz, h->_data)) {
+    h->set(Error::Cancel);
     return CURLE_WRITE_ERROR;
   }
 
@@ -136,14 +150,103 @@ size_t Http::buffer_fn(void *buf, size_t size, size_t nmemb, void *data) {
 
 size_t Http::file_fn(void *buf, size_t size, size_t nmemb, void *data) {
   size_t sz = size*nmemb;
-  stream_task *tsk = (stream_task*)data;
-  Http *h = tsk->http;
-  int fd = tsk->fd;
+  Http *h = (Http*)data;
+
+  // Wszystkie bufory u dysku - wstrzymujemy, wznowi watek dyskowy (setWake)
+  if (h->_writer && !(h->_map && h->_map->active()) && !h->_writer->room(sz))
+    return CURL_WRITEFUNC_PAUSE;
+  // Ponad limit - curl wstrzymuje czytanie z gniazda az Limiter wznowi
+  if (!Limiter::instance().take(&h->_flow, sz)) return CURL_WRITEFUNC_PAUSE;
+  int fd = h->_fd;
+
+  if (h->_len == 0 && h->_prealloc && h->_end < 0) {
+    // Naglowki juz sa - rezerwujemy miejsce zanim cokolwiek zapiszemy
+    off_t size = h->_headers.contentLength();
+    if (size <= 0) size = h->_phint;
+    if (size > 0) {
+      Error::Type err = preallocate(fd, 0, size);
+      if (err != Error::None) { h->set(err); return CURLE_WRITE_ERROR; }
+      h->_allocd = true;
+    }
+  }
+
+  if (h->_end >= 0) { // Zakres - piszemy pwrite na swoje miejsce
+    if (h->_len == 0) {
+      int code = h->_headers.status();
+      // 200 od poczatku pliku tez jest dobre - i tak utniemy na _end
+      if (code != 206 && !(code == 200 && h->_pos == 0)) { 
+        h->set(Error::Failed); 
+        return CURLE_WRITE_ERROR; 
+      }
+      // Inny plik (np. strona z bledem) - nie moze trafic w zakres
+      off_t from, to, total;
+      if (h->_total >= 0 && (code == 206 ?
+            !h->_headers.contentRange(from, to, total) || from != h->_pos || total != h->_total :
+            h->_headers.contentLength() >= 0 && h->_headers.contentLength() != h->_total)) {
+        h->set(Error::Failed);
+        return CURLE_WRITE_ERROR;
+      }
+    }
+    if (h->_pos + (off_t)sz > h->_end) {
+      sz = h->_end > h->_pos ? h->_end - h->_pos : 0;
+      h->_cut = true;
+    }
+  }
+
+  if (h->_len == 0 && h->_mapped) {
+    // Rozmiar znany - od razu mapujemy caly zakres (MapWriter sam rezerwuje)
+    off_t to = h->_end;
+    if (to < 0) {
+      to = h->_headers.contentLength();
+      if (to <= 0) to = h->_phint;
+    }
+    if (to > h->_pos) {
+      if (!h->_map) h->_map = new(std::nothrow) MapWriter();
+      bool nospace = false;
+      if (h->_map && h->_map->begin(fd, h->_pos, to, nospace)) {
+        if (h->_end < 0) h->_allocd = true; // na koniec przytniemy do _len
+      } else if (nospace) {
+        h->set(Error::NoSpace);
+        return CURLE_WRITE_ERROR;
+      }
+    }
+  }
 
   size_t done = 0;
 
+  if (h->_map && h->_map->active()) {
+    if (h->_map->write((const char*)buf, sz)) done = sz;
+    else {
+      // Przyszlo wiecej niz zapowiedziano - reszta zwyklym zapisem
+      done = h->_map->position() - h->_pos;
+      h->_map->end();
+      off_t at = h->_pos + done;
+      if ((h->_end < 0 && lseek(fd, at, SEEK_SET) < 0) ||
+          (h->_writer && !h->_writer->begin(fd, at, h->_end >= 0))) {
+        h->set(Error::NoWrite);
+        return CURLE_WRITE_ERROR;
+      }
+    }
+  } else if (h->_writer) { // Do bufora, na dysk pojdzie z watku dyskowego
+    if (!h->_writer->write((const char*)buf, sz)) {
+      h->set(Error::NoWrite);
+      return CURLE_WRITE_ERROR;
+    }
+    done = sz;
+  }
+
+  if (done < sz && h->_writer && h->_map) { // po zejsciu z mmap
+    if (!h->_writer->write((const char*)buf + done, sz - done)) {
+      h->set(Error::NoWrite);
+      return CURLE_WRITE_ERROR;
+    }
+    done = sz;
+  }
+
   while (done < sz) {
-    int wr = write(fd, (char*)buf+done, sz-done);
+    int wr = (h->_end >= 0) ? 
+      pwrite(fd, (char*)buf+done, sz-done, h->_pos+done) : 
+      write(fd, (char*)buf+done, sz-done);
     if (wr < 0) {
       if (errno == EINTR || errno == EAGAIN) continue;
       h->set(Error::NoWrite); 
@@ -152,184 +255,593 @@ size_t Http::file_fn(void *buf, size_t size, size_t nmemb, void *data) {
     done += wr;
   }
 
-  if (tsk->fn && !tsk->fn((const char*)buf, sz, tsk->data)) {
+  if (sz && h->_fn && !h->_fn((const char*)buf, sz, h->_data)) {
     h->set(Error::Cancel);
     return CURLE_WRITE_ERROR;
   }
   
-  tsk->len += sz;
+  // Skrot razem z pozycja - HttpSegments skleja kawalki po position()
+  if (h->_digest) h->_digest->update((const char*)buf, sz);
+  h->_len += sz;
+  h->_pos += sz;
+
+  // Doszlismy do (byc moze przesunietego) konca zakresu
+  if (h->_cut) return 0;
+
   return sz;
 }
 
-static curl_slist *MoreHeaders(void) throw()
+// Probe - tresc (bajt albo caly plik, gdy serwer zignorowal Range) pomijamy
+size_t Http::probe_fn(void *, size_t, size_t, void *data) {
+  ((Http*)data)->_cut = true;
+  return 0;
+}
+
+off_t Http::total(void) const
+{
+  off_t from, to, total;
+  if (_headers.status() != 206 || !_headers.contentRange(from, to, total)) return -1;
+  return total;
+}
+
+Http::Error::Type Http::preallocate(int fd, off_t from, off_t len) throw()
 {
-  static curl_slist *slist = NULL;
+  if (fallocate(fd, 0, from, len) == 0) return Error::None;
+  if (errno == ENOSPC || errno == EFBIG) return Error::NoSpace;
+
+  // System plikow nie umie fallocate - przynajmniej sprawdzmy czy sie zmiesci
+  struct statvfs vfs;
+  if (fstatvfs(fd, &vfs) == 0 && (unsigned long long)vfs.f_bavail*vfs.f_frsize < (unsigned long long)len)
+    return Error::NoSpace;
+
+  return Error::None;
+}
+
+static curl_slist *MoreHeaders(bool keepalive) throw()
+{
+  static curl_slist *slist = NULL, *klist = NULL;
+  static const char *agent = "User-Agent: Mozilla/5.0 (X11; U; Linux i686; en-US; rv:1.8.1.8) Gecko/20071028 PLD/3.0 (Th) BonEcho/2.0.0.8";
   if (!slist) {
-    if (!(slist = curl_slist_append(slist, "User-Agent: Mozilla/5.0 (X11; U; Linux i686; en-US; rv:1.8.1.8) Gecko/20071028 PLD/3.0 (Th) BonEcho/2.0.0.8")))
+    if (!(slist = curl_slist_append(slist, agent)))
       throw EInternal("curl_slist_append() - fix it!");
     if (!(slist = curl_slist_append(slist, "Keep-Alive: 300")))
       throw EInternal("curl_slist_append() - fix it!");
     if (!(slist = curl_slist_append(slist, "Connection: close"))) 
       throw EInternal("curl_slist_append() - fix it!");
   }
+  if (!klist) { // Dla puli polaczen - nie zamykamy polaczenia
+    if (!(klist = curl_slist_append(klist, agent)))
+      throw EInternal("curl_slist_append() - fix it!");
+    if (!(klist = curl_slist_append(klist, "Keep-Alive: 300")))
+      throw EInternal("curl_slist_append() - fix it!");
+    if (!(klist = curl_slist_append(klist, "Connection: keep-alive"))) 
+      throw EInternal("curl_slist_append() - fix it!");
+  }
   // FIXME : potrzeba jeszcze curl_slist_free_all(slist)
-  return slist;
+  return keepalive ? klist : slist;
 }
 
-size_t Http::get(char *&page, size_t &len, 
-    const char *url, const char *post, const char *cookies, 
-    Http::progress_fn fn, void *data, int msec) throw() 
+// Kopia wspolnych naglowkow z dodatkowym, do zwolnienia curl_slist_free_all
+static curl_slist *OwnHeaders(const curl_slist *base, const char *extra) throw()
 {
-  clear();
-  page = NULL;
-  len = 0;
+  curl_slist *slist = NULL, *tmp;
 
-  _st = Status::Failed;
-  _err = Error::Failed;
+  for (; base; base = base->next) {
+    if (!(tmp = curl_slist_append(slist, base->data))) { curl_slist_free_all(slist); return NULL; }
+    slist = tmp;
+  }
+  if (!(tmp = curl_slist_append(slist, extra))) { curl_slist_free_all(slist); return NULL; }
+
+  return tmp;
+}
+
+void *Http::acquire(const char *url) throw()
+{
+  if (!_pooled) return curl_easy_init();
+
+  CURL *curl = HttpPool::instance().acquire(url);
+  if (curl && curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L) != CURLE_OK) {
+    HttpPool::instance().release(url, curl);
+    return NULL;
+  }
+
+  return curl;
+}
+
+void Http::release(const char *url, void *curl) throw()
+{
+  if (_pooled) HttpPool::instance().release(url, (CURL*)curl);
+  else curl_easy_cleanup((CURL*)curl);
+}
+
+// Zakonczenie transferu w watku HttpEngine
+struct HttpCompletion {
+  static void done(CURL *, CURLcode cd, void *data)
+  {
+    Http *h = (Http*)data;
+
+    // Z pisarzem w tle koniec przyjdzie przez call() (drained)
+    if (h->finish(cd)) complete(h);
+  }
+
+  static void complete(void *data)
+  {
+    Http *h = (Http*)data;
+    Http::done_fn fn = h->_done;
+    void *ddata = h->_ddata;
+
+    h->complete();
+
+    // Po fn obiekt moze juz nie istniec (np. get() juz wrocil)
+    if (fn) fn(h, ddata);
+  }
+
+  // Z watku dyskowego - do watku silnika, w kolejnosci z resume
+  static void drained(void *data)
+  {
+    HttpEngine::instance().call(complete, data);
+  }
+
+  static void wake(void *data)
+  {
+    HttpEngine::instance().call(resume, data);
+  }
+
+  // Dysk oddal bufor - transfer (jesli jeszcze trwa) czyta dalej
+  static void resume(void *data)
+  {
+    Http *h = (Http*)data;
+    if (h->_curl) curl_easy_pause((CURL*)h->_curl, CURLPAUSE_CONT);
+  }
+};
+
+// Gniazdo polaczone juz przez Resolver::race oddajemy curl-owi
+struct HttpSocket {
+  static curl_socket_t open(void *data, curlsocktype, struct curl_sockaddr *addr)
+  {
+    Http *h = (Http*)data;
+    int fd = h->_racefd;
+
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    if (fd >= 0 && getsockname(fd, (sockaddr*)&ss, &len) == 0 && ss.ss_family == addr->family) {
+      h->_racefd = -1; // teraz zamknie je curl
+      return fd;
+    }
+
+    return socket(addr->family, addr->socktype | SOCK_CLOEXEC, addr->protocol);
+  }
+
+  static int sockopt(void *, curl_socket_t fd, curlsocktype)
+  {
+    // Polaczone gniazdo poznajemy po tym, ze ma juz adres drugiej strony
+    sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+    return getpeername(fd, (sockaddr*)&ss, &len) == 0 ? CURL_SOCKOPT_ALREADY_CONNECTED : CURL_SOCKOPT_OK;
+  }
+};
+
+// Przez proxy laczy sie curl sam - wtedy nie ma sensu sie scigac
+static bool Proxied(void) throw()
+{
+  static const char *vars[] = { "http_proxy", "https_proxy", "all_proxy", "HTTPS_PROXY", "ALL_PROXY", NULL };
+  for (const char **v = vars; *v; ++v) {
+    const char *e = getenv(*v);
+    if (e && *e) return true;
+  }
+  return false;
+}
+
+bool Http::resolve(void *curl, const char *url) throw()
+{
+  Resolver &res = Resolver::instance();
+  std::string host;
+  std::vector<std::string> addrs;
+  int port;
+  bool raced;
+  // W watku silnika (np. HttpSegments::steal) nie wolno czekac na DNS ani connect
+  bool block = !HttpEngine::instance().inside();
+
+  if (!Resolver::split(url, host, port) || !res.lookup(host, addrs, block, &raced)) 
+    return true; // niech curl sprobuje sam
+  if (addrs.size() == 1 && addrs[0] == host) return true; // adres numeryczny
+
+  if (block && !raced && addrs.size() > 1 && res.racing() && !Proxied()) {
+    size_t won;
+    int fd = res.race(addrs, port, _timeout_ms, won);
+    if (fd >= 0) {
+      res.prefer(host, addrs[won]);
+      addrs.assign(1, addrs[won]);
+      _racefd = fd;
+    }
+  }
+
+  _resolve = curl_slist_append(NULL, Resolver::entry(host, port, addrs).c_str());
+  if (!_resolve ||
+      curl_easy_setopt((CURL*)curl, CURLOPT_RESOLVE, _resolve) != CURLE_OK ||
+      (_racefd >= 0 && (
+        curl_easy_setopt((CURL*)curl, CURLOPT_OPENSOCKETFUNCTION, HttpSocket::open) != CURLE_OK ||
+        curl_easy_setopt((CURL*)curl, CURLOPT_OPENSOCKETDATA, this) != CURLE_OK ||
+        curl_easy_setopt((CURL*)curl, CURLOPT_SOCKOPTFUNCTION, HttpSocket::sockopt) != CURLE_OK))) {
+    unresolve();
+    return false;
+  }
+
+  return true;
+}
 
-  CURL *curl = curl_easy_init();
-  if (!curl) { _err = Error::NoMemory; return -1; }
+void Http::unresolve(void) throw()
+{
+  if (_resolve) {
+    curl_slist_free_all((curl_slist*)_resolve);
+    _resolve = NULL;
+  }
+  // curl nie wzial gniazda (np. uzyl polaczenia z puli)
+  if (_racefd >= 0) {
+    close(_racefd);
+    _racefd = -1;
+  }
+}
 
-  buffer_task tsk(this, &page, len, fn, data);
+bool Http::prepare(const char *url, const char *post, const char *cookies, 
+    Http::progress_fn fn, void *data, Http::done_fn done, void *ddata, int msec) throw()
+{
+  _url = url;
+  _len = _wire = 0;
+  _msec = msec;
+  if (_digest) _digest->reset();
+  _fn = fn;
+  _data = data;
+  _done = done;
+  _ddata = ddata;
+
+  CURL *curl = (CURL*)acquire(url);
+  if (!curl) { _err = Error::NoMemory; return false; }
+
+  bool file = _fd >= 0;
+  curl_slist *hdrs = MoreHeaders(_pooled);
+
+  std::string jcookies;
+  if (_jar && _jar->header(url, jcookies)) {
+    if (cookies) jcookies = std::string(cookies) + "; " + jcookies;
+    cookies = jcookies.c_str(); // curl robi sobie kopie
+  }
 
+  if (_end >= 0 || _head) {
+    // CURLOPT_RANGE dziala tylko dla GET, a etap 3 to POST
+    char range[64];
+    if (_head) snprintf(range, sizeof(range), "Range: bytes=0-0");
+    else snprintf(range, sizeof(range), "Range: bytes=%lld-%lld", (long long)_pos, (long long)_end-1);
+    if (!(hdrs = OwnHeaders(hdrs, range))) { 
+      release(url, curl); 
+      _err = Error::NoMemory; 
+      return false; 
+    }
+    _slist = hdrs;
+  }
+
+  // COPYPOSTFIELDS - post nie musi zyc do konca transferu
   if (curl_easy_setopt(curl, CURLOPT_URL, url) != CURLE_OK ||
-      (post && curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post) != CURLE_OK) ||
+      (post && curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, post) != CURLE_OK) ||
       (cookies && curl_easy_setopt(curl, CURLOPT_COOKIE, cookies) != CURLE_OK) ||
       (msec > 0 && curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, msec) != CURLE_OK) ||
       curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, _timeout_ms) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, MoreHeaders()) != CURLE_OK ||
+      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdrs) != CURLE_OK ||
+      curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L) != CURLE_OK ||
+      // "" - wszystko co curl umie rozpakowac; ujscia dostaja juz czysta tresc
+      (!file && !_head && _compressed && curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "") != CURLE_OK) ||
 //      curl_easy_setopt(curl, CURLOPT_VERBOSE, 1) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, buffer_fn) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_WRITEDATA, &tsk) != CURLE_OK ||
+      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, 
+        _head ? probe_fn : (file ? file_fn : (_rope ? rope_fn : buffer_fn))) != CURLE_OK ||
+      curl_easy_setopt(curl, CURLOPT_WRITEDATA, this) != CURLE_OK ||
       curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_fn) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_HEADERDATA, this) != CURLE_OK) {
-    curl_easy_cleanup(curl);
+      curl_easy_setopt(curl, CURLOPT_HEADERDATA, this) != CURLE_OK ||
+      // curl liczy wstrzymanie przez Limiter jak zastoj - bez pilnowania,
+      // gdy limit nie pozwala na bps
+      (_stall && !throttled(_stall_bps ? _stall_bps : 1) && (
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long)(_stall_bps ? _stall_bps : 1)) != CURLE_OK ||
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)_stall) != CURLE_OK)) ||
+      !resolve(curl, url)) {
+    release(url, curl);
+    if (_slist) { curl_slist_free_all((curl_slist*)_slist); _slist = NULL; }
     _err = Error::InvalidArgs;
-    return -1;
+    return false;
   }
-  
-  CURLcode cd = curl_easy_perform(curl);
+
+  if (file && AsyncWriter::policy().buffer) {
+    if (!_writer) _writer = new(std::nothrow) AsyncWriter();
+    // Bez pisarza (brak pamieci) zapisujemy po staremu
+    if (_writer && !_writer->begin(_fd, _pos, _end >= 0)) {
+      delete _writer;
+      _writer = NULL;
+    }
+    if (_writer) _writer->setWake(HttpCompletion::wake, this);
+  } else if (file && _writer) { // Pisarz wylaczony w miedzyczasie
+    delete _writer;
+    _writer = NULL;
+  }
+
+  Limiter::instance().attach(&_flow, curl, _weight, _cap);
+
+  _curl = curl;
+  return true;
+}
+
+// Czy Limiter trzyma ten transfer ponizej bps (wlasny limit albo rowny
+// udzial w globalnym razem z tym transferem)
+bool Http::throttled(uint64_t bps) const throw()
+{
+  Limiter &lim = Limiter::instance();
+  uint64_t rate = lim.rate();
+  if (_cap && _cap < bps) return true;
+  return rate && rate/(lim.flows() + 1) < bps;
+}
+
+bool Http::finish(int code) throw()
+{
+  CURLcode cd = (CURLcode)code;
+
+  // Licznik curl-a liczy tresc jeszcze przed rozpakowaniem
+  curl_off_t wire = 0;
+  if (curl_easy_getinfo((CURL*)_curl, CURLINFO_SIZE_DOWNLOAD_T, &wire) == CURLE_OK) _wire = wire;
+  __sync_fetch_and_add(&_traffic_wire, (uint64_t)_wire);
+  __sync_fetch_and_add(&_traffic_decoded, (uint64_t)_len);
+
+  // Za wolno przez okno setStall (a nie limit na polaczenie czy caly transfer),
+  // pretransfer > 0 - zadanie bylo juz wyslane (takze po starym polaczeniu)
+  curl_off_t took = 0, sent = 0;
+  if (cd == CURLE_OPERATION_TIMEDOUT && _stall &&
+      curl_easy_getinfo((CURL*)_curl, CURLINFO_TOTAL_TIME_T, &took) == CURLE_OK &&
+      curl_easy_getinfo((CURL*)_curl, CURLINFO_PRETRANSFER_TIME_T, &sent) == CURLE_OK &&
+      sent > 0 && (_msec <= 0 || took/1000 < _msec)) 
+    _err = Error::Stalled;
+
+  Limiter::instance().detach(&_flow);
+  release(_url.c_str(), _curl);
+  _curl = NULL;
+
+  if (_slist) {
+    curl_slist_free_all((curl_slist*)_slist);
+    _slist = NULL;
+  }
+  unresolve();
+
+  _code = cd;
+  if (_fd >= 0 && _map) _map->end();
+
+  // Reszta z buforow musi trafic do pliku przed zamknieciem (i przed done),
+  // ale watek silnika na dysk nie czeka. Takze gdy juz wszystko zapisane -
+  // przez call(), za ewentualnym resume z watku dyskowego.
+  if (_fd >= 0 && _writer) {
+    if (_writer->drain(HttpCompletion::drained, this))
+      HttpEngine::instance().call(HttpCompletion::complete, this);
+    return false;
+  }
+
+  return true;
+}
+
+void Http::complete(void) throw()
+{
+  CURLcode cd = (CURLcode)_code;
+
+  if (_fd >= 0) {
+    if (_writer && _writer->end() == false) { 
+      _err = Error::NoWrite; 
+      if (cd == CURLE_OK) cd = CURLE_WRITE_ERROR; 
+    }
+    // Rezerwacja mogla byc wieksza niz to co przyszlo
+    if (_allocd && ftruncate(_fd, _len) && cd == CURLE_OK) { 
+      _err = Error::NoWrite; 
+      cd = CURLE_WRITE_ERROR; 
+    }
+    if (_fdown && close(_fd) && cd == CURLE_OK) cd = CURLE_WRITE_ERROR;
+    _fd = -1;
+  }
+
+  if (cd == CURLE_WRITE_ERROR && _cut) cd = CURLE_OK; // koniec zakresu
+
   if (cd != CURLE_OK) {
-    if (cd == CURLE_OPERATION_TIMEOUTED) _err = Error::Timeout;
+    _st = Status::Failed;
+    if (cd == CURLE_OPERATION_TIMEDOUT && _err == Error::Stalled) ;
+    else if (cd == CURLE_OPERATION_TIMEDOUT) _err = Error::Timeout;
     else if (cd == CURLE_COULDNT_CONNECT) _err = Error::NotConnect;
+    else if (cd == CURLE_WRITE_ERROR && _err != Error::Failed) ; // blad z ujscia
     else _err = Error::Failed;
-
-    curl_easy_cleanup(curl);
-    return -1;
+    return;
   }
 
-  curl_easy_cleanup(curl);
-  
   analyse();
+}
+
+bool Http::start(char *&page, size_t &len, 
+    const char *url, const char *post, const char *cookies, 
+    Http::progress_fn fn, void *data, Http::done_fn done, void *ddata, int msec) throw() 
+{
+  clear();
+  page = NULL;
+  len = 0;
 
-  return _err == Error::None ? tsk.len : -1;
+  _st = Status::Failed;
+  _err = Error::Failed;
+
+  _page = &page;
+  _plen = &len;
+  _preal = 0;
+
+  if (!prepare(url, post, cookies, fn, data, done, ddata, msec)) return false;
+
+  HttpEngine::instance().add((CURL*)_curl, HttpCompletion::done, this);
+  return true;
 }
 
-off_t Http::get(const char *path,
+bool Http::start(const char *path, 
     const char *url, const char *post, const char *cookies, 
-    Http::progress_fn fn, void *data, int msec) throw() 
+    Http::progress_fn fn, void *data, Http::done_fn done, void *ddata, int msec) throw() 
 {
   clear();
 
   _st = Status::Failed;
   _err = Error::Failed;
 
-  int fd = open(path, O_WRONLY|O_TRUNC|O_CREAT, 0644);
-  if (fd < 0) { _err = Error::NoAccess; return -1; }
+  _fd = open(path, O_WRONLY|O_TRUNC|O_CREAT, 0644);
+  if (_fd < 0) { _err = Error::NoAccess; return false; }
 
-  // destruktor stream_task zamknie fd
-  stream_task tsk(this, fd, fn, data);
-  
-  CURL *curl = curl_easy_init();
-  if (!curl) { _err = Error::NoMemory; return -1; }
+  if (!prepare(url, post, cookies, fn, data, done, ddata, msec)) {
+    close(_fd);
+    _fd = -1;
+    return false;
+  }
 
-  if (curl_easy_setopt(curl, CURLOPT_URL, url) != CURLE_OK ||
-      (post && curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post) != CURLE_OK) ||
-      (cookies && curl_easy_setopt(curl, CURLOPT_COOKIE, cookies) != CURLE_OK) ||
-      (msec > 0 && curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, msec) != CURLE_OK) ||
-      curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, _timeout_ms) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, MoreHeaders()) != CURLE_OK ||
-//      curl_easy_setopt(curl, CURLOPT_VERBOSE, 1) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, file_fn) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_WRITEDATA, &tsk) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_fn) != CURLE_OK ||
-      curl_easy_setopt(curl, CURLOPT_HEADERDATA, this) != CURLE_OK) {
-    curl_easy_cleanup(curl);
-    _err = Error::InvalidArgs;
-    return -1;
+  HttpEngine::instance().add((CURL*)_curl, HttpCompletion::done, this);
+  return true;
+}
+
+bool Http::start(Rope &page, 
+    const char *url, const char *post, const char *cookies, 
+    Http::progress_fn fn, void *data, Http::done_fn done, void *ddata, int msec) throw() 
+{
+  clear();
+  page.clear();
+
+  _st = Status::Failed;
+  _err = Error::Failed;
+
+  _rope = &page;
+
+  if (!prepare(url, post, cookies, fn, data, done, ddata, msec)) return false;
+
+  HttpEngine::instance().add((CURL*)_curl, HttpCompletion::done, this);
+  return true;
+}
+
+bool Http::start(int fd, off_t from, off_t to,
+    const char *url, const char *post, const char *cookies, 
+    Http::progress_fn fn, void *data, Http::done_fn done, void *ddata, int msec) throw() 
+{
+  clear();
+
+  _st = Status::Failed;
+  _err = Error::Failed;
+
+  if (fd < 0 || from < 0 || to <= from) { _err = Error::InvalidArgs; return false; }
+
+  _fd = fd;
+  _fdown = false;
+  _pos = from;
+  _end = to;
+
+  if (!prepare(url, post, cookies, fn, data, done, ddata, msec)) {
+    _fd = -1;
+    return false;
   }
+
+  HttpEngine::instance().add((CURL*)_curl, HttpCompletion::done, this);
+  return true;
+}
+
+bool Http::probe(const char *url, const char *post, const char *cookies, int msec) throw()
+{
+  clear();
+
+  _st = Status::Failed;
+  _err = Error::Failed;
+  _head = true;
+
+  Semaphore done;
   
-  CURLcode cd = curl_easy_perform(curl);
-  if (cd != CURLE_OK) {
-    if (cd == CURLE_OPERATION_TIMEOUTED) _err = Error::Timeout;
-    else if (cd == CURLE_COULDNT_CONNECT) _err = Error::NotConnect;
-    else _err = Error::Failed;
-  
-    curl_easy_cleanup(curl);
-    return -1;
-  }
+  if (!prepare(url, post, cookies, NULL, NULL, s_wake_fn, &done, msec)) return false;
 
-  curl_easy_cleanup(curl);
-  analyse();
+  HttpEngine::instance().add((CURL*)_curl, HttpCompletion::done, this);
+  done.p();
+
+  return _err == Error::None;
+}
+
+void Http::s_wake_fn(Http *, void *data)
+{
+  ((Semaphore*)data)->v();
+}
+
+size_t Http::get(char *&page, size_t &len, 
+    const char *url, const char *post, const char *cookies, 
+    Http::progress_fn fn, void *data, int msec) throw() 
+{
+  Semaphore done;
+
+  if (!start(page, len, url, post, cookies, fn, data, s_wake_fn, &done, msec)) return -1;
+  done.p();
+
+  return _err == Error::None ? len : -1;
+}
+
+off_t Http::get(const char *path,
+    const char *url, const char *post, const char *cookies, 
+    Http::progress_fn fn, void *data, int msec) throw() 
+{
+  Semaphore done;
+
+  if (!start(path, url, post, cookies, fn, data, s_wake_fn, &done, msec)) return -1;
+  done.p();
+
+  return _err == Error::None ? _len : -1;
+}
+
+size_t Http::get(Rope &page,
+    const char *url, const char *post, const char *cookies, 
+    Http::progress_fn fn, void *data, int msec) throw() 
+{
+  Semaphore done;
+
+  if (!start(page, url, post, cookies, fn, data, s_wake_fn, &done, msec)) return -1;
+  done.p();
 
-  return _err == Error::None ? tsk.len : -1;
+  return _err == Error::None ? _len : -1;
 }
 
+void Http::traffic(uint64_t &wire, uint64_t &decoded) throw() {
+  wire = __sync_fetch_and_add(&_traffic_wire, 0);
+  decoded = __sync_fetch_and_add(&_traffic_decoded, 0);
+}
+
+off_t Http::written(void) const {
+  if (_map && _map->active()) return _pos; // strony juz sa w pliku (page cache)
+  return _writer && _fd >= 0 ? _writer->written() : _pos;
+}
 
 void Http::clear(void) {
-  if (_header) { free(_header); _header = NULL; }
-  if (_redirect) { free(_redirect); _redirect = NULL; }
-  _cookies[0]  = 0;
-  _hlen = _hreal = 0;
+  _headers.clear();
+  _cookies.clear();
   _st = 0;
+  _fdown = true;
+  _rope = NULL;
+  _pos = 0;
+  _end = -1;
+  _cut = _head = _allocd = false;
 }
 
 void Http::analyse(void) {
-  if (_hlen < 10) return set(Status::Failed, Error::Failed);
-  
-  _st = Status::Failed;
-  _err = Error::None;
+  _st = _headers.status();
 
-  char *ptr = _header, *eol;
-  size_t c_len = 0, c_max = _cookies_max_len;
-  char *c_buf = _cookies;
-
-  while ((eol = strstr(ptr, "\r\n"))) {
-    if (strncasecmp(ptr, "HTTP/", 5) == 0) {
-      ptr += 5;
-      while (ptr != eol && *ptr != ' ' && *ptr != '\t') ++ptr;
-      if (ptr == eol) set(Status::Failed, Error::Failed);
-      while (ptr != eol && (*ptr == ' ' || *ptr == '\t')) ++ptr;
-      _st = strtoul(ptr, NULL, 10);
-      
-      if (_st < 100 || _st > 700) set(Status::Failed, Error::Failed);
-    } else if (strncasecmp(ptr, "Location:", 9) == 0) {
-      ptr += 9;
-      while (ptr != eol && (*ptr == ' ' || *ptr == '\t')) ++ptr;
-      *eol = 0;
-      _redirect = strdup(ptr);
-      *eol = '\r';
-      if (!_redirect) { _err = Error::NoMemory; return; }
-    } else if (strncasecmp(ptr, "Set-Cookie:", 11) == 0) {
-      ptr += 11;
-      while (ptr != eol && (*ptr == ' ' || *ptr == '\t')) ++ptr;
-      char *eoc = ptr;
-      while (eol != eoc && *eoc != ';') ++eoc;
-      if (eol == eoc) set(Status::Failed, Error::Failed);
-      char c = *eoc;
-      *eoc = 0;
-      size_t l = strlen(ptr);
-      *eoc = c;
-    
-      if (c_len + l + 3 > c_max) { _err = Error::NoMemory; return; }
-      strncpy(c_buf+c_len, ptr, l);
-      strncpy(c_buf+c_len+l, "; ", 2);
-      
-      c_len += l + 2;
-      c_buf[c_len] = 0;
-    }
+  if (_st <= 0) return set(Status::Failed, Error::Failed);
 
-    ptr = eol + 2;
+  if (_jar) {
+    const char *c;
+    for (size_t i = 0; (c = _headers.setCookie(i)); ++i) _jar->set(_url.c_str(), c);
   }
+
+  _err = Error::None;
 }
 
+const char *Http::cookies(void) const {
+  if (_cookies.empty()) {
+    const char *c;
+    for (size_t i = 0; (c = _headers.setCookie(i)); ++i) {
+      const char *eoc = strchr(c, ';');
+      _cookies.append(c, eoc ? eoc - c : strlen(c));
+      _cookies.append("; ");
+    }
+  }
+
+  return _cookies.c_str();
+}
@@ -13,14 +13,24 @@
 #endif
 
 #include <cstdlib>
+#include <stdint.h>
 #include <string>
 
+#include <rs/HttpHeaders.hh>
+#include <rs/Limiter.hh>
+
+class Rope;
+class CookieJar;
+class AsyncWriter;
+class MapWriter;
+class Digest;
+
 class Http {
   public:
     // Jesli nie uda sie pobrac strony, do ustawiony bedzie jakis error.
     struct Error {
       typedef const char *Type;
-      static const Type None, NoMemory, InvalidArgs, Cancel, Failed, NoWrite, NoAccess, Timeout, NotConnect;
+      static const Type None, NoMemory, InvalidArgs, Cancel, Failed, NoWrite, NoAccess, Timeout, NotConnect, NoSpace, Stalled;
     };
 
     // None - jeszcze nie laczono,
@@ -33,42 +43,191 @@ class Http {
     };
 
     // Funkcja postepu pobierania - jak zwroci false, pobieranie jest anulowane
+    // (buf == NULL - HttpSegments zglasza len bajtow pobranych wczesniej)
     typedef bool (*progress_fn)(const char *buf, size_t len, void *data);
+    // Funkcja konca pobierania (start) - wolana z watku HttpEngine
+    typedef void (*done_fn)(Http *http, void *data);
   
-    Http(void) throw();
+    // pooled == true - uchwyt curl-a pozyczany z HttpPool (keep-alive,
+    // wspolny cache DNS i polaczen), inaczej nowy uchwyt na kazde get()
+    Http(bool pooled = false) throw();
     ~Http(void) throw();
   
+    // Wersje synchroniczne - czekaja na koniec transferu w HttpEngine,
+    // nie wolno ich wolac z funkcji zwrotnych (watek silnika).
     size_t get(char *&page, size_t &len, // Pobierz strone, potem delete[] gdy page != NULL
         const char *url, const char *post = NULL, const char *cookies = NULL, 
         progress_fn fn = NULL, void *data = NULL, int msec = -1) throw();
     off_t get(const char *path, // Pobierz strone do pliku
         const char *url, const char *post = NULL, const char *cookies = NULL,
         progress_fn fn = NULL, void *data = NULL, int msec = -1) throw();
+    size_t get(Rope &page, // Pobierz strone do bufora z kawalkow (bez przepisywania)
+        const char *url, const char *post = NULL, const char *cookies = NULL,
+        progress_fn fn = NULL, void *data = NULL, int msec = -1) throw();
+
+    // Wersje asynchroniczne - zwracaja od razu, wynik (error(), status(),
+    // length()) jest gotowy w done. Obiekt, page i len musza zyc do konca.
+    // false - nie udalo sie rozpoczac, done nie zostanie wywolane.
+    bool start(char *&page, size_t &len, 
+        const char *url, const char *post, const char *cookies, 
+        progress_fn fn, void *data, done_fn done, void *ddata, int msec = -1) throw();
+    bool start(const char *path, 
+        const char *url, const char *post, const char *cookies,
+        progress_fn fn, void *data, done_fn done, void *ddata, int msec = -1) throw();
+    bool start(Rope &page, 
+        const char *url, const char *post, const char *cookies,
+        progress_fn fn, void *data, done_fn done, void *ddata, int msec = -1) throw();
+    // Pobierz zakres [from, to) do otwartego pliku (pwrite od from),
+    // fd nie jest zamykany. Transfer konczy sie tez po dojsciu do limit().
+    bool start(int fd, off_t from, off_t to,
+        const char *url, const char *post, const char *cookies,
+        progress_fn fn, void *data, done_fn done, void *ddata, int msec = -1) throw();
+
+    // Zapytaj o rozmiar i obsluge zakresow tym samym zadaniem (metoda i
+    // post), co potem pobieranie, z "Range: bytes=0-0" - tresc jest pomijana.
+    // Rozmiar w total(), gdy serwer odpowie 206.
+    bool probe(const char *url, const char *post = NULL, const char *cookies = NULL, 
+        int msec = -1) throw();
+
     void clear(void); // Czysc strukture Http
 
+    // Zakres: dokad juz odebrano i zmiana konca (tylko z watku HttpEngine)
+    off_t position(void) const { return _pos; }
+    // Dokad dane sa juz w pliku (pisarz w tle moze byc troche z tylu)
+    off_t written(void) const;
+    off_t limit(void) const { return _end; }
+    void limit(off_t to) { _end = to; }
+    // Rozmiar calego pliku z Content-Range odpowiedzi 206, -1 - brak
+    off_t total(void) const;
+    // Zakres: odpowiedz musi opisywac plik o rozmiarze total (Content-Range
+    // albo Content-Length przy 200), inaczej Error::Failed. -1 - bez sprawdzania
+    void setTotal(off_t total) { _total = total; }
+    
+    // Content-Length (-1 gdy nie podano) i czy serwer obsluguje Range
+    off_t contentLength(void) const { return _headers.contentLength(); }
+    bool acceptRanges(void) const { return _headers.acceptRanges(); }
+
+    // Wspolne ciastka: wysylane z kazdym zadaniem (obok cookies z argumentu),
+    // a Set-Cookie z odpowiedzi trafia z powrotem do sloika. NULL - bez sloika.
+    void setCookieJar(CookieJar *jar) { _jar = jar; }
+
+    // Udzial w globalnym limicie predkosci (Limiter) i wlasny limit w B/s
+    // (0 - brak), od nastepnego pobierania
+    void setShare(unsigned weight, uint64_t cap = 0) { _weight = weight; _cap = cap; }
+
+    // Skrot tresci liczony w locie, z kazdym pobieraniem od nowa (reset).
+    // Obiekt nalezy do wolajacego. NULL - bez skrotu.
+    void setDigest(Digest *d) { _digest = d; }
+    const Digest *digest(void) const { return _digest; }
+
+    // Rezerwuj miejsce na caly plik zanim przyjdzie tresc (get/start do
+    // pliku) - rozmiar z Content-Length, a bez niego hint (gdy > 0). Na koniec
+    // plik jest przycinany do tego co faktycznie przyszlo.
+    void setPreallocate(bool on, off_t hint = -1) { _prealloc = on; _phint = hint; }
+    // Gdy rozmiar jest znany (Content-Length, zakres, hint z setPreallocate),
+    // tresc jest kopiowana wprost do pliku zmapowanego w pamieci (MapWriter),
+    // bez write() na kazdy kawalek. Wiecej danych niz zapowiedziano - reszta
+    // zwyklym zapisem.
+    void setMapped(bool on) { _mapped = on; }
+    // fallocate [from, from+len), Error::NoSpace gdy nie zmiesci sie na dysku
+    static Error::Type preallocate(int fd, off_t from, off_t len) throw();
+
+    // Strony do pamieci (bufor, Rope) moga przychodzic skompresowane
+    // (Accept-Encoding: gzip, deflate), curl rozpakowuje je w locie.
+    // Pobieranie do pliku zawsze bez kompresji. Domyslnie wlaczone.
+    void setCompressed(bool on) { _compressed = on; }
+
+    // Pilnowanie zastoju: gdy przez secs sekund przyjdzie mniej niz secs*bps
+    // bajtow, transfer jest zrywany z Error::Stalled. curl liczy takze czas
+    // wstrzymania przez Limiter, wiec gdy wlasny limit (setShare) albo
+    // udzial w globalnym jest ponizej bps, pilnowania nie ma. secs == 0 -
+    // bez pilnowania.
+    void setStall(unsigned secs, uint64_t bps = 1) { _stall = secs; _stall_bps = bps; }
+
+    // Ile bajtow tresci odebrano w ostatnim pobieraniu (po rozpakowaniu)
+    off_t length(void) const { return _len; }
+    // Ile bajtow tresci przyszlo faktycznie z sieci
+    off_t wireLength(void) const { return _wire; }
+    // Suma z wszystkich zakonczonych transferow: z sieci / po rozpakowaniu
+    static void traffic(uint64_t &wire, uint64_t &decoded) throw();
     // Daj naglowek
-    const char *header(void) const { return _header; }
+    const char *header(void) const { return _headers.raw(); }
+    // Naglowki juz rozebrane na pola
+    const HttpHeaders &headers(void) const { return _headers; }
     // Daj ciastka
-    const char *cookies(void) const { return _cookies; }
+    const char *cookies(void) const;
     // Dokad jest przekierowanie (==NULL nie ma przekierowania)
-    const char *redirect(void) const { return _redirect; }
+    const char *redirect(void) const { return _headers.location(); }
 
     Error::Type  error(void) const { return _err; }
     Status::Type status(void) const { return _st; }
     
   private:
-    static const size_t _cookies_max_len = 4096;
+    friend struct HttpCompletion; // Http.cc - zakonczenie transferu w HttpEngine
+    friend struct HttpSocket;     // Http.cc - gniazdo z wyscigu (Resolver::race)
+
     static unsigned _timeout_ms;
-    char *_header, *_redirect;
-    char _cookies[_cookies_max_len];
+    static uint64_t _traffic_wire, _traffic_decoded;
+    HttpHeaders _headers;
+    mutable std::string _cookies; // skladane z Set-Cookie przy cookies()
     Error::Type _err;
     Status::Type _st;
-    size_t _hlen, _hreal;
+    bool _pooled;
+    CookieJar *_jar;
+
+    // Stan biezacego pobierania
+    void *_curl;
+    void *_slist;     // wlasne naglowki zadania (curl_slist), NULL - wspolne
+    void *_resolve;   // adresy z Resolver-a dla CURLOPT_RESOLVE (curl_slist)
+    int _racefd;      // polaczone gniazdo z wyscigu, jeszcze nie oddane curl-owi
+    std::string _url;
+    char **_page;     // ujscie do bufora
+    size_t *_plen, _preal;
+    Rope *_rope;      // ujscie do bufora z kawalkow
+    int _fd;          // ujscie do pliku
+    bool _fdown;      // czy zamknac _fd po transferze
+    AsyncWriter *_writer; // zapis do _fd w tle (AsyncWriter::policy())
+    bool _prealloc, _allocd; // rezerwowac miejsce / czy zarezerwowano
+    bool _mapped;     // pisac przez mmap gdy znamy rozmiar
+    MapWriter *_map;
+    off_t _phint;
+    Digest *_digest;
+    Limiter::Flow _flow;  // wiaderko tego transferu
+    unsigned _weight;
+    uint64_t _cap;
+    off_t _pos, _end; // zakres do pwrite (_end < 0 - caly plik, write)
+    bool _cut;        // transfer przerwany po dojsciu do _end
+    bool _head;       // tylko naglowki (probe)
+    off_t _total;     // oczekiwany rozmiar pliku dla zakresu (setTotal)
+    bool _compressed;
+    unsigned _stall;   // okno pilnowania zastoju w sek, 0 - bez
+    uint64_t _stall_bps;
+    int _msec;         // limit czasu calego transferu (-1 - bez)
+    int _code;         // wynik curl-a miedzy finish a complete
+    off_t _len, _wire;
+    progress_fn _fn;
+    void *_data;
+    done_fn _done;
+    void *_ddata;
 
     Http(const Http &);
     static size_t header_fn(void *buf, size_t size, size_t nmemb, void *data);
     static size_t buffer_fn(void *buf, size_t size, size_t nmemb, void *data);
     static size_t file_fn(void *buf, size_t size, size_t nmemb, void *data);
+    static size_t rope_fn(void *buf, size_t size, size_t nmemb, void *data);
+    static size_t probe_fn(void *buf, size_t size, size_t nmemb, void *data);
+    static void s_wake_fn(Http *http, void *data);
+    bool prepare(const char *url, const char *post, const char *cookies, 
+        progress_fn fn, void *data, done_fn done, void *ddata, int msec) throw();
+    bool resolve(void *curl, const char *url) throw();
+    void unresolve(void) throw();
+    bool throttled(uint64_t bps) const throw();
+    // Koniec transferu: true - mozna od razu complete(), false - complete()
+    // przyjdzie z watku silnika, gdy pisarz odda wszystko dyskowi
+    bool finish(int code) throw();
+    void complete(void) throw();
+    void *acquire(const char *url) throw();
+    void release(const char *url, void *curl) throw();
     void set(Status::Type st, Error::Type er) { _st = st; _err = er; }
     void set(Error::Type er) { _err = er; }
     void analyse(void);
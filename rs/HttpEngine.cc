@@ -0,0 +1,324 @@
+/**
+ * @brief Silnik wielu rownoleglych polaczen http (curl multi + epoll).
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/HttpEngine.hh>
+#include <rs/Exception.hh>
+#include <rs/Time.hh>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+HttpEngine &HttpEngine::instance(void)
+{
+  static HttpEngine engine;
+  return engine;
+}
+
+HttpEngine::HttpEngine(void) throw()
+  : m_ticker_id(0), m_running(0), m_multi(NULL), m_epfd(-1), m_evfd(-1), m_deadline(0)
+{
+  if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK)
+    throw EInternal("curl_global_init");
+
+  if (!(m_multi = curl_multi_init()))
+    throw EInternal("curl_multi_init");
+
+  if (curl_multi_setopt(m_multi, CURLMOPT_SOCKETFUNCTION, s_socket_fn) != CURLM_OK ||
+      curl_multi_setopt(m_multi, CURLMOPT_SOCKETDATA, this) != CURLM_OK ||
+      curl_multi_setopt(m_multi, CURLMOPT_TIMERFUNCTION, s_timer_fn) != CURLM_OK ||
+      curl_multi_setopt(m_multi, CURLMOPT_TIMERDATA, this) != CURLM_OK)
+    throw EInternal("curl_multi_setopt");
+
+  if ((m_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    throw EInternal("epoll_create1: %d, %s", errno, strerror(errno));
+  if ((m_evfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+    throw EInternal("eventfd: %d, %s", errno, strerror(errno));
+
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = m_evfd;
+  if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_evfd, &ev))
+    throw EInternal("epoll_ctl: %d, %s", errno, strerror(errno));
+
+  pthread_attr_t pat;
+  int ret;
+
+  if ((ret = pthread_attr_init(&pat)) != 0)
+    throw EInternal("pthread_attr_init: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_create(&m_pth, &pat, HttpEngine::s_thread_fn, this)) != 0)
+    throw EInternal("pthread_create: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_attr_destroy(&pat)) != 0)
+    throw EInternal("pthread_attr_destroy: %d, %s", ret, strerror(ret));
+}
+
+HttpEngine::~HttpEngine(void) throw()
+{
+  int ret;
+
+  if ((ret = pthread_cancel(m_pth)) != 0)
+    throw EInternal("pthread_cancel: %d, %s", ret, strerror(ret));
+  // Czekamy az watek wyjdzie z epoll_wait - dopiero potem znikaja blokady
+  if ((ret = pthread_join(m_pth, NULL)) != 0)
+    throw EInternal("pthread_join: %d, %s", ret, strerror(ret));
+}
+
+void *HttpEngine::s_thread_fn(void *ptr)
+{
+  HttpEngine *engine = (HttpEngine*)ptr;
+
+  engine->thread_fn();
+
+  return NULL;
+}
+
+bool HttpEngine::inside(void) const throw()
+{
+  return pthread_equal(pthread_self(), m_pth);
+}
+
+void HttpEngine::add(CURL *curl, done_fn fn, void *data) throw()
+{
+  Transfer t;
+  t.curl = curl;
+  t.fn = fn;
+  t.data = data;
+
+  {
+    Lock l(m_lock);
+    m_pending.push_back(t);
+    ++m_running;
+  }
+
+  wakeup();
+}
+
+unsigned HttpEngine::every(unsigned msec, tick_fn fn, void *data) throw()
+{
+  Ticker t;
+  t.fn = fn;
+  t.data = data;
+  t.msec = msec ? msec : 1;
+  t.next = Time::mono_msec() + t.msec;
+
+  {
+    Lock l(m_lock);
+    if (!++m_ticker_id) ++m_ticker_id;
+    t.id = m_ticker_id;
+    m_tickers.push_back(t);
+  }
+
+  wakeup(); // niech watek przeliczy timeout
+  return t.id;
+}
+
+void HttpEngine::stop(unsigned id) throw()
+{
+  Lock l(m_lock);
+  for (size_t i = 0; i < m_tickers.size(); ++i) {
+    if (m_tickers[i].id != id) continue;
+    m_tickers.erase(m_tickers.begin() + i);
+    break;
+  }
+}
+
+void HttpEngine::call(tick_fn fn, void *data) throw()
+{
+  {
+    Lock l(m_lock);
+    m_calls.push_back(std::make_pair(fn, data));
+  }
+
+  wakeup();
+}
+
+// Wola zalegle funkcje cykliczne, zwraca najblizszy termin (0 - brak)
+uint64_t HttpEngine::run_tickers(void)
+{
+  std::vector<Ticker> due;
+  uint64_t now = Time::mono_msec(), next = 0;
+
+  {
+    Lock l(m_lock);
+    for (size_t i = 0; i < m_tickers.size(); ++i) {
+      Ticker &t = m_tickers[i];
+      if (t.next <= now) {
+        due.push_back(t);
+        t.next = now + t.msec;
+      }
+      if (!next || t.next < next) next = t.next;
+    }
+  }
+
+  // Bez blokady - funkcje moga dodawac transfery albo nowe funkcje
+  for (size_t i = 0; i < due.size(); ++i) due[i].fn(due[i].data);
+
+  return next;
+}
+
+size_t HttpEngine::running(void) throw()
+{
+  Lock l(m_lock);
+  return m_running;
+}
+
+void HttpEngine::wakeup(void) throw()
+{
+  uint64_t one = 1;
+  while (write(m_evfd, &one, sizeof(one)) < 0)
+    if (errno != EINTR) break; // EAGAIN - licznik i tak niezerowy
+}
+
+int HttpEngine::s_socket_fn(CURL *, curl_socket_t s, int what, void *userp, void *socketp)
+{
+  HttpEngine *engine = (HttpEngine*)userp;
+
+  if (what == CURL_POLL_REMOVE) {
+    epoll_ctl(engine->m_epfd, EPOLL_CTL_DEL, s, NULL);
+    return 0;
+  }
+
+  epoll_event ev;
+  ev.events = 0;
+  ev.data.fd = s;
+  if (what & CURL_POLL_IN) ev.events |= EPOLLIN;
+  if (what & CURL_POLL_OUT) ev.events |= EPOLLOUT;
+
+  if (socketp) {
+    epoll_ctl(engine->m_epfd, EPOLL_CTL_MOD, s, &ev);
+  } else {
+    // Gniazdo jest nowe dla epoll, zaznaczamy je w curl-u
+    if (epoll_ctl(engine->m_epfd, EPOLL_CTL_ADD, s, &ev) && errno == EEXIST)
+      epoll_ctl(engine->m_epfd, EPOLL_CTL_MOD, s, &ev);
+    curl_multi_assign(engine->m_multi, s, engine);
+  }
+
+  return 0;
+}
+
+int HttpEngine::s_timer_fn(CURLM *, long timeout_ms, void *userp)
+{
+  HttpEngine *engine = (HttpEngine*)userp;
+
+  if (timeout_ms < 0) engine->m_deadline = 0;
+  else engine->m_deadline = Time::mono_msec() + timeout_ms;
+
+  return 0;
+}
+
+void HttpEngine::take_pending(void) throw()
+{
+  std::vector<Transfer> pending;
+  std::vector<std::pair<tick_fn, void*> > calls;
+
+  {
+    Lock l(m_lock);
+    pending.swap(m_pending);
+    calls.swap(m_calls);
+  }
+
+  for (size_t i = 0; i < pending.size(); ++i) {
+    Transfer *t = new(std::nothrow) Transfer(pending[i]);
+
+    if (!t || curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t) != CURLE_OK ||
+        curl_multi_add_handle(m_multi, t->curl) != CURLM_OK) {
+      if (t) delete t;
+      { Lock l(m_lock); --m_running; }
+      pending[i].fn(pending[i].curl, CURLE_OUT_OF_MEMORY, pending[i].data);
+    }
+  }
+
+  // Bez blokady - funkcje moga dodawac transfery i kolejne wywolania
+  for (size_t i = 0; i < calls.size(); ++i) calls[i].first(calls[i].second);
+}
+
+void HttpEngine::check_done(void) throw()
+{
+  CURLMsg *msg;
+  int left;
+
+  while ((msg = curl_multi_info_read(m_multi, &left))) {
+    if (msg->msg != CURLMSG_DONE) continue;
+
+    CURL *curl = msg->easy_handle;
+    CURLcode cd = msg->data.result;
+    Transfer *t = NULL;
+
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&t);
+    curl_multi_remove_handle(m_multi, curl);
+
+    { Lock l(m_lock); --m_running; }
+
+    if (t) {
+      done_fn fn = t->fn;
+      void *data = t->data;
+      delete t;
+      fn(curl, cd, data);
+    }
+  }
+}
+
+void HttpEngine::thread_fn(void)
+{
+  static const int max_events = 64;
+  epoll_event events[max_events];
+  int running = 0;
+  uint64_t tick = 0;
+
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+  while (true) {
+    int timeout = -1;
+    uint64_t now = Time::mono_msec();
+
+    if (m_deadline) 
+      timeout = (m_deadline > now) ? (int)(m_deadline - now) : 0;
+    if (tick && (timeout < 0 || tick < now + timeout))
+      timeout = (tick > now) ? (int)(tick - now) : 0;
+
+    // Przerwac (~HttpEngine) mozna tylko tu, gdy nie trzymamy zadnej blokady
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    int n = epoll_wait(m_epfd, events, max_events, timeout);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw EInternal("epoll_wait: %d, %s", errno, strerror(errno));
+    }
+
+    if (n == 0 && m_deadline && m_deadline <= Time::mono_msec()) {
+      m_deadline = 0;
+      curl_multi_socket_action(m_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+
+    for (int i = 0; i < n; ++i) {
+      int fd = events[i].data.fd;
+
+      if (fd == m_evfd) {
+        uint64_t cnt;
+        while (read(m_evfd, &cnt, sizeof(cnt)) > 0) ;
+        take_pending();
+        continue;
+      }
+
+      int flags = 0;
+      if (events[i].events & EPOLLIN) flags |= CURL_CSELECT_IN;
+      if (events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+      if (events[i].events & (EPOLLERR|EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+
+      curl_multi_socket_action(m_multi, fd, flags, &running);
+    }
+
+    tick = run_tickers();
+
+    // Timer mogl juz minac w trakcie obslugi gniazd (albo wznowienia)
+    if (m_deadline && m_deadline <= Time::mono_msec()) {
+      m_deadline = 0;
+      curl_multi_socket_action(m_multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+
+    check_done();
+  }
+}
+
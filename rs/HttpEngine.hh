@@ -0,0 +1,109 @@
+/**
+ * @brief Silnik wielu rownoleglych polaczen http (curl multi + epoll).
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_HTTP_ENGINE_HH__
+#define __RS_HTTP_ENGINE_HH__
+
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <rs/Mutex.hh>
+
+#include <vector>
+
+class HttpEngine {
+  public:
+    /**
+     * Klasa singleton - jeden watek obsluguje wszystkie transfery.
+     */
+    static HttpEngine &instance(void);
+
+    // Funkcja wolana z watku silnika po zakonczeniu transferu. Uchwyt
+    // jest juz wyjety z curl multi, mozna go zwolnic lub uzyc ponownie.
+    typedef void (*done_fn)(CURL *curl, CURLcode code, void *data);
+
+    /**
+     * @brief Dodaj skonfigurowany uchwyt do obslugi (bez blokowania).
+     *
+     * Funkcje zwrotne curl-a (zapis, naglowki, postep) beda wolane z
+     * watku silnika, nie wolno w nich czekac na inne transfery.
+     */
+    void add(CURL *curl, done_fn fn, void *data) throw();
+
+    /**
+     * @brief Liczba aktywnych (dodanych, niezakonczonych) transferow.
+     */
+    size_t running(void) throw();
+
+    /**
+     * @brief Czy biezacy watek jest watkiem silnika.
+     */
+    bool inside(void) const throw();
+
+    // Funkcja wolana cyklicznie z watku silnika
+    typedef void (*tick_fn)(void *data);
+
+    /**
+     * @brief Wolaj fn(data) co msec milisekund z watku silnika (np. by
+     * wznawiac wstrzymane transfery). Zwraca numer do stop() (nigdy 0).
+     */
+    unsigned every(unsigned msec, tick_fn fn, void *data) throw();
+
+    /**
+     * @brief Przestan wolac funkcje z every() (takze z niej samej). Juz
+     * zalegla moze byc jeszcze wolana raz.
+     */
+    void stop(unsigned id) throw();
+
+    /**
+     * @brief Wolaj fn(data) raz, z watku silnika, zaraz po obsluzeniu
+     * biezacych zdarzen (bez blokowania, takze z watku silnika).
+     */
+    void call(tick_fn fn, void *data) throw();
+
+  private:
+    HttpEngine(void) throw();
+    HttpEngine(const HttpEngine &);
+    ~HttpEngine(void) throw();
+
+    struct Transfer {
+      CURL *curl;
+      done_fn fn;
+      void *data;
+    };
+
+    struct Ticker {
+      unsigned id;
+      tick_fn fn;
+      void *data;
+      unsigned msec;
+      uint64_t next;
+    };
+
+    Mutex m_lock;
+    std::vector<Transfer> m_pending; // czekaja na dodanie w watku silnika
+    std::vector<Ticker> m_tickers;
+    unsigned m_ticker_id;            // ostatnio nadany numer (every)
+    std::vector<std::pair<tick_fn, void*> > m_calls; // do wywolania raz (call)
+    size_t m_running;
+
+    CURLM *m_multi;
+    int m_epfd, m_evfd;
+    uint64_t m_deadline; // kiedy wolac curl z timeoutem (0 - nigdy)
+    pthread_t m_pth;
+
+    void thread_fn(void);
+    void wakeup(void) throw();
+    void take_pending(void) throw();
+    void check_done(void) throw();
+    uint64_t run_tickers(void);
+    static void *s_thread_fn(void *);
+    static int s_socket_fn(CURL *, curl_socket_t s, int what, void *userp, void *socketp);
+    static int s_timer_fn(CURLM *, long timeout_ms, void *userp);
+};
+
+#endif
+
@@ -0,0 +1,160 @@
+/**
+ * @brief Przyrostowy parser naglowkow http - linia po linii, bez kopiowania.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/HttpHeaders.hh>
+
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+HttpHeaders::HttpHeaders(void) throw()
+  : m_raw(NULL), m_vals(NULL), m_rlen(0), m_rcap(0), m_vlen(0), m_vcap(0)
+{
+  forget();
+}
+
+HttpHeaders::~HttpHeaders(void) throw()
+{
+  if (m_raw) free(m_raw);
+  if (m_vals) free(m_vals);
+}
+
+void HttpHeaders::forget(void) throw()
+{
+  m_fields.clear();
+  m_cookies.clear();
+  m_vlen = 0;
+  m_status = 0;
+  m_clen = m_rfrom = m_rto = m_rtotal = -1;
+  m_ranges = false;
+  m_location = m_etag = m_encoding = npos;
+}
+
+void HttpHeaders::clear(void) throw()
+{
+  // Pamiec zostaje na nastepne zadanie
+  m_rlen = 0;
+  if (m_raw) m_raw[0] = 0;
+  forget();
+}
+
+bool HttpHeaders::reserve(char *&buf, size_t &cap, size_t need) throw()
+{
+  if (need <= cap) return true;
+
+  size_t max = cap ? cap : 1024;
+  while (max < need) max *= 2;
+
+  char *ptr = (char*)realloc(buf, max);
+  if (!ptr) return false;
+
+  buf = ptr;
+  cap = max;
+  return true;
+}
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+bool HttpHeaders::feed(const char *line, size_t len) throw()
+{
+  if (!reserve(m_raw, m_rcap, m_rlen + len + 1)) return false;
+
+  size_t bgn = m_rlen;
+  memcpy(m_raw + m_rlen, line, len);
+  m_rlen += len;
+  m_raw[m_rlen] = 0;
+
+  const char *ptr = m_raw + bgn, *end = m_raw + m_rlen;
+  while (end != ptr && (end[-1] == '\r' || end[-1] == '\n')) --end;
+
+  if (ptr == end) return true; // pusta linia - koniec naglowkow
+
+  if (end - ptr > 5 && strncasecmp(ptr, "HTTP/", 5) == 0) {
+    forget(); // nowa odpowiedz
+    ptr += 5;
+    while (ptr != end && !is_blank(*ptr)) ++ptr;
+    while (ptr != end && is_blank(*ptr)) ++ptr;
+    m_status = strtoul(ptr, NULL, 10);
+    if (m_status < 100 || m_status > 700) m_status = -1;
+    return true;
+  }
+
+  const char *colon = (const char*)memchr(ptr, ':', end - ptr);
+  if (!colon) return true;
+
+  const char *val = colon + 1;
+  while (val != end && is_blank(*val)) ++val;
+  const char *vend = end;
+  while (vend != val && is_blank(vend[-1])) --vend;
+
+  Field f;
+  f.name = ptr - m_raw;
+  f.nlen = colon - ptr;
+  f.val = m_vlen;
+
+  size_t vl = vend - val;
+  if (!reserve(m_vals, m_vcap, m_vlen + vl + 1)) return false;
+  memcpy(m_vals + m_vlen, val, vl);
+  m_vlen += vl;
+  m_vals[m_vlen++] = 0;
+
+  try { m_fields.push_back(f); }
+  catch (...) { return false; }
+
+  size_t idx = m_fields.size() - 1;
+  const char *v = m_vals + f.val;
+
+#define IS(hname) (f.nlen == sizeof(hname) - 1 && strncasecmp(ptr, hname, f.nlen) == 0)
+  if (IS("Content-Length")) {
+    m_clen = strtoll(v, NULL, 10);
+  } else if (IS("Content-Range")) {
+    long long a, b, t;
+    if (sscanf(v, "bytes %lld-%lld/%lld", &a, &b, &t) == 3) {
+      m_rfrom = a; m_rto = b; m_rtotal = t;
+    }
+  } else if (IS("Accept-Ranges")) {
+    m_ranges = strncasecmp(v, "bytes", 5) == 0;
+  } else if (IS("Location")) {
+    m_location = idx;
+  } else if (IS("ETag")) {
+    m_etag = idx;
+  } else if (IS("Content-Encoding")) {
+    m_encoding = idx;
+  } else if (IS("Set-Cookie")) {
+    try { m_cookies.push_back(idx); }
+    catch (...) { return false; }
+  }
+#undef IS
+
+  return true;
+}
+
+bool HttpHeaders::contentRange(off_t &from, off_t &to, off_t &total) const
+{
+  if (m_rfrom < 0) return false;
+  from = m_rfrom;
+  to = m_rto;
+  total = m_rtotal;
+  return true;
+}
+
+const char *HttpHeaders::setCookie(size_t i) const
+{
+  return i < m_cookies.size() ? m_vals + m_fields[m_cookies[i]].val : NULL;
+}
+
+const char *HttpHeaders::find(const char *name, size_t nth) const throw()
+{
+  size_t len = strlen(name);
+
+  for (size_t i = 0; i < m_fields.size(); ++i) {
+    const Field &f = m_fields[i];
+    if (f.nlen != len || strncasecmp(m_raw + f.name, name, len)) continue;
+    if (nth-- == 0) return m_vals + f.val;
+  }
+
+  return NULL;
+}
+
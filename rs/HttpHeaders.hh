@@ -0,0 +1,103 @@
+/**
+ * @brief Przyrostowy parser naglowkow http - linia po linii, bez kopiowania.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_HTTP_HEADERS_HH__
+#define __RS_HTTP_HEADERS_HH__
+
+#ifndef _FILE_OFFSET_BITS
+# define _FILE_OFFSET_BITS 64
+#elif _FILE_OFFSET_BITS != 64
+# error "_FILE_OFFSET_BITS != 64"
+#endif
+
+#include <sys/types.h>
+#include <cstdlib>
+#include <vector>
+
+/**
+ * Naglowki sa dopisywane do jednego bufora (arena) w takiej postaci, w
+ * jakiej przyszly, a wartosci dodatkowo do drugiego, zakonczone zerem.
+ * Pola pamietaja tylko przesuniecia, wiec realokacja areny nic nie psuje.
+ * Najczesciej uzywane naglowki sa rozpoznawane od razu przy dopisywaniu.
+ *
+ * Po kazdej linii statusu (np. "100 Continue", przekierowanie) pola sa
+ * zapominane - obowiazuja naglowki ostatniej odpowiedzi. Surowy tekst
+ * zostaje caly.
+ */
+class HttpHeaders {
+  public:
+    HttpHeaders(void) throw();
+    ~HttpHeaders(void) throw();
+
+    /**
+     * @brief Dopisz jedna linie naglowka (tak jak podaje ja curl, z "\r\n").
+     * false - brak pamieci.
+     */
+    bool feed(const char *line, size_t len) throw();
+    void clear(void) throw();
+
+    // Caly tekst naglowkow (zakonczony zerem), NULL gdy nic nie przyszlo
+    const char *raw(void) const { return m_rlen ? m_raw : NULL; }
+    size_t length(void) const { return m_rlen; }
+
+    // Kod ostatniej odpowiedzi, 0 - nie bylo linii statusu
+    int status(void) const { return m_status; }
+    // Content-Length, -1 - nie podano
+    off_t contentLength(void) const { return m_clen; }
+    // Content-Range: bytes from-to/total (to wlacznie), false - nie podano
+    bool contentRange(off_t &from, off_t &to, off_t &total) const;
+    // Accept-Ranges: bytes
+    bool acceptRanges(void) const { return m_ranges; }
+
+    // Wartosci (zakonczone zerem) albo NULL
+    const char *location(void) const { return field(m_location); }
+    const char *etag(void) const { return field(m_etag); }
+    const char *contentEncoding(void) const { return field(m_encoding); }
+
+    // Kolejne Set-Cookie: i od 0, NULL - koniec
+    const char *setCookie(size_t i) const;
+
+    /**
+     * @brief Dowolny naglowek po nazwie (bez rozrozniania wielkosci liter).
+     * nth - ktore wystapienie. NULL - brak.
+     */
+    const char *find(const char *name, size_t nth = 0) const throw();
+
+    // Liczba pol i dostep do nich
+    size_t count(void) const { return m_fields.size(); }
+    const char *name(size_t i, size_t &len) const
+    {
+      len = m_fields[i].nlen;
+      return m_raw + m_fields[i].name;
+    }
+    const char *value(size_t i) const { return m_vals + m_fields[i].val; }
+
+  private:
+    HttpHeaders(const HttpHeaders &);
+
+    struct Field {
+      size_t name, nlen; // w m_raw
+      size_t val;        // w m_vals (zakonczone zerem)
+    };
+
+    static const size_t npos = (size_t)-1;
+
+    char *m_raw, *m_vals;
+    size_t m_rlen, m_rcap, m_vlen, m_vcap;
+    std::vector<Field> m_fields;
+    std::vector<size_t> m_cookies; // numery pol Set-Cookie
+
+    int m_status;
+    off_t m_clen, m_rfrom, m_rto, m_rtotal;
+    bool m_ranges;
+    size_t m_location, m_etag, m_encoding; // numery pol albo npos
+
+    const char *field(size_t i) const { return i == npos ? NULL : m_vals + m_fields[i].val; }
+    static bool reserve(char *&buf, size_t &cap, size_t need) throw();
+    void forget(void) throw();
+};
+
+#endif
+
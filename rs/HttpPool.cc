@@ -0,0 +1,117 @@
+/**
+ * @brief Pula polaczen http (keep-alive) - uchwyty curl-a wielokrotnego uzytku.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/HttpPool.hh>
+#include <rs/Exception.hh>
+
+#include <cstring>
+
+HttpPool &HttpPool::instance(void)
+{
+  static HttpPool pool;
+  return pool;
+}
+
+HttpPool::HttpPool(void) throw()
+  : m_max_idle(4), m_share(NULL)
+{
+  if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK)
+    throw EInternal("curl_global_init");
+
+  if (!(m_share = curl_share_init()))
+    throw EInternal("curl_share_init");
+
+  // Wspolny cache DNS, polaczen i sesji SSL dla wszystkich uchwytow
+  if (curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, s_lock_fn) != CURLSHE_OK ||
+      curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, s_unlock_fn) != CURLSHE_OK ||
+      curl_share_setopt(m_share, CURLSHOPT_USERDATA, this) != CURLSHE_OK ||
+      curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+      curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK ||
+      curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT) != CURLSHE_OK)
+    throw EInternal("curl_share_setopt");
+}
+
+HttpPool::~HttpPool(void) throw()
+{
+  for (Idle::iterator i = m_idle.begin(); i != m_idle.end(); ++i)
+    for (size_t j = 0; j < i->second.size(); ++j)
+      curl_easy_cleanup(i->second[j]);
+  m_idle.clear();
+
+  if (m_share) curl_share_cleanup(m_share);
+}
+
+void HttpPool::s_lock_fn(CURL *, curl_lock_data data, curl_lock_access, void *ptr)
+{
+  HttpPool *pool = (HttpPool*)ptr;
+  pool->m_share_lock[data].lock();
+}
+
+void HttpPool::s_unlock_fn(CURL *, curl_lock_data data, void *ptr)
+{
+  HttpPool *pool = (HttpPool*)ptr;
+  pool->m_share_lock[data].unlock();
+}
+
+std::string HttpPool::host(const char *url)
+{
+  const char *bgn = strstr(url, "://");
+  bgn = bgn ? bgn + 3 : url;
+
+  const char *end = bgn;
+  while (*end && *end != '/' && *end != '?' && *end != '#') ++end;
+
+  return std::string(url, end - url);
+}
+
+CURL *HttpPool::acquire(const char *url) throw()
+{
+  std::string key = host(url);
+  CURL *curl = NULL;
+
+  {
+    Lock l(m_lock);
+    Idle::iterator i = m_idle.find(key);
+    if (i != m_idle.end() && !i->second.empty()) {
+      curl = i->second.back();
+      i->second.pop_back();
+    }
+  }
+
+  if (curl) return curl;
+
+  if (!(curl = curl_easy_init())) return NULL;
+
+  // curl_easy_reset() nie rusza share, wiec ustawiamy tylko raz
+  if (curl_easy_setopt(curl, CURLOPT_SHARE, m_share) != CURLE_OK) {
+    curl_easy_cleanup(curl);
+    return NULL;
+  }
+
+  return curl;
+}
+
+void HttpPool::release(const char *url, CURL *curl) throw()
+{
+  if (!curl) return;
+
+  // Czyscimy opcje, ale polaczenia i cache zostaja w uchwycie/share
+  curl_easy_reset(curl);
+
+  {
+    Lock l(m_lock);
+    std::vector<CURL*> &v = m_idle[host(url)];
+    if (v.size() < m_max_idle) { v.push_back(curl); return; }
+  }
+
+  curl_easy_cleanup(curl);
+}
+
+void HttpPool::setMaxIdle(size_t perhost) throw()
+{
+  Lock l(m_lock);
+  m_max_idle = perhost;
+}
+
@@ -0,0 +1,67 @@
+/**
+ * @brief Pula polaczen http (keep-alive) - uchwyty curl-a wielokrotnego uzytku.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_HTTP_POOL_HH__
+#define __RS_HTTP_POOL_HH__
+
+#include <curl/curl.h>
+
+#include <rs/Mutex.hh>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class HttpPool {
+  public:
+    /**
+     * Klasa singleton - jedna pula na proces, zeby cache DNS i cache
+     * polaczen byly wspolne dla wszystkich obiektow Http.
+     */
+    static HttpPool &instance(void);
+
+    /**
+     * @brief Pozycz uchwyt curl-a dla hosta z url-a.
+     *
+     * Zwrocony uchwyt jest "czysty" (curl_easy_reset), ale pamieta
+     * otwarte polaczenia i rozwiazane nazwy (share). NULL gdy brak pamieci.
+     */
+    CURL *acquire(const char *url) throw();
+
+    /**
+     * @brief Oddaj uchwyt do puli, nadmiarowe uchwyty sa zwalniane.
+     */
+    void release(const char *url, CURL *curl) throw();
+
+    /**
+     * @brief Ile bezczynnych uchwytow trzymac dla jednego hosta.
+     */
+    void setMaxIdle(size_t perhost) throw();
+
+    /**
+     * @brief Klucz puli - "schemat://host:port" z url-a.
+     */
+    static std::string host(const char *url);
+
+  private:
+    HttpPool(void) throw();
+    HttpPool(const HttpPool &);
+    ~HttpPool(void) throw();
+
+    typedef std::map<std::string, std::vector<CURL*> > Idle;
+
+    Mutex m_lock;
+    Idle m_idle;
+    size_t m_max_idle;
+
+    CURLSH *m_share;
+    Mutex m_share_lock[CURL_LOCK_DATA_LAST];
+
+    static void s_lock_fn(CURL *, curl_lock_data data, curl_lock_access, void *ptr);
+    static void s_unlock_fn(CURL *, curl_lock_data data, void *ptr);
+};
+
+#endif
+
@@ -0,0 +1,394 @@
+/**
+ * @brief Pobieranie pliku kilkoma rownoleglymi polaczeniami (Range).
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/HttpSegments.hh>
+#include <rs/HttpEngine.hh>
+
+#include <cstdio>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+
+HttpSegments::HttpSegments(bool pooled) throw()
+  : m_pooled(pooled), m_resume(false), m_prealloc(false), m_mapped(false), m_jar(NULL), m_digest(NULL),
+  m_weight(Limiter::DefWeight), m_cap(0), m_stall(0), m_stall_bps(1), 
+  m_mirror(0), m_failovers(0), m_probe(pooled), m_busy(0), m_abort(false),
+  m_fd(-1), m_size(-1), m_len(0), m_resumed(0), m_unsynced(0),
+  m_err(Http::Error::None), m_st(Http::Status::None),
+  m_url(NULL), m_post(NULL), m_cookies(NULL), m_fn(NULL), m_data(NULL) { }
+
+HttpSegments::~HttpSegments(void) throw()
+{
+  for (size_t i = 0; i < m_segs.size(); ++i) delete m_segs[i];
+  m_segs.clear();
+  for (size_t i = 0; i < m_pieces.size(); ++i) delete m_pieces[i].dg;
+}
+
+off_t HttpSegments::single(const char *path, const char *url, const char *post,
+    const char *cookies, Http::progress_fn fn, void *data) throw()
+{
+  for (;;) {
+    off_t ret = m_probe.get(path, url, post, cookies, fn, data);
+    m_err = m_probe.error();
+    m_st = m_probe.status();
+
+    // Bez zakresow nie da sie kontynuowac - nastepny serwer od poczatku
+    if (m_err != Http::Error::Stalled || m_mirror + 1 >= m_urls.size()) return ret;
+    m_url = url = m_urls[++m_mirror].c_str();
+    ++m_failovers;
+  }
+}
+
+off_t HttpSegments::get(const char *path, const char *url, const char *post,
+    const char *cookies, unsigned segments, Http::progress_fn fn, void *data) throw()
+{
+  m_err = Http::Error::Failed;
+  m_st = Http::Status::Failed;
+  m_len = m_resumed = m_unsynced = 0;
+  m_abort = false;
+  m_todo.clear();
+
+  m_urls.assign(1, url);
+  for (size_t i = 0; i < m_mirrors.size(); ++i)
+    if (m_mirrors[i] != url) m_urls.push_back(m_mirrors[i]);
+  m_mirror = m_failovers = 0;
+  m_url = url = m_urls[0].c_str();
+
+  std::string part = m_resume ? std::string(path) + ".part" : std::string(path);
+  std::string jpath = part + ".journal";
+  off_t size = -1;
+
+  // Z zapasowymi serwerami tez zakresami - po zmianie serwera jedziemy dalej.
+  // Pytamy tym samym zadaniem (POST), rozmiar tylko z 206 - strona z bledem
+  // na HEAD nie moze udawac pliku
+  if ((segments > 1 || m_resume || m_urls.size() > 1) && m_probe.probe(url, post, cookies))
+    size = m_probe.total();
+
+  if (size < 0 || (!m_resume && size < 2*MinSegment)) {
+    // Nie ma co dzielic ani wznawiac - jednym polaczeniem od zera
+    off_t ret = single(part.c_str(), url, post, cookies, fn, data);
+    if (ret >= 0 && m_resume && rename(part.c_str(), path)) {
+      m_err = Http::Error::NoWrite;
+      return -1;
+    }
+    if (m_resume) Journal::remove(jpath.c_str());
+    return ret;
+  }
+
+  int flags = O_RDWR|O_CREAT; // RDWR - skrot moze doczytywac plik
+  // Wersja pliku na serwerze - po zmianie stare zakresy sa do wyrzucenia
+  const char *version = m_probe.headers().etag();
+  if (!version) version = m_probe.headers().find("Last-Modified");
+
+  if (m_resume && m_journal.open(jpath.c_str(), size, version ? version : "", part.c_str())) {
+    m_todo = m_journal.missing();
+  } else {
+    // Nowy (lub nie pasujacy) dziennik - to co jest w *.part nie jest nic warte
+    flags |= O_TRUNC;
+    m_todo.push_back(Journal::Range(0, size));
+  }
+
+  m_fd = open(part.c_str(), flags, 0644);
+  if (m_fd < 0) { m_journal.close(); m_err = Http::Error::NoAccess; return -1; }
+
+  // Rozmiar znamy z probe - rezerwujemy od razu, zanim ruszy pierwszy kawalek
+  Http::Error::Type err = m_prealloc ? Http::preallocate(m_fd, 0, size) : Http::Error::None;
+
+  if (err != Http::Error::None || ftruncate(m_fd, size)) {
+    close(m_fd);
+    m_fd = -1;
+    m_journal.close();
+    m_err = err != Http::Error::None ? err : Http::Error::NoWrite;
+    return -1;
+  }
+
+  m_post = post;
+  m_cookies = cookies;
+  m_fn = fn;
+  m_data = data;
+  m_size = size;
+
+  for (size_t i = 0; i < m_todo.size(); ++i)
+    m_resumed -= m_todo[i].second - m_todo[i].first;
+  m_resumed += size;
+
+  if (m_resumed > 0 && fn) fn(NULL, m_resumed, data);
+
+  // Dzielimy najwieksze brakujace zakresy, az starczy dla wszystkich kawalkow
+  size_t n = segments ? segments : 1;
+  while (m_todo.size() < n) {
+    size_t big = 0;
+    for (size_t i = 1; i < m_todo.size(); ++i)
+      if (m_todo[i].second - m_todo[i].first > m_todo[big].second - m_todo[big].first) big = i;
+    if (m_todo.empty() || m_todo[big].second - m_todo[big].first < 2*MinSegment) break;
+    off_t mid = m_todo[big].first + (m_todo[big].second - m_todo[big].first)/2;
+    m_todo.push_back(Journal::Range(mid, m_todo[big].second));
+    m_todo[big].second = mid;
+  }
+
+  if (n > m_todo.size()) n = m_todo.size();
+  while (m_segs.size() < n) m_segs.push_back(new Segment(this, m_pooled));
+  // Skrot w kawalkach tylko gdy da sie go potem skleic
+  Digest *tmp = m_digest ? m_digest->clone() : NULL;
+  bool split = tmp && m_digest->combine(*tmp, 0);
+  delete tmp;
+
+  for (size_t i = 0; i < m_segs.size(); ++i) {
+    Segment *seg = m_segs[i];
+    if (split && !seg->dg) seg->dg = m_digest->clone();
+    seg->http.setDigest(split ? seg->dg : NULL);
+
+    // Plik w n kawalkach nie moze dostac n razy wiecej niz inne transfery
+    m_segs[i]->http.setCookieJar(m_jar);
+    m_segs[i]->http.setShare(m_weight/n ? m_weight/n : 1, m_cap && m_cap < n ? 1 : m_cap/n);
+    // Prog zastoju tez na kawalek - n wolnych kawalkow to jeszcze nie zastoj
+    m_segs[i]->http.setStall(m_stall, m_stall_bps/n ? m_stall_bps/n : 1);
+    m_segs[i]->http.setMapped(m_mapped);
+  }
+
+  // Kawalki startuja z watku silnika - tam sa konczone, dzielone (steal) i
+  // przelaczane na inny serwer, wiec wszystko to idzie po kolei
+  m_first.assign(m_todo.begin(), m_todo.begin() + n);
+  m_todo.erase(m_todo.begin(), m_todo.begin() + n);
+
+  m_err = Http::Error::None;
+  m_busy = n;
+
+  if (n) {
+    HttpEngine::instance().call(s_start_fn, this);
+    m_done.p();
+  }
+
+  if (m_digest && m_err == Http::Error::None && !digest(size)) m_err = Http::Error::NoWrite;
+
+  for (size_t i = 0; i < m_pieces.size(); ++i) delete m_pieces[i].dg;
+  m_pieces.clear();
+
+  if (close(m_fd) && m_err == Http::Error::None) m_err = Http::Error::NoWrite;
+  m_fd = -1;
+  m_journal.close();
+
+  if (m_err != Http::Error::None) return -1;
+
+  if (m_resume) {
+    if (rename(part.c_str(), path)) { m_err = Http::Error::NoWrite; return -1; }
+    Journal::remove(jpath.c_str());
+  }
+
+  m_st = Http::Status::Ok;
+  return m_len + m_resumed;
+}
+
+void HttpSegments::s_start_fn(void *data)
+{
+  HttpSegments *hs = (HttpSegments*)data;
+  std::vector<Journal::Range> first;
+  first.swap(hs->m_first);
+
+  for (size_t i = 0; i < first.size(); ++i) {
+    Segment *seg = hs->m_segs[i];
+    if (!hs->run(seg, first[i].first, first[i].second)) {
+      seg->http.limit(-1);
+      hs->finished(seg->http.error()); // ostatni moze obudzic get() - potem juz bez hs
+    }
+  }
+}
+
+// Tylko z watku silnika
+bool HttpSegments::run(Segment *seg, off_t from, off_t to) throw()
+{
+  seg->synced = seg->start = from;
+  seg->mirror = m_mirror;
+  seg->http.setTotal(m_size);
+  return seg->http.start(m_fd, from, to, m_url, m_post, m_cookies,
+      s_progress_fn, this, s_done_fn, seg);
+}
+
+bool HttpSegments::next(Segment *seg) throw()
+{
+  if (m_abort || m_todo.empty()) return false;
+
+  Journal::Range r = m_todo.back();
+  m_todo.pop_back();
+  seg->retries = 0;
+
+  if (run(seg, r.first, r.second)) return true;
+
+  m_todo.push_back(r);
+  return false;
+}
+
+bool HttpSegments::steal(Segment *seg) throw()
+{
+  Segment *victim = NULL;
+  off_t most = 0;
+
+  if (m_abort) return false;
+
+  // Wszystko w watku HttpEngine (takze start pierwszych kawalkow) - pozycje
+  // i limity nie zmienia sie pod nami
+  for (size_t i = 0; i < m_segs.size(); ++i) {
+    Http &h = m_segs[i]->http;
+    if (m_segs[i] == seg || h.limit() < 0) continue;
+    off_t left = h.limit() - h.position();
+    if (left > most) { most = left; victim = m_segs[i]; }
+  }
+
+  if (!victim || most < 2*MinSegment) return false;
+
+  Http &h = victim->http;
+  off_t end = h.limit(), mid = h.position() + most/2;
+
+  h.limit(mid);
+  seg->retries = 0;
+  if (run(seg, mid, end)) return true;
+
+  h.limit(end); // nie udalo sie, niech ofiara robi swoje
+  return false;
+}
+
+bool HttpSegments::failover(Segment *seg) throw()
+{
+  // Inny kawalek mogl juz przelaczyc - wtedy tylko idziemy za nim
+  if (seg->mirror == m_mirror) {
+    if (m_mirror + 1 >= m_urls.size()) return false;
+    m_url = m_urls[++m_mirror].c_str();
+    ++m_failovers;
+  }
+
+  return true;
+}
+
+void HttpSegments::checkpoint(Segment *only) throw()
+{
+  if (!m_resume || m_fd < 0) return;
+
+  // Stan pisarzy sprzed fdatasync - tylko to, co juz bylo oddane jadru,
+  // na pewno jest na dysku; dopiero potem wpis w dzienniku
+  std::vector<off_t> pos(m_segs.size(), -1);
+  for (size_t i = 0; i < m_segs.size(); ++i) {
+    Segment *seg = m_segs[i];
+    if ((only && seg != only) || seg->http.limit() < 0) continue;
+    pos[i] = seg->http.written();
+  }
+
+  if (fdatasync(m_fd)) return;
+
+  for (size_t i = 0; i < m_segs.size(); ++i) {
+    Segment *seg = m_segs[i];
+    if (pos[i] > seg->synced && m_journal.add(seg->synced, pos[i])) seg->synced = pos[i];
+  }
+
+  m_unsynced = 0;
+}
+
+void HttpSegments::piece(Segment *seg) throw()
+{
+  Http *http = &seg->http;
+  if (!seg->dg || http->digest() != seg->dg || http->position() <= seg->start) return;
+
+  // Skrot zostaje przy zakresie, kawalek dostaje nowy
+  Digest *fresh = seg->dg->clone();
+  if (!fresh) return; // zabraknie zakresu - zostanie doczytany z pliku
+
+  Piece p;
+  p.from = seg->start;
+  p.to = http->position();
+  p.dg = seg->dg;
+  m_pieces.push_back(p);
+
+  seg->dg = fresh;
+  http->setDigest(fresh);
+}
+
+bool HttpSegments::digest(off_t size) throw()
+{
+  std::sort(m_pieces.begin(), m_pieces.end());
+  m_digest->reset();
+
+  off_t pos = 0;
+  for (size_t i = 0; i < m_pieces.size(); ++i) {
+    const Piece &p = m_pieces[i];
+    // Dziury (np. zakresy sprzed wznowienia) doczytujemy z pliku
+    if (p.from > pos && !m_digest->read(m_fd, pos, p.from)) return false;
+    if (p.from < pos || !m_digest->combine(*p.dg, p.to - p.from)) {
+      // Nie powinno sie zdarzyc - liczymy od nowa z pliku
+      m_digest->reset();
+      return m_digest->read(m_fd, 0, size);
+    }
+    pos = p.to;
+  }
+
+  return pos >= size || m_digest->read(m_fd, pos, size);
+}
+
+void HttpSegments::finished(Http::Error::Type err) throw()
+{
+  bool last;
+
+  {
+    Lock l(m_lock);
+
+    if (err != Http::Error::None) {
+      if (m_err == Http::Error::None) m_err = err;
+      m_abort = true;
+    }
+
+    last = --m_busy == 0;
+  }
+
+  // Po v() get() wraca i obiekt moze zniknac - juz bez blokady w reku
+  if (last) m_done.v();
+}
+
+bool HttpSegments::s_progress_fn(const char *buf, size_t len, void *data)
+{
+  HttpSegments *hs = (HttpSegments*)data;
+
+  if (hs->m_abort) return false;
+  hs->m_len += len;
+
+  if (hs->m_resume && (hs->m_unsynced += len) >= Checkpoint) hs->checkpoint();
+
+  return hs->m_fn ? hs->m_fn(buf, len, hs->m_data) : true;
+}
+
+void HttpSegments::s_done_fn(Http *http, void *data)
+{
+  Segment *seg = (Segment*)data;
+  HttpSegments *hs = seg->owner;
+
+  // To co ten kawalek zdazyl pobrac zostaje w dzienniku (i w skrotach)
+  hs->checkpoint(seg);
+  hs->piece(seg);
+
+  if (http->error() == Http::Error::None) {
+    // Kawalek skonczony - bierzemy nastepny zakres albo pomagamy najwolniejszemu
+    if (hs->next(seg) || hs->steal(seg)) return;
+    http->limit(-1);
+    return hs->finished(Http::Error::None);
+  }
+
+  off_t from = http->position(), to = http->limit();
+  Http::Error::Type err = http->error();
+
+  if (!hs->m_abort && err == Http::Error::Stalled && from < to) {
+    // Serwer stanal - reszta zakresu z nastepnego
+    if (hs->failover(seg)) {
+      seg->retries = 0;
+      if (hs->run(seg, from, to)) return;
+      err = http->error();
+    }
+  } else if (!hs->m_abort && err != Http::Error::Cancel &&
+      seg->retries < MaxRetries && from < to) {
+    ++seg->retries;
+    if (hs->run(seg, from, to)) return;
+    err = http->error();
+  }
+
+  http->limit(-1);
+  hs->finished(err);
+}
+
@@ -0,0 +1,165 @@
+/**
+ * @brief Pobieranie pliku kilkoma rownoleglymi polaczeniami (Range).
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_HTTP_SEGMENTS_HH__
+#define __RS_HTTP_SEGMENTS_HH__
+
+#include <rs/Http.hh>
+#include <rs/Journal.hh>
+#include <rs/Semaphore.hh>
+#include <rs/Mutex.hh>
+#include <rs/Digest.hh>
+
+#include <string>
+#include <vector>
+
+class HttpSegments {
+  public:
+    HttpSegments(bool pooled = false) throw();
+    ~HttpSegments(void) throw();
+
+    /**
+     * @brief Pobierz plik do path w segments kawalkach.
+     *
+     * Najpierw pytamy o rozmiar (zadanie z "Range: bytes=0-0", rozmiar z
+     * Content-Range odpowiedzi 206), plik jest od razu
+     * ustawiany na docelowy rozmiar, a kazdy kawalek pisany pwrite na swoje
+     * miejsce. Gdy kawalek sie skonczy, przejmuje polowe reszty najwolniejszego.
+     * Bez obslugi zakresow - zwykle Http::get(path, ...).
+     *
+     * progress_fn jest wolana z watku HttpEngine, po kolei dla wszystkich
+     * kawalkow (bajty nie przychodza po kolei!). Przy wznowieniu najpierw
+     * raz z buf == NULL i len == liczba bajtow juz pobranych wczesniej.
+     */
+    off_t get(const char *path, const char *url, const char *post = NULL,
+        const char *cookies = NULL, unsigned segments = 4,
+        Http::progress_fn fn = NULL, void *data = NULL) throw();
+
+    /**
+     * @brief Wznawianie - dane ida do "path.part", pobrane zakresy do
+     * dziennika "path.part.journal", a gotowy plik jest przemianowywany.
+     */
+    void setResume(bool on) { m_resume = on; }
+
+    // Rezerwuj miejsce na caly plik (Http::setPreallocate)
+    void setPreallocate(bool on, off_t hint = -1) { m_prealloc = on; m_probe.setPreallocate(on, hint); }
+
+    // Zapis przez mmap (Http::setMapped) - kazdy kawalek mapuje swoj zakres
+    void setMapped(bool on) { m_mapped = on; m_probe.setMapped(on); }
+
+    // Udzial calego pliku w limicie predkosci - dzielony miedzy kawalki
+    void setShare(unsigned weight, uint64_t cap = 0) { m_weight = weight; m_cap = cap; m_probe.setShare(weight, cap); }
+
+    /**
+     * @brief Skrot calego pliku. Kazdy kawalek liczy swoj zakres w locie, a na
+     * koniec sa sklejane (crc32c); zakresy z wznowienia sa doczytywane z pliku.
+     * Skroty, ktorych nie da sie skleic, sa liczone z pliku po pobraniu.
+     */
+    void setDigest(Digest *d) { m_digest = d; m_probe.setDigest(d); }
+
+    // Zastoj (Http::setStall) w ktoryms kawalku przelacza na nastepny serwer.
+    // bps dotyczy calego pliku - kazdy z n kawalkow pilnuje bps/n.
+    void setStall(unsigned secs, uint64_t bps = 1) { m_stall = secs; m_stall_bps = bps; m_probe.setStall(secs, bps); }
+
+    /**
+     * @brief Zapasowe serwery z tym samym plikiem, w kolejnosci. Gdy kawalek
+     * stanie (setStall), on i kolejne zakresy ida z nastepnego serwera - od
+     * miejsca, gdzie kawalek przestal. Bez obslugi zakresow - od poczatku.
+     * url podany do get() jest pomijany, jesli jest tez na liscie.
+     */
+    void setMirrors(const std::vector<std::string> &urls) { m_mirrors = urls; }
+    // Ile razy przelaczono serwer w ostatnim get() i z ktorego skonczono
+    unsigned failovers(void) const { return m_failovers; }
+    const char *url(void) const { return m_url; }
+
+    // Sloik z ciastkami dla wszystkich polaczen (Http::setCookieJar)
+    void setCookieJar(CookieJar *jar) { m_jar = jar; m_probe.setCookieJar(jar); }
+
+    // Najmniejszy kawalek jaki oplaca sie dzielic dalej
+    static const off_t MinSegment = 256*1024;
+    // Ile razy ponawiac zerwany kawalek (od miejsca gdzie skonczyl)
+    static const unsigned MaxRetries = 3;
+    // Co ile bajtow robic fdatasync i zapis do dziennika
+    static const off_t Checkpoint = 8*1024*1024;
+
+    Http::Error::Type error(void) const { return m_err; }
+    Http::Status::Type status(void) const { return m_st; }
+    // Naglowek odpowiedzi na zapytanie o rozmiar
+    const char *header(void) const { return m_probe.header(); }
+    // Ile bajtow bylo juz pobranych (wznowienie)
+    off_t resumed(void) const { return m_resumed; }
+
+  private:
+    HttpSegments(const HttpSegments &);
+
+    struct Segment {
+      HttpSegments *owner;
+      Http http;
+      unsigned retries;
+      size_t mirror; // z ktorego serwera (m_urls) idzie biezacy transfer
+      off_t synced;  // do kad zakres jest juz w dzienniku
+      off_t start;   // skad zaczal biezacy transfer
+      Digest *dg;    // skrot biezacego transferu
+      Segment(HttpSegments *owner, bool pooled)
+        : owner(owner), http(pooled), retries(0), mirror(0), synced(0), start(0), dg(NULL) { }
+      ~Segment(void) { delete dg; }
+    };
+
+    // Skrot jednego pobranego zakresu [from, to)
+    struct Piece {
+      off_t from, to;
+      Digest *dg;
+      bool operator<(const Piece &p) const { return from < p.from; }
+    };
+
+    bool m_pooled, m_resume, m_prealloc, m_mapped;
+    CookieJar *m_jar;
+    Digest *m_digest;
+    std::vector<Piece> m_pieces; // tylko z watku HttpEngine (i po koncu)
+    unsigned m_weight;
+    uint64_t m_cap;
+    unsigned m_stall;
+    uint64_t m_stall_bps;
+    std::vector<std::string> m_mirrors; // zapasowe serwery (setMirrors)
+    std::vector<std::string> m_urls;    // url z get() i zapasowe
+    size_t m_mirror;                    // biezacy serwer w m_urls
+    unsigned m_failovers;
+    Http m_probe;
+    std::vector<Segment*> m_segs;
+    std::vector<Journal::Range> m_todo; // zakresy czekajace na wolny kawalek
+    std::vector<Journal::Range> m_first; // zakresy pierwszych kawalkow (s_start_fn)
+    Journal m_journal;
+    Semaphore m_done;
+    Mutex m_lock;
+    size_t m_busy;     // ile kawalkow jeszcze sie pobiera
+    bool m_abort;      // blad w ktoryms kawalku - przerwac reszte
+    int m_fd;
+    off_t m_size;      // rozmiar pliku z probe - kazdy zakres musi go potwierdzic
+    off_t m_len, m_resumed, m_unsynced;
+    Http::Error::Type m_err;
+    Http::Status::Type m_st;
+
+    // Parametry biezacego pobierania (dla ponowien i podzialow)
+    const char *m_url, *m_post, *m_cookies;
+    Http::progress_fn m_fn;
+    void *m_data;
+
+    off_t single(const char *path, const char *url, const char *post,
+        const char *cookies, Http::progress_fn fn, void *data) throw();
+    bool run(Segment *seg, off_t from, off_t to) throw();
+    bool next(Segment *seg) throw();
+    bool steal(Segment *seg) throw();
+    bool failover(Segment *seg) throw();
+    void checkpoint(Segment *only = NULL) throw();
+    void finished(Http::Error::Type err) throw();
+    void piece(Segment *seg) throw();
+    bool digest(off_t size) throw();
+    static void s_start_fn(void *data);
+    static void s_done_fn(Http *http, void *data);
+    static bool s_progress_fn(const char *buf, size_t len, void *data);
+};
+
+#endif
+
@@ -0,0 +1,151 @@
+/**
+ * @brief Dziennik pobranych (trwale zapisanych) zakresow pliku *.part
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/Journal.hh>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static bool write_all(int fd, const char *buf, size_t len) throw()
+{
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t wr = write(fd, buf+done, len-done);
+    if (wr < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      return false;
+    }
+    done += wr;
+  }
+
+  return true;
+}
+
+bool Journal::open(const char *path, off_t size, const std::string &version, const char *data) throw()
+{
+  close();
+
+  m_path = path;
+  m_size = size;
+  m_ranges.clear();
+
+  // Bez danych (albo z innymi) wpisy w dzienniku klamia - zera zamiast tresci
+  struct stat st;
+  bool valid = false;
+  FILE *f = (stat(data, &st) == 0 && st.st_size == size) ? fopen(path, "r") : NULL;
+
+  if (f) {
+    char line[1024];
+    long long sz = -1;
+    int at = 0;
+
+    if (fgets(line, sizeof(line), f) && strchr(line, '\n') &&
+        sscanf(line, "RSJ 1 %lld%n", &sz, &at) == 1 && sz == (long long)size) {
+      // Reszta linii (bez spacji przed) to wersja pliku na serwerze
+      const char *ver = line + at;
+      if (*ver == ' ') ++ver;
+      valid = std::string(ver, strchr(ver, '\n') - ver) == version;
+    }
+
+    if (valid) {
+      while (fgets(line, sizeof(line), f)) {
+        long long from, to;
+        if (!strchr(line, '\n')) break; // urwana linia
+        if (sscanf(line, "%lld %lld", &from, &to) != 2) break;
+        if (from < 0 || to > size || from >= to) continue;
+        merge(from, to);
+      }
+    }
+
+    fclose(f);
+  }
+
+  if (valid) {
+    if ((m_fd = ::open(path, O_WRONLY|O_APPEND)) >= 0) return true;
+    // Nie da sie dopisywac - wpisy nic nie znacza, plik od nowa
+  }
+
+  m_ranges.clear();
+  m_fd = ::open(path, O_WRONLY|O_TRUNC|O_CREAT, 0644);
+  if (m_fd < 0) return false;
+
+  char head[64];
+  int n = snprintf(head, sizeof(head), "RSJ 1 %lld ", (long long)size);
+  std::string line = std::string(head, n) + version + "\n";
+  if (!write_all(m_fd, line.data(), line.size()) || fdatasync(m_fd)) close();
+
+  return false;
+}
+
+void Journal::close(void) throw()
+{
+  if (m_fd >= 0) ::close(m_fd);
+  m_fd = -1;
+}
+
+bool Journal::add(off_t from, off_t to) throw()
+{
+  if (from >= to) return true;
+  if (m_fd < 0) return false;
+
+  char line[64];
+  int n = snprintf(line, sizeof(line), "%lld %lld\n", (long long)from, (long long)to);
+  if (!write_all(m_fd, line, n) || fdatasync(m_fd)) return false;
+
+  merge(from, to);
+  return true;
+}
+
+void Journal::merge(off_t from, off_t to) throw()
+{
+  std::vector<Range> out;
+  size_t i = 0;
+
+  while (i < m_ranges.size() && m_ranges[i].second < from) out.push_back(m_ranges[i++]);
+
+  while (i < m_ranges.size() && m_ranges[i].first <= to) {
+    if (m_ranges[i].first < from) from = m_ranges[i].first;
+    if (m_ranges[i].second > to) to = m_ranges[i].second;
+    ++i;
+  }
+  out.push_back(Range(from, to));
+
+  while (i < m_ranges.size()) out.push_back(m_ranges[i++]);
+
+  m_ranges.swap(out);
+}
+
+off_t Journal::done(void) const throw()
+{
+  off_t sum = 0;
+  for (size_t i = 0; i < m_ranges.size(); ++i) sum += m_ranges[i].second - m_ranges[i].first;
+  return sum;
+}
+
+std::vector<Journal::Range> Journal::missing(void) const throw()
+{
+  std::vector<Range> out;
+  off_t pos = 0;
+
+  for (size_t i = 0; i < m_ranges.size(); ++i) {
+    if (m_ranges[i].first > pos) out.push_back(Range(pos, m_ranges[i].first));
+    pos = m_ranges[i].second;
+  }
+  if (pos < m_size) out.push_back(Range(pos, m_size));
+
+  return out;
+}
+
+void Journal::remove(const char *path) throw()
+{
+  unlink(path);
+}
+
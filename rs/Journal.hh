@@ -0,0 +1,69 @@
+/**
+ * @brief Dziennik pobranych (trwale zapisanych) zakresow pliku *.part
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_JOURNAL_HH__
+#define __RS_JOURNAL_HH__
+
+#ifndef _FILE_OFFSET_BITS
+# define _FILE_OFFSET_BITS 64
+#elif _FILE_OFFSET_BITS != 64
+# error "_FILE_OFFSET_BITS != 64"
+#endif
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+/**
+ * Plik tekstowy: "RSJ 1 <rozmiar> <wersja>", potem po jednej linii
+ * "<od> <do>" na kazdy zapisany zakres [od, do). Wersja to ETag albo
+ * Last-Modified z serwera (moze byc pusta). Linie sa tylko dopisywane,
+ * urwana ostatnia linia (np. po padzie) jest pomijana.
+ */
+class Journal {
+  public:
+    typedef std::pair<off_t, off_t> Range; // [od, do)
+
+    Journal(void) throw() : m_fd(-1), m_size(-1) { }
+    ~Journal(void) throw() { close(); }
+
+    /**
+     * @brief Otworz dziennik pliku data o rozmiarze size i wersji version.
+     *
+     * Gdy dziennik nie istnieje, opisuje inny rozmiar albo wersje, albo
+     * pliku data nie ma (lub ma inny rozmiar), zaczynamy od zera (zwraca
+     * false, ranges() puste - dane w data nie sa nic warte).
+     */
+    bool open(const char *path, off_t size, const std::string &version, const char *data) throw();
+    void close(void) throw();
+
+    /**
+     * @brief Zapisz trwale zakres. Dane w pliku musza juz byc po fdatasync!
+     */
+    bool add(off_t from, off_t to) throw();
+
+    // Scalone, posortowane zakresy z dziennika
+    const std::vector<Range> &ranges(void) const { return m_ranges; }
+    // Ile bajtow jest juz trwale zapisanych
+    off_t done(void) const throw();
+    // Czego jeszcze brakuje w [0, rozmiar)
+    std::vector<Range> missing(void) const throw();
+    off_t size(void) const { return m_size; }
+
+    static void remove(const char *path) throw();
+
+  private:
+    Journal(const Journal &);
+
+    int m_fd;
+    off_t m_size;
+    std::string m_path;
+    std::vector<Range> m_ranges;
+
+    void merge(off_t from, off_t to) throw();
+};
+
+#endif
+
@@ -0,0 +1,140 @@
+/**
+ * @brief Ograniczanie predkosci pobierania (wiaderko z zetonami).
+ * @author Piotr Truszkowski
+ */
+
+#include <curl/curl.h>
+
+#include <rs/Limiter.hh>
+#include <rs/HttpEngine.hh>
+#include <rs/Time.hh>
+
+#include <algorithm>
+
+Limiter &Limiter::instance(void)
+{
+  // Nigdy nie niszczony - watek silnika wola tick() az do konca procesu,
+  // takze w trakcie niszczenia obiektow statycznych
+  static Limiter *limiter = new Limiter();
+  return *limiter;
+}
+
+Limiter::Limiter(void) throw()
+  : m_rate(0), m_last(Time::mono_msec()), m_ticker(0) { }
+
+// Rozdzial rusza przy pierwszym transferze z limitem (wolane pod m_lock)
+void Limiter::start(void) throw()
+{
+  if (m_ticker) return;
+  m_last = Time::mono_msec();
+  m_ticker = HttpEngine::instance().every(TickMs, s_tick_fn, this);
+}
+
+void Limiter::setRate(uint64_t bps) throw()
+{
+  m_rate = bps;
+
+  Lock l(m_lock);
+  if (bps && !m_flows.empty()) start();
+}
+
+void Limiter::s_tick_fn(void *data)
+{
+  ((Limiter*)data)->tick();
+}
+
+void Limiter::attach(Flow *f, void *curl, unsigned weight, uint64_t cap) throw()
+{
+  f->curl = curl;
+  f->weight = weight ? weight : 1;
+  f->cap = cap;
+  f->tokens = 0;
+  f->paused = false;
+
+  Lock l(m_lock);
+  m_flows.push_back(f);
+  if (m_rate || cap) start();
+}
+
+size_t Limiter::flows(void) throw()
+{
+  Lock l(m_lock);
+  return m_flows.size();
+}
+
+void Limiter::detach(Flow *f) throw()
+{
+  Lock l(m_lock);
+  std::vector<Flow*>::iterator it = std::find(m_flows.begin(), m_flows.end(), f);
+  if (it != m_flows.end()) m_flows.erase(it);
+}
+
+void Limiter::tick(void) throw()
+{
+  static const double Inf = 1e300;
+
+  uint64_t rate = m_rate;
+  std::vector<Flow*> wake;
+
+  {
+    Lock l(m_lock); // m_last takze - start() zeruje go z innych watkow
+    uint64_t now = Time::mono_msec();
+    double dt = (now - m_last)/1000.0;
+    m_last = now;
+    if (dt > 0.2) dt = 0.2; // po dlugiej przerwie nie dajemy calej zaleglosci
+
+    size_t n = m_flows.size();
+    std::vector<double> room(n);
+    std::vector<bool> open(n);
+    double left = rate ? rate*dt : Inf;
+
+    // Ile kazdy moze jeszcze przyjac: do pelnego wiaderka i nie ponad wlasny limit
+    for (size_t i = 0; i < n; ++i) {
+      Flow *f = m_flows[i];
+      uint64_t r = f->cap ? f->cap : rate;
+      double burst = std::max((double)MinBurst, r*2.0*TickMs/1000.0);
+      room[i] = std::max(0.0, burst - f->tokens);
+      if (f->cap) room[i] = std::min(room[i], f->cap*dt);
+      open[i] = room[i] > 0;
+    }
+
+    // Rozdzial wedlug wag, nadwyzka tych co juz maja dosc idzie do reszty
+    for (int pass = 0; pass < 4 && left > 1.0; ++pass) {
+      double wsum = 0, given = 0;
+      for (size_t i = 0; i < n; ++i) if (open[i]) wsum += m_flows[i]->weight;
+      if (wsum == 0) break;
+
+      for (size_t i = 0; i < n; ++i) {
+        if (!open[i]) continue;
+        double g = (left == Inf) ? room[i] : left*m_flows[i]->weight/wsum;
+        if (g >= room[i]) { g = room[i]; open[i] = false; }
+        m_flows[i]->tokens += g;
+        room[i] -= g;
+        given += g;
+      }
+
+      if (left != Inf) left -= given;
+    }
+
+    bool busy = false;
+    for (size_t i = 0; i < n; ++i) {
+      Flow *f = m_flows[i];
+      if (f->paused && (f->tokens > 0 || (!rate && !f->cap))) {
+        f->paused = false;
+        wake.push_back(f);
+      }
+      if (rate || f->cap || f->paused) busy = true;
+    }
+
+    // Nie ma czego ograniczac ani wznawiac - do nastepnego attach/setRate
+    if (!busy && m_ticker) {
+      HttpEngine::instance().stop(m_ticker);
+      m_ticker = 0;
+    }
+  }
+
+  // Wznowienie moze od razu wolac ujscie (take) - juz bez blokady
+  for (size_t i = 0; i < wake.size(); ++i)
+    curl_easy_pause((CURL*)wake[i]->curl, CURLPAUSE_CONT);
+}
+
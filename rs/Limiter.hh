@@ -0,0 +1,82 @@
+/**
+ * @brief Ograniczanie predkosci pobierania (wiaderko z zetonami).
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_LIMITER_HH__
+#define __RS_LIMITER_HH__
+
+#include <stdint.h>
+#include <cstdlib>
+#include <vector>
+
+#include <rs/Mutex.hh>
+
+/**
+ * Kazdy transfer (Flow) ma swoje wiaderko. Co TickMs watek HttpEngine
+ * rozdziela globalny przydzial miedzy transfery wedlug wag - czego jeden
+ * nie wykorzysta (pelne wiaderko, wlasny limit), dostaja pozostali.
+ * Rozdzial chodzi tylko wtedy, gdy jest co ograniczac albo wznawiac -
+ * bez limitow (i bez wstrzymanych) watek silnika nie budzi sie co TickMs.
+ *
+ * Gdy w wiaderku nic nie ma, ujscie zwraca CURL_WRITEFUNC_PAUSE - curl
+ * przestaje czytac z gniazda (nie ma buforowania poza jednym kawalkiem),
+ * a przy nastepnym rozdziale transfer jest wznawiany.
+ */
+class Limiter {
+  public:
+    static Limiter &instance(void);
+
+    struct Flow {
+      void *curl;
+      unsigned weight;
+      uint64_t cap;    // wlasny limit B/s, 0 - brak
+      double tokens;   // moze zejsc ponizej zera (caly kawalek na raz)
+      bool paused;
+    };
+
+    static const unsigned TickMs = 20;
+    static const unsigned DefWeight = 100;
+    // Najmniejsze wiaderko - musi pomiescic kawalek jaki daje curl
+    static const uint64_t MinBurst = 64*1024;
+
+    // Globalny limit w B/s, 0 - bez limitu. Mozna zmieniac w trakcie.
+    void setRate(uint64_t bps) throw();
+    uint64_t rate(void) const throw() { return m_rate; }
+
+    // Ile transferow jest dolaczonych
+    size_t flows(void) throw();
+
+    // Dolacz / odlacz transfer (uchwyt curl)
+    void attach(Flow *f, void *curl, unsigned weight, uint64_t cap) throw();
+    void detach(Flow *f) throw();
+
+    /**
+     * @brief Wez len bajtow z wiaderka (z watku silnika, w ujsciu).
+     * false - transfer trzeba wstrzymac (CURL_WRITEFUNC_PAUSE).
+     */
+    bool take(Flow *f, size_t len) throw()
+    {
+      if (!m_rate && !f->cap) return true;
+      if (f->tokens > 0) { f->tokens -= len; return true; }
+      f->paused = true;
+      return false;
+    }
+
+  private:
+    Limiter(void) throw();
+    Limiter(const Limiter &);
+
+    Mutex m_lock;
+    std::vector<Flow*> m_flows;
+    volatile uint64_t m_rate;
+    uint64_t m_last;
+    unsigned m_ticker; // HttpEngine::every, 0 - rozdzial stoi
+
+    void start(void) throw();
+    void tick(void) throw();
+    static void s_tick_fn(void *data);
+};
+
+#endif
+
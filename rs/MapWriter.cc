@@ -0,0 +1,105 @@
+/**
+ * @brief Zapis do pliku przez mmap - dane z sieci kopiowane wprost do stron.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/MapWriter.hh>
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static off_t page_size(void) throw()
+{
+  static off_t page = sysconf(_SC_PAGESIZE) > 0 ? sysconf(_SC_PAGESIZE) : 4096;
+  return page;
+}
+
+MapWriter::MapWriter(void) throw()
+  : m_fd(-1), m_from(0), m_to(0), m_pos(0), m_map(NULL), m_moff(0), m_mlen(0) { }
+
+bool MapWriter::begin(int fd, off_t from, off_t to, bool &nospace) throw()
+{
+  end();
+  nospace = false;
+
+  if (fd < 0 || from < 0 || to <= from) return false;
+
+  // Bloki musza byc zajete zanim dotkniemy stron (inaczej SIGBUS przy ENOSPC)
+  if (fallocate(fd, 0, from, to - from)) {
+    nospace = (errno == ENOSPC || errno == EFBIG);
+    return false;
+  }
+
+  m_fd = fd;
+  m_from = m_pos = from;
+  m_to = to;
+
+  if (!remap()) { m_fd = -1; return false; }
+
+  return true;
+}
+
+bool MapWriter::remap(void) throw()
+{
+  unmap();
+
+  m_moff = m_pos & ~(page_size() - 1);
+  m_mlen = (m_to - m_moff < (off_t)Window) ? m_to - m_moff : Window;
+
+  void *map = mmap(NULL, m_mlen, PROT_READ|PROT_WRITE, MAP_SHARED, m_fd, m_moff);
+  if (map == MAP_FAILED) { m_map = NULL; return false; }
+
+  m_map = (char*)map;
+  // Piszemy po kolei - jadro moze z wyprzedzeniem podpinac strony
+  madvise(m_map, m_mlen, MADV_SEQUENTIAL);
+  return true;
+}
+
+void MapWriter::unmap(void) throw()
+{
+  if (!m_map) return;
+
+  // Zapis okna rusza od razu, nie czekamy az jadro samo sie zorientuje
+  // (msync MS_ASYNC od dawna nic nie robi)
+  off_t len = (m_pos < m_moff + (off_t)m_mlen ? m_pos : m_moff + (off_t)m_mlen) - m_moff;
+  if (len > 0) sync_file_range(m_fd, m_moff, len, SYNC_FILE_RANGE_WRITE);
+
+  munmap(m_map, m_mlen);
+  m_map = NULL;
+}
+
+bool MapWriter::write(const char *buf, size_t len) throw()
+{
+  if (m_fd < 0 || m_pos + (off_t)len > m_to) return false;
+
+  while (len) {
+    if (!m_map || m_pos >= m_moff + (off_t)m_mlen) {
+      if (!remap()) return false; // czesc moze byc juz zapisana - patrz position()
+    }
+
+    size_t off = m_pos - m_moff, n = m_mlen - off;
+    if (n > len) n = len;
+
+    memcpy(m_map + off, buf, n);
+    buf += n;
+    len -= n;
+    m_pos += n;
+  }
+
+  return true;
+}
+
+void MapWriter::end(void) throw()
+{
+  if (m_fd < 0) return;
+
+  unmap();
+  // Plik zaraz bedzie czytany po kolei (skrot, kopiowanie) - wieksza readahead
+  if (m_pos > m_from) posix_fadvise(m_fd, m_from, m_pos - m_from, POSIX_FADV_SEQUENTIAL);
+
+  m_fd = -1;
+}
+
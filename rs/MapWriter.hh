@@ -0,0 +1,62 @@
+/**
+ * @brief Zapis do pliku przez mmap - dane z sieci kopiowane wprost do stron.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_MAP_WRITER_HH__
+#define __RS_MAP_WRITER_HH__
+
+#ifndef _FILE_OFFSET_BITS
+# define _FILE_OFFSET_BITS 64
+#elif _FILE_OFFSET_BITS != 64
+# error "_FILE_OFFSET_BITS != 64"
+#endif
+
+#include <sys/types.h>
+#include <cstdlib>
+
+/**
+ * Gdy znamy rozmiar, zakres pliku jest rezerwowany (fallocate) i mapowany
+ * oknami po Window bajtow. Zapis to memcpy - bez write() na kazdy kawalek.
+ * Skonczone okno jest oddawane do zapisu (sync_file_range) i odmapowywane,
+ * wiec brudnych stron w mapowaniu jest najwyzej jedno okno.
+ *
+ * Bez fallocate mapowanie sie nie zaczyna - zapis do dziury w pliku przy
+ * pelnym dysku konczy sie SIGBUS, a nie bledem.
+ */
+class MapWriter {
+  public:
+    static const size_t Window = 16*1024*1024;
+
+    MapWriter(void) throw();
+    ~MapWriter(void) throw() { end(); }
+
+    /**
+     * @brief Pisz do zakresu [from, to) pliku fd (fd nie jest zamykany).
+     * false - nie da sie mapowac (pisz po staremu), nospace - brak miejsca.
+     */
+    bool begin(int fd, off_t from, off_t to, bool &nospace) throw();
+    // Dopisz dane. false - poza zakresem (nic nie zapisano) albo blad mmap
+    // (zapisano do position())
+    bool write(const char *buf, size_t len) throw();
+    // Odmapuj, zacznij zapis na dysk i podpowiedz czytajacym kolejnosc
+    void end(void) throw();
+
+    bool active(void) const { return m_fd >= 0; }
+    off_t position(void) const { return m_pos; }
+
+  private:
+    MapWriter(const MapWriter &);
+
+    int m_fd;
+    off_t m_from, m_to, m_pos;
+    char *m_map;       // biezace okno
+    off_t m_moff;      // skad w pliku (wyrownane do strony)
+    size_t m_mlen;
+
+    bool remap(void) throw();
+    void unmap(void) throw();
+};
+
+#endif
+
@@ -0,0 +1,124 @@
+/**
+ * @brief Szukanie wielu napisow naraz w jednym przejsciu (Aho-Corasick).
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/Matcher.hh>
+#include <rs/Exception.hh>
+
+#include <cstring>
+#include <deque>
+
+unsigned Matcher::add(const std::string &pattern) throw()
+{
+  if (m_compiled) throw EInternal("Matcher::add(): automat juz zbudowany");
+  if (pattern.empty()) throw EInternal("Matcher::add(): pusty wzorzec");
+
+  m_pats.push_back(pattern);
+  m_lens.push_back(pattern.size());
+  return m_pats.size() - 1;
+}
+
+void Matcher::compile(void) throw()
+{
+  // Klasy: 0 - bajty, ktorych nie ma w zadnym wzorcu
+  memset(m_class, 0, sizeof(m_class));
+  m_classes = 1;
+  for (size_t p = 0; p < m_pats.size(); ++p)
+    for (size_t i = 0; i < m_pats[p].size(); ++i) {
+      unsigned char b = m_pats[p][i];
+      if (!m_class[b]) m_class[b] = m_classes++;
+    }
+
+  const unsigned C = m_classes;
+
+  // Drzewo wzorcow, -1 - brak krawedzi
+  std::vector<int> go(C, -1);
+  m_out.assign(1, -1);
+
+  for (size_t p = 0; p < m_pats.size(); ++p) {
+    unsigned s = 0;
+    for (size_t i = 0; i < m_pats[p].size(); ++i) {
+      unsigned c = m_class[(unsigned char)m_pats[p][i]];
+      if (go[s*C + c] < 0) {
+        go[s*C + c] = m_out.size();
+        m_out.push_back(-1);
+        go.resize(go.size() + C, -1);
+      }
+      s = go[s*C + c];
+    }
+    if (m_out[s] < 0) m_out[s] = p; // taki sam wzorzec drugi raz - zostaje pierwszy
+  }
+
+  // Przejscia dla kazdej pary (stan, klasa) - wszerz, od korzenia, wiec
+  // stan dla najdluzszego sufiksu (fail) jest gotowy przed stanem glebszym
+  const size_t N = m_out.size();
+  std::vector<unsigned> fail(N, 0);
+  std::deque<unsigned> queue;
+
+  m_next.assign(N*C, 0);
+  m_dict.assign(N, 0);
+
+  for (unsigned c = 0; c < C; ++c) {
+    if (go[c] < 0) continue;
+    m_next[c] = go[c];
+    queue.push_back(go[c]);
+  }
+
+  while (!queue.empty()) {
+    unsigned s = queue.front();
+    queue.pop_front();
+
+    for (unsigned c = 0; c < C; ++c) {
+      int t = go[s*C + c];
+      if (t < 0) {
+        m_next[s*C + c] = m_next[fail[s]*C + c];
+        continue;
+      }
+
+      unsigned f = m_next[fail[s]*C + c];
+      fail[t] = f;
+      m_dict[t] = (m_out[f] >= 0) ? f : m_dict[f];
+      m_next[s*C + c] = t;
+      queue.push_back(t);
+    }
+  }
+
+  // W petli skanowania: przejscie to od razu poczatek wiersza nastepnego
+  // stanu (bez mnozenia), a Report - czy tam jest jakis wynik
+  m_report.assign(N, 0);
+  for (size_t s = 1; s < N; ++s) m_report[s] = (m_out[s] >= 0) ? s : m_dict[s];
+  for (size_t i = 0; i < N*C; ++i)
+    m_next[i] = (m_next[i]*C) | (m_report[m_next[i]] ? Report : 0);
+
+  m_compiled = true;
+}
+
+void Matcher::scan(const char *buf, size_t len, std::vector<Hit> &hits,
+    unsigned &state, size_t &pos) const throw()
+{
+  if (!m_compiled) throw EInternal("Matcher::scan(): automat nie zbudowany");
+
+  const unsigned C = m_classes;
+  const unsigned *next = &m_next[0];
+  const unsigned char *cls = m_class, *b = (const unsigned char*)buf;
+  unsigned row = state*C;
+
+  for (size_t i = 0; i < len; ++i) {
+    unsigned t = next[row + cls[b[i]]];
+    row = t & ~Report;
+    if (!(t & Report)) continue;
+
+    // Wynik w tym stanie i w krotszych sufiksach (jeden wzorzec w drugim)
+    for (unsigned o = m_report[row/C]; o; o = m_dict[o]) {
+      Hit h;
+      h.id = m_out[o];
+      h.offset = pos + i + 1 - m_lens[h.id];
+      hits.push_back(h);
+    }
+  }
+
+  state = row/C;
+  pos += len;
+}
+
@@ -0,0 +1,71 @@
+/**
+ * @brief Szukanie wielu napisow naraz w jednym przejsciu (Aho-Corasick).
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_MATCHER_HH__
+#define __RS_MATCHER_HH__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Wzorce sa skladane w automat (tablica przejsc po klasach bajtow - bajty
+ * spoza wzorcow to jedna klasa), wiec strona jest czytana raz, bajt po
+ * bajcie, niezaleznie od liczby wzorcow. Dane mozna podawac kawalkami
+ * (np. kolejne kawalki Rope) - wzorzec moze zaczac sie w jednym kawalku
+ * i skonczyc w nastepnym.
+ *
+ * Po compile() automat sie nie zmienia, wiec moze byc uzywany przez wiele
+ * watkow naraz (stan skanowania jest po stronie wolajacego).
+ */
+class Matcher {
+  public:
+    struct Hit {
+      unsigned id;   // numer wzorca (z add)
+      size_t offset; // gdzie wzorzec sie zaczyna
+    };
+
+    Matcher(void) throw() : m_classes(1), m_compiled(false) { }
+
+    // Dodaj wzorzec (niepusty), zwraca jego numer - kolejne od 0
+    unsigned add(const std::string &pattern) throw();
+    // Zbuduj automat, potem nie mozna juz dodawac
+    void compile(void) throw();
+
+    /**
+     * @brief Wszystkie wystapienia wzorcow w buf (dopisywane do hits, po
+     * kolei wedlug konca wzorca).
+     *
+     * Skanowanie kawalkami: state i pos zaczynaja od 0 i sa przekazywane
+     * do nastepnego wywolania, pos - ile bajtow juz przeczytano.
+     */
+    void scan(const char *buf, size_t len, std::vector<Hit> &hits,
+        unsigned &state, size_t &pos) const throw();
+
+    void scan(const char *buf, size_t len, std::vector<Hit> &hits) const throw()
+    {
+      unsigned state = 0;
+      size_t pos = 0;
+      scan(buf, len, hits, state, pos);
+    }
+
+    size_t patterns(void) const { return m_lens.size(); }
+
+  private:
+    static const unsigned Report = 0x80000000U;
+
+    unsigned char m_class[256];     // bajt -> klasa
+    unsigned m_classes;
+    std::vector<unsigned> m_next;   // stan*m_classes + klasa -> stan*m_classes | Report
+    std::vector<int> m_out;         // wzorzec konczacy sie w stanie, -1 - brak
+    std::vector<unsigned> m_dict;   // nastepny stan z wynikiem po sufiksach, 0 - brak
+    std::vector<unsigned> m_report; // pierwszy stan z wynikiem (ten albo m_dict), 0 - brak
+    std::vector<size_t> m_lens;     // dlugosci wzorcow
+    std::vector<std::string> m_pats;
+    bool m_compiled;
+};
+
+#endif
+
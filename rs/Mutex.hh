@@ -38,6 +38,8 @@ class Mutex {
   private:
     Mutex(const Mutex&); /* non-copyable */
     pthread_mutex_t m;
+
+    friend class Condition;
 };
 
 class Lock {
@@ -0,0 +1,251 @@
+/**
+ * @brief Cache DNS dla calego procesu i laczenie "na wyscigi" z kilkoma adresami.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/Resolver.hh>
+#include <rs/Time.hh>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+Resolver &Resolver::instance(void)
+{
+  static Resolver resolver;
+  return resolver;
+}
+
+Resolver::Resolver(void) throw()
+  : m_ttl(300), m_stagger(250), m_racing(false) { }
+
+void Resolver::clear(void) throw()
+{
+  Lock l(m_lock);
+  m_cache.clear();
+}
+
+static bool numeric(const std::string &host) throw()
+{
+  unsigned char buf[sizeof(in6_addr)];
+  return inet_pton(AF_INET, host.c_str(), buf) == 1 || inet_pton(AF_INET6, host.c_str(), buf) == 1;
+}
+
+bool Resolver::lookup(const std::string &host, std::vector<std::string> &addrs, 
+    bool block, bool *raced) throw()
+{
+  addrs.clear();
+  if (raced) *raced = false;
+  if (host.empty()) return false;
+
+  if (numeric(host)) {
+    addrs.push_back(host);
+    return true;
+  }
+
+  uint64_t now = Time::mono_msec();
+
+  if (m_ttl) {
+    Lock l(m_lock);
+    Cache::iterator it = m_cache.find(host);
+    // Z watku silnika lepszy nieswiezy adres niz czekanie na DNS
+    if (it != m_cache.end() && (it->second.expires > now || !block)) {
+      addrs = it->second.addrs;
+      if (raced) *raced = it->second.raced;
+      return true;
+    }
+  }
+
+  if (!block) return false;
+
+  addrinfo hints, *res = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_ADDRCONFIG;
+
+  if (getaddrinfo(host.c_str(), NULL, &hints, &res) || !res) return false;
+
+  std::vector<std::string> v4, v6;
+  for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+    char buf[NI_MAXHOST];
+    if (getnameinfo(ai->ai_addr, ai->ai_addrlen, buf, sizeof(buf), NULL, 0, NI_NUMERICHOST)) continue;
+    std::vector<std::string> &v = (ai->ai_family == AF_INET6) ? v6 : v4;
+    bool dup = false;
+    for (size_t i = 0; i < v.size() && !dup; ++i) dup = v[i] == buf;
+    if (!dup) v.push_back(buf);
+  }
+  freeaddrinfo(res);
+
+  // Na przemian rodziny (jak w Happy Eyeballs) - w wyscigu obie maja szanse
+  for (size_t i = 0; i < v4.size() || i < v6.size(); ++i) {
+    if (i < v6.size()) addrs.push_back(v6[i]);
+    if (i < v4.size()) addrs.push_back(v4[i]);
+  }
+
+  if (addrs.empty()) return false;
+
+  if (m_ttl) {
+    Lock l(m_lock);
+    Entry &e = m_cache[host];
+    e.addrs = addrs;
+    e.expires = now + m_ttl*1000ULL;
+    e.raced = false;
+  }
+
+  return true;
+}
+
+void Resolver::prefer(const std::string &host, const std::string &addr) throw()
+{
+  Lock l(m_lock);
+  Cache::iterator it = m_cache.find(host);
+  if (it == m_cache.end()) return;
+
+  std::vector<std::string> &v = it->second.addrs;
+  std::vector<std::string>::iterator a = std::find(v.begin(), v.end(), addr);
+  if (a != v.end()) std::rotate(v.begin(), a, a + 1);
+  it->second.raced = true;
+}
+
+bool Resolver::split(const char *url, std::string &host, int &port) throw()
+{
+  const char *bgn = strstr(url, "://");
+  port = (bgn && bgn - url == 5 && !strncasecmp(url, "https", 5)) ? 443 : 80;
+  bgn = bgn ? bgn + 3 : url;
+
+  const char *end;
+  if (*bgn == '[') { // [IPv6]
+    end = strchr(bgn, ']');
+    if (!end) return false;
+    host.assign(bgn + 1, end - bgn - 1);
+    ++end;
+  } else {
+    end = bgn;
+    while (*end && *end != '/' && *end != ':' && *end != '?' && *end != '#') ++end;
+    host.assign(bgn, end - bgn);
+  }
+
+  if (*end == ':') port = atoi(end + 1);
+
+  return !host.empty() && port > 0 && port < 65536;
+}
+
+std::string Resolver::entry(const std::string &host, int port, const std::vector<std::string> &addrs)
+{
+  char num[16];
+  snprintf(num, sizeof(num), ":%d:", port);
+
+  std::string e = host + num;
+  for (size_t i = 0; i < addrs.size(); ++i) {
+    if (i) e += ',';
+    if (addrs[i].find(':') != std::string::npos) e += "[" + addrs[i] + "]";
+    else e += addrs[i];
+  }
+
+  return e;
+}
+
+static int start_connect(const std::string &addr, int port) throw()
+{
+  sockaddr_storage ss;
+  socklen_t len;
+  memset(&ss, 0, sizeof(ss));
+
+  sockaddr_in *in4 = (sockaddr_in*)&ss;
+  sockaddr_in6 *in6 = (sockaddr_in6*)&ss;
+
+  if (inet_pton(AF_INET, addr.c_str(), &in4->sin_addr) == 1) {
+    in4->sin_family = AF_INET;
+    in4->sin_port = htons(port);
+    len = sizeof(*in4);
+  } else if (inet_pton(AF_INET6, addr.c_str(), &in6->sin6_addr) == 1) {
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = htons(port);
+    len = sizeof(*in6);
+  } else {
+    return -1;
+  }
+
+  int fd = socket(ss.ss_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  if (connect(fd, (sockaddr*)&ss, len) && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int Resolver::race(const std::vector<std::string> &addrs, int port, unsigned timeout_ms, size_t &won) throw()
+{
+  std::vector<pollfd> pfds;
+  std::vector<size_t> which; // numer adresu dla pfds[i]
+  uint64_t start = Time::mono_msec(), deadline = start + timeout_ms, next_at = start;
+  size_t next = 0;
+  int winner = -1;
+
+  while (winner < 0) {
+    uint64_t now = Time::mono_msec();
+    if (now >= deadline) break;
+
+    // Kolejny adres - gdy minal odstep albo nic juz sie nie laczy
+    if (next < addrs.size() && (now >= next_at || pfds.empty())) {
+      int fd = start_connect(addrs[next], port);
+      if (fd >= 0) {
+        pollfd p;
+        p.fd = fd;
+        p.events = POLLOUT;
+        p.revents = 0;
+        pfds.push_back(p);
+        which.push_back(next);
+      }
+      ++next;
+      next_at = now + m_stagger;
+      continue;
+    }
+
+    if (pfds.empty()) break; // wszystkie adresy odpadly
+
+    uint64_t until = (next < addrs.size() && next_at < deadline) ? next_at : deadline;
+    int n = poll(&pfds[0], pfds.size(), until > now ? (int)(until - now) : 0);
+    if (n < 0 && errno != EINTR) break;
+    if (n <= 0) continue;
+
+    for (size_t i = 0; i < pfds.size(); ) {
+      if (!pfds[i].revents) { ++i; continue; }
+
+      int err = 0;
+      socklen_t elen = sizeof(err);
+      if (winner < 0 && getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &elen) == 0 && err == 0) {
+        winner = pfds[i].fd;
+        won = which[i];
+        ++i;
+        continue;
+      }
+
+      // Ten adres nie dziala - nastepny moze ruszyc od razu
+      close(pfds[i].fd);
+      pfds.erase(pfds.begin() + i);
+      which.erase(which.begin() + i);
+      next_at = Time::mono_msec();
+    }
+  }
+
+  for (size_t i = 0; i < pfds.size(); ++i)
+    if (pfds[i].fd != winner) close(pfds[i].fd);
+
+  return winner;
+}
+
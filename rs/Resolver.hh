@@ -0,0 +1,76 @@
+/**
+ * @brief Cache DNS dla calego procesu i laczenie "na wyscigi" z kilkoma adresami.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_RESOLVER_HH__
+#define __RS_RESOLVER_HH__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+#include <rs/Mutex.hh>
+
+class Resolver {
+  public:
+    /**
+     * Klasa singleton - jeden cache na proces. Http pyta go przed kazdym
+     * transferem i podaje adresy curl-owi (CURLOPT_RESOLVE), wiec curl sam
+     * juz nie rozwiazuje nazw.
+     */
+    static Resolver &instance(void);
+
+    /**
+     * @brief Adresy hosta (numeryczne, IPv6 i IPv4 na przemian).
+     *
+     * block == false - tylko z cache (np. z watku HttpEngine), bez pytania DNS.
+     * raced - czy kolejnosc adresow ustalil juz wyscig (prefer()).
+     * false - nie ma adresow.
+     */
+    bool lookup(const std::string &host, std::vector<std::string> &addrs, 
+        bool block = true, bool *raced = NULL) throw();
+
+    // Adres, ktory wygral wyscig, idzie na poczatek - az do wygasniecia wpisu
+    void prefer(const std::string &host, const std::string &addr) throw();
+
+    /**
+     * @brief Polacz sie rownolegle z adresami (kolejny co stagger ms, dopoki
+     * zaden sie nie polaczyl). Zwraca polaczone gniazdo (nieblokujace) albo
+     * -1, won - ktory adres wygral.
+     */
+    int race(const std::vector<std::string> &addrs, int port, unsigned timeout_ms, size_t &won) throw();
+
+    // Jak dlugo pamietac adresy, 0 - bez cache
+    void setTtl(unsigned secs) throw() { m_ttl = secs; }
+    // Laczenie na wyscigi, stagger - odstep miedzy kolejnymi probami
+    void setRacing(bool on, unsigned stagger_ms = 250) throw() { m_racing = on; m_stagger = stagger_ms; }
+    bool racing(void) const throw() { return m_racing; }
+    void clear(void) throw();
+
+    // Host i port z url-a (http - 80, https - 443). false - zly url.
+    static bool split(const char *url, std::string &host, int &port) throw();
+    // Wpis dla CURLOPT_RESOLVE: "host:port:adres,adres"
+    static std::string entry(const std::string &host, int port, const std::vector<std::string> &addrs);
+
+  private:
+    Resolver(void) throw();
+    Resolver(const Resolver &);
+
+    struct Entry {
+      std::vector<std::string> addrs;
+      uint64_t expires; // Time::mono_msec()
+      bool raced;
+    };
+
+    typedef std::tr1::unordered_map<std::string, Entry> Cache;
+
+    Mutex m_lock;
+    Cache m_cache;
+    unsigned m_ttl, m_stagger;
+    bool m_racing;
+};
+
+#endif
+
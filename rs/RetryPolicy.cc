@@ -0,0 +1,130 @@
+/**
+ * @brief Ponawianie po bledach - odstepy i limity wedlug rodzaju bledu.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/RetryPolicy.hh>
+#include <rs/Time.hh>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+RetryPolicy &RetryPolicy::instance(void)
+{
+  static RetryPolicy policy;
+  return policy;
+}
+
+RetryPolicy::RetryPolicy(void) throw()
+  : m_job_budget(40), m_host_tries(6), m_host_window(60), m_seed(Time::in_usec())
+{
+  // Bledy sieci - krotko, ale szybko coraz dluzej; strony serwisu - jak
+  // dawne stale WaitingFor*, z wolniejszym wzrostem
+  static const Rule defaults[Classes] = {
+    /* HttpError */ {   5,  300, 2.0, 0.2,  5 },
+    /* Timeout   */ {  10,  600, 2.0, 0.2,  5 },
+    /* Stall     */ {  10,  600, 2.0, 0.2,  5 },
+    /* Later     */ {  60, 1800, 1.5, 0.2, 30 },
+    /* Busy      */ { 120, 1800, 1.5, 0.3, 30 },
+    /* Limit     */ { 120, 3600, 1.5, 0.1, 30 },
+    /* Rivalry   */ {  60,  900, 1.5, 0.3, 30 }
+  };
+
+  for (unsigned c = 0; c < Classes; ++c) m_rules[c] = defaults[c];
+}
+
+const char *RetryPolicy::name(Class c) throw()
+{
+  static const char *names[Classes] = {
+    "HttpError", "Timeout", "Stall", "Later", "Busy", "Limit", "Rivalry"
+  };
+  return (c < Classes) ? names[c] : "?";
+}
+
+void RetryPolicy::setRule(Class c, const Rule &r) throw()
+{
+  if (c >= Classes) throw EInternal("RetryPolicy::setRule(): zly rodzaj %d", (int)c);
+
+  Lock l(m_lock);
+  m_rules[c] = r;
+}
+
+RetryPolicy::Rule RetryPolicy::rule(Class c) throw()
+{
+  if (c >= Classes) throw EInternal("RetryPolicy::rule(): zly rodzaj %d", (int)c);
+
+  Lock l(m_lock);
+  return m_rules[c];
+}
+
+void RetryPolicy::setHostBudget(unsigned tries, unsigned secs) throw()
+{
+  Lock l(m_lock);
+  m_host_tries = tries;
+  m_host_window = secs;
+  m_hosts.clear();
+}
+
+// Pierwsza chwila >= t, w ktorej zadne okno [s, s+window) z t nie ma
+// jeszcze tries zaplanowanych ponowien (q - posortowane). Ponowienia
+// zaplanowane daleko (np. po podpowiedzi ze strony) nie blokuja blizszych.
+uint64_t RetryPolicy::fit(const std::vector<uint64_t> &q, uint64_t t, uint64_t window, unsigned tries) throw()
+{
+  for (bool moved = true; moved; ) {
+    moved = false;
+
+    // Okna zaczynajace sie w zaplanowanym ponowieniu z (t - window, t]
+    for (size_t i = 0; i < q.size() && q[i] <= t && !moved; ++i) {
+      if (q[i] + window <= t) continue;
+      size_t in = std::lower_bound(q.begin(), q.end(), q[i] + window) - (q.begin() + i);
+      if (in >= tries) { t = q[i] + window; moved = true; }
+    }
+    if (moved) continue;
+
+    // Okno zaczynajace sie w t - pelne pozniejszych, wiec t idzie za pierwsze z nich
+    std::vector<uint64_t>::const_iterator from = std::lower_bound(q.begin(), q.end(), t);
+    size_t in = std::lower_bound(from, q.end(), t + window) - from;
+    if (in >= tries) { t = *from + 1; moved = true; }
+  }
+
+  return t;
+}
+
+bool RetryPolicy::next(Class c, unsigned attempt, const std::string &host,
+    unsigned hint, uint64_t &delay) throw()
+{
+  if (c >= Classes) throw EInternal("RetryPolicy::next(): zly rodzaj %d", (int)c);
+
+  Lock l(m_lock);
+  const Rule &r = m_rules[c];
+
+  if (attempt > r.tries) return false;
+
+  // base * factor^(attempt-1), najwyzej cap
+  double secs = r.base * pow(r.factor > 1 ? r.factor : 1.0, (double)(attempt ? attempt - 1 : 0));
+  if (secs > r.cap) secs = r.cap;
+
+  double dice = ((double)rand_r(&m_seed)) / RAND_MAX; // 0..1
+  secs *= 1.0 + r.jitter*(2*dice - 1);
+
+  // Serwis sam mowi, ile czekac - nie wczesniej (rozrzut tylko w gore)
+  if (hint && secs < hint) secs = hint * (1.0 + r.jitter*dice);
+
+  uint64_t now = Time::mono_msec(), at = now + (uint64_t)(secs*1000);
+
+  if (m_host_tries && m_host_window && !host.empty()) {
+    std::vector<uint64_t> &q = m_hosts[host];
+    uint64_t window = m_host_window*1000ULL;
+
+    // Minione okna juz nic nie znacza
+    while (!q.empty() && q.front() + window <= now) q.erase(q.begin());
+
+    at = fit(q, at, window, m_host_tries);
+    q.insert(std::upper_bound(q.begin(), q.end(), at), at);
+  }
+
+  delay = at - now;
+  return true;
+}
+
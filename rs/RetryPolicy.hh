@@ -0,0 +1,88 @@
+/**
+ * @brief Ponawianie po bledach - odstepy i limity wedlug rodzaju bledu.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_RETRY_POLICY_HH__
+#define __RS_RETRY_POLICY_HH__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <rs/Mutex.hh>
+
+/**
+ * Klasa singleton - zasady wspolne dla wszystkich zadan, liczniki prob
+ * kazde zadanie trzyma u siebie. Dla kazdego rodzaju bledu jest zasada:
+ * odstep rosnie wykladniczo od base do cap (razy factor z kazda proba),
+ * z losowym rozrzutem +-jitter (zadania nie wracaja naraz) i najwyzej
+ * tries prob w jednym zadaniu. Podpowiedz ze strony ("try again in about
+ * N minutes") zastepuje wyliczony odstep, gdy jest dluzsza.
+ *
+ * Do tego limit na host: najwyzej setHostBudget ponowien w oknie - kolejne
+ * czekaja, az okno sie zwolni, zamiast wszystkie naraz pukac do serwera,
+ * ktory wlasnie odpowiada "busy".
+ */
+class RetryPolicy {
+  public:
+    static RetryPolicy &instance(void);
+
+    enum Class {
+      HttpError = 0, // blad polaczenia, zly kod HTTP albo strona bez potrzebnych danych
+      Timeout,       // Http::Error::Timeout
+      Stall,         // Http::Error::Stalled - zastoj na wszystkich serwerach
+      Later,         // strona "try again later"
+      Busy,          // serwery przeciazone
+      Limit,         // wyczerpany limit pobierania
+      Rivalry,       // ktos z tego adresu juz pobiera
+      Classes
+    };
+
+    struct Rule {
+      unsigned base;   // pierwszy odstep (sek)
+      unsigned cap;    // najdluzszy odstep (sek)
+      double factor;   // mnoznik odstepu z kazda proba
+      double jitter;   // rozrzut (0..1) - czesc odstepu w gore lub w dol
+      unsigned tries;  // ile ponowien w jednym zadaniu, 0 - bez ponawiania
+    };
+
+    void setRule(Class c, const Rule &r) throw();
+    Rule rule(Class c) throw();
+
+    // Najwyzej tries ponowien jednego zadania razem (wszystkie rodzaje)
+    void setJobBudget(unsigned tries) throw() { m_job_budget = tries; }
+    unsigned jobBudget(void) const throw() { return m_job_budget; }
+    // Najwyzej tries ponowien do jednego hosta w oknie secs sekund, 0 - bez
+    void setHostBudget(unsigned tries, unsigned secs) throw();
+
+    /**
+     * @brief Czy ponawiac i po ilu ms. attempt - ktora to proba tego
+     * rodzaju w zadaniu (od 1), hint - podpowiedz ze strony (sek, 0 - brak).
+     * Wynik liczy sie do limitu hosta.
+     */
+    bool next(Class c, unsigned attempt, const std::string &host,
+        unsigned hint, uint64_t &delay) throw();
+
+    static const char *name(Class c) throw();
+
+    // Pierwsza chwila >= t, w ktorej zadne okno [s, s+window) z t nie ma
+    // jeszcze tries ponowien z q (posortowane) - limit hosta w next()
+    static uint64_t fit(const std::vector<uint64_t> &q, uint64_t t, uint64_t window, unsigned tries) throw();
+
+  private:
+    RetryPolicy(void) throw();
+    RetryPolicy(const RetryPolicy &);
+
+    typedef std::map<std::string, std::vector<uint64_t> > Hosts; // zaplanowane ponowienia (Time::mono_msec())
+
+    Mutex m_lock;
+    Rule m_rules[Classes];
+    unsigned m_job_budget, m_host_tries, m_host_window;
+    Hosts m_hosts;
+    unsigned m_seed;
+};
+
+#endif
+
@@ -0,0 +1,121 @@
+/**
+ * @brief Bufor z kawalkow (slabow) - dopisywanie bez kopiowania calosci.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/Rope.hh>
+
+#include <cstring>
+#include <new>
+
+bool Rope::grow(size_t cap) throw()
+{
+  Slab s;
+  if (!(s.data = new(std::nothrow) char[cap + 1])) return false;
+  s.len = 0;
+  s.cap = cap;
+  s.data[0] = 0;
+
+  try { m_slabs.push_back(s); }
+  catch (...) { delete[] s.data; return false; }
+
+  return true;
+}
+
+bool Rope::reserve(size_t len) throw()
+{
+  if (!m_slabs.empty()) {
+    Slab &s = m_slabs.back();
+    if (s.cap - s.len >= len) return true;
+    if (s.len == 0) { // pusty kawalek - zamieniamy na wiekszy
+      char *ptr = new(std::nothrow) char[len + 1];
+      if (!ptr) return false;
+      delete[] s.data;
+      s.data = ptr;
+      s.data[0] = 0;
+      s.cap = len;
+      return true;
+    }
+  }
+
+  return grow(len - (m_slabs.empty() ? 0 : m_slabs.back().cap - m_slabs.back().len));
+}
+
+bool Rope::append(const char *buf, size_t len) throw()
+{
+  while (len > 0) {
+    if (m_slabs.empty() || m_slabs.back().len == m_slabs.back().cap)
+      if (!grow(len > SlabSize ? len : SlabSize)) return false;
+
+    Slab &s = m_slabs.back();
+    size_t n = s.cap - s.len < len ? s.cap - s.len : len;
+
+    memcpy(s.data + s.len, buf, n);
+    s.len += n;
+    s.data[s.len] = 0;
+    m_size += n;
+    buf += n;
+    len -= n;
+  }
+
+  return true;
+}
+
+void Rope::clear(void) throw()
+{
+  for (size_t i = 0; i < m_slabs.size(); ++i) delete[] m_slabs[i].data;
+  m_slabs.clear();
+  m_size = 0;
+}
+
+const char *Rope::contiguous(void) const throw()
+{
+  if (m_slabs.empty()) return "";
+
+  // Dane w pierwszym kawalku, reszta pusta (np. po reserve)
+  for (size_t i = 1; i < m_slabs.size(); ++i)
+    if (m_slabs[i].len) return NULL;
+
+  return m_slabs[0].data;
+}
+
+const char *Rope::flatten(void) throw()
+{
+  const char *ptr = contiguous();
+  if (ptr) return ptr;
+
+  Slab s;
+  if (!(s.data = new(std::nothrow) char[m_size + 1])) return NULL;
+  s.len = s.cap = m_size;
+
+  size_t off = 0;
+  for (size_t i = 0; i < m_slabs.size(); ++i) {
+    memcpy(s.data + off, m_slabs[i].data, m_slabs[i].len);
+    off += m_slabs[i].len;
+    delete[] m_slabs[i].data;
+  }
+  s.data[m_size] = 0;
+
+  m_slabs.clear();
+  m_slabs.push_back(s); // miejsce bylo, clear() nie zwalnia pojemnosci
+
+  return s.data;
+}
+
+Rope::const_iterator Rope::at(size_t pos) const throw()
+{
+  for (size_t i = 0; i < m_slabs.size(); ++i) {
+    if (pos < m_slabs[i].len) return const_iterator(this, i, pos);
+    pos -= m_slabs[i].len;
+  }
+
+  return end();
+}
+
+size_t Rope::const_iterator::offset(void) const
+{
+  size_t off = o;
+  for (size_t i = 0; i < s && i < r->m_slabs.size(); ++i) off += r->m_slabs[i].len;
+  return off;
+}
+
@@ -0,0 +1,125 @@
+/**
+ * @brief Bufor z kawalkow (slabow) - dopisywanie bez kopiowania calosci.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_ROPE_HH__
+#define __RS_ROPE_HH__
+
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+class Rope {
+  public:
+    // Domyslny rozmiar kolejnego kawalka
+    static const size_t SlabSize = 64*1024;
+
+    Rope(void) throw() : m_size(0) { }
+    ~Rope(void) throw() { clear(); }
+
+    /**
+     * @brief Przygotuj miejsce na len bajtow (np. z Content-Length).
+     * Gdy bufor jest pusty, pierwszy kawalek bedzie mial tyle miejsca
+     * ile trzeba, wiec cala strona bedzie ciagla.
+     */
+    bool reserve(size_t len) throw();
+
+    // Dopisz dane na koniec, false - brak pamieci
+    bool append(const char *buf, size_t len) throw();
+
+    void clear(void) throw();
+
+    size_t size(void) const { return m_size; }
+    bool empty(void) const { return m_size == 0; }
+
+    // Kawalki jeden po drugim (scatter/gather)
+    size_t spans(void) const { return m_slabs.size(); }
+    const char *span(size_t i, size_t &len) const
+    {
+      len = m_slabs[i].len;
+      return m_slabs[i].data;
+    }
+
+    /**
+     * @brief Wskaznik na calosc (zakonczona zerem) gdy dane sa w jednym
+     * kawalku, NULL w przeciwnym razie - nic nie kopiuje.
+     */
+    const char *contiguous(void) const throw();
+
+    /**
+     * @brief Calosc w jednym kawalku - w razie potrzeby skleja (jedna kopia).
+     * NULL - brak pamieci.
+     */
+    const char *flatten(void) throw();
+
+    /**
+     * Iterator dwukierunkowy po bajtach - nadaje sie dla boost::regex.
+     */
+    class const_iterator
+      : public std::iterator<std::bidirectional_iterator_tag, char, std::ptrdiff_t, const char *, const char &> {
+      public:
+        const_iterator(void) : r(NULL), s(0), o(0) { }
+        const_iterator(const Rope *r, size_t s, size_t o) : r(r), s(s), o(o) { }
+
+        const char &operator*(void) const { return r->m_slabs[s].data[o]; }
+        const char *operator->(void) const { return &r->m_slabs[s].data[o]; }
+
+        const_iterator &operator++(void)
+        {
+          if (++o == r->m_slabs[s].len) { o = 0; next(); }
+          return *this;
+        }
+        const_iterator operator++(int) { const_iterator t(*this); ++(*this); return t; }
+
+        const_iterator &operator--(void)
+        {
+          if (o == 0) {
+            do --s; while (r->m_slabs[s].len == 0);
+            o = r->m_slabs[s].len;
+          }
+          --o;
+          return *this;
+        }
+        const_iterator operator--(int) { const_iterator t(*this); --(*this); return t; }
+
+        bool operator==(const const_iterator &i) const { return s == i.s && o == i.o; }
+        bool operator!=(const const_iterator &i) const { return !(*this == i); }
+
+        // Pozycja od poczatku bufora
+        size_t offset(void) const;
+
+      private:
+        friend class Rope;
+        const Rope *r;
+        size_t s, o; // kawalek i przesuniecie w nim
+
+        void next(void) { ++s; while (s < r->m_slabs.size() && r->m_slabs[s].len == 0) ++s; }
+    };
+
+    const_iterator begin(void) const
+    {
+      const_iterator i(this, 0, 0);
+      if (!m_slabs.empty() && m_slabs[0].len == 0) i.next();
+      return i;
+    }
+    const_iterator end(void) const { return const_iterator(this, m_slabs.size(), 0); }
+    // Iterator na bajt o zadanej pozycji (<= size())
+    const_iterator at(size_t pos) const throw();
+
+  private:
+    Rope(const Rope &); /* non-copyable */
+
+    struct Slab {
+      char *data;
+      size_t len, cap; // cap bez bajtu na zero konczace
+    };
+
+    std::vector<Slab> m_slabs;
+    size_t m_size;
+
+    bool grow(size_t cap) throw();
+};
+
+#endif
+
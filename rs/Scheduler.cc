@@ -0,0 +1,221 @@
+/**
+ * @brief Odliczanie czasu dla wielu zadan - hierarchiczne kolo czasu.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/Scheduler.hh>
+#include <rs/Time.hh>
+
+#include <vector>
+
+Scheduler &Scheduler::instance(void)
+{
+  // Nigdy nie niszczony - jak Limiter, watek dziala do konca procesu
+  static Scheduler *scheduler = new Scheduler();
+  return *scheduler;
+}
+
+Scheduler::Scheduler(void) throw()
+  : m_tick(now()), m_next(1)
+{
+  memset(m_wheel, 0, sizeof(m_wheel));
+
+  pthread_attr_t pat;
+  int ret;
+
+  if ((ret = pthread_attr_init(&pat)) != 0)
+    throw EInternal("pthread_attr_init: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_create(&m_pth, &pat, Scheduler::s_thread_fn, this)) != 0)
+    throw EInternal("pthread_create: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_attr_destroy(&pat)) != 0)
+    throw EInternal("pthread_attr_destroy: %d, %s", ret, strerror(ret));
+}
+
+uint64_t Scheduler::now(void) throw()
+{
+  return Time::mono_msec() / TickMs;
+}
+
+// Wpis do przegrodki wedlug odleglosci od m_tick (wolane pod m_lock)
+void Scheduler::link(Node *n) throw()
+{
+  uint64_t e = n->expires;
+  if (e <= m_tick) e = m_tick + 1;
+
+  unsigned l = 0;
+  while (l + 1 < Levels && ((e - m_tick) >> (Bits*(l+1)))) ++l;
+
+  // Dalej niz siega kolo - na koniec najwyzszego poziomu, bedzie przenoszony
+  uint64_t max = ((uint64_t)1 << (Bits*Levels)) - 1;
+  if (e - m_tick > max) e = m_tick + max;
+
+  n->level = l;
+  n->slot = (e >> (Bits*l)) & (Slots - 1);
+
+  Node *&head = m_wheel[l][n->slot];
+  n->prev = NULL;
+  n->next = head;
+  if (head) head->prev = n;
+  head = n;
+}
+
+void Scheduler::unlink(Node *n) throw()
+{
+  if (n->prev) n->prev->next = n->next;
+  else m_wheel[n->level][n->slot] = n->next;
+  if (n->next) n->next->prev = n->prev;
+  n->prev = n->next = NULL;
+}
+
+// Poziom zatoczyl kolo - wpisy z przegrodki wyzej ida nizej
+void Scheduler::cascade(unsigned level) throw()
+{
+  if (level >= Levels) return;
+
+  unsigned idx = (m_tick >> (Bits*level)) & (Slots - 1);
+  if (!idx) cascade(level + 1);
+
+  Node *n = m_wheel[level][idx];
+  m_wheel[level][idx] = NULL;
+
+  while (n) {
+    Node *next = n->next;
+    link(n);
+    n = next;
+  }
+}
+
+// Najblizszy tick, w ktorym jest cos do zrobienia, 0 - nic
+uint64_t Scheduler::wakeup(void) const throw()
+{
+  if (m_nodes.empty()) return 0;
+
+  // Poziom 0 siega najdalej Slots tickow
+  for (unsigned i = 1; i < Slots; ++i)
+    if (m_wheel[0][(m_tick + i) & (Slots - 1)]) return m_tick + i;
+
+  // Przeniesienia - tylko gdy w przegrodce wyzej cos jest
+  uint64_t b = (m_tick | (Slots - 1)) + 1;
+  for (unsigned k = 0; k < Slots; ++k, b += Slots) {
+    for (unsigned l = 1; l < Levels; ++l) {
+      unsigned idx = (b >> (Bits*l)) & (Slots - 1);
+      if (m_wheel[l][idx]) return b;
+      if (idx) break;
+    }
+  }
+
+  return b; // i tak trzeba przejsc na nastepna przegrodke poziomu 2
+}
+
+Scheduler::Timer Scheduler::add(uint64_t ms, timer_fn fn, void *data) throw()
+{
+  Node *n = new Node;
+  n->fn = fn;
+  n->data = data;
+  // W gore - nie wczesniej niz za ms
+  n->expires = (Time::mono_msec() + ms + TickMs - 1) / TickMs;
+
+  Lock l(m_lock);
+  n->id = m_next++;
+  m_nodes[n->id] = n;
+  link(n);
+  m_cond.signal();
+
+  return n->id;
+}
+
+bool Scheduler::cancel(Timer t) throw()
+{
+  Node *n;
+  {
+    Lock l(m_lock);
+    Nodes::iterator it = m_nodes.find(t);
+    if (it == m_nodes.end()) return false;
+    n = it->second;
+    m_nodes.erase(it);
+    unlink(n);
+  }
+
+  delete n;
+  return true;
+}
+
+bool Scheduler::reschedule(Timer t, uint64_t ms) throw()
+{
+  Lock l(m_lock);
+  Nodes::iterator it = m_nodes.find(t);
+  if (it == m_nodes.end()) return false;
+
+  Node *n = it->second;
+  unlink(n);
+  n->expires = (Time::mono_msec() + ms + TickMs - 1) / TickMs;
+  link(n);
+  m_cond.signal();
+
+  return true;
+}
+
+uint64_t Scheduler::remaining(Timer t) throw()
+{
+  Lock l(m_lock);
+  Nodes::iterator it = m_nodes.find(t);
+  if (it == m_nodes.end()) return 0;
+
+  uint64_t at = it->second->expires * TickMs, now = Time::mono_msec();
+  return (at > now) ? at - now : 0;
+}
+
+size_t Scheduler::size(void) throw()
+{
+  Lock l(m_lock);
+  return m_nodes.size();
+}
+
+void *Scheduler::s_thread_fn(void *ptr)
+{
+  ((Scheduler*)ptr)->thread_fn();
+  return NULL;
+}
+
+void Scheduler::thread_fn(void) throw()
+{
+  std::vector<Node*> fired;
+
+  m_lock.lock();
+
+  while (true) {
+    uint64_t tick = now();
+
+    if (m_nodes.empty()) m_tick = tick; // nic nie czeka - bez przewijania
+
+    while (m_tick < tick) {
+      ++m_tick;
+
+      unsigned idx = m_tick & (Slots - 1);
+      if (!idx) cascade(1);
+
+      for (Node *n = m_wheel[0][idx]; n; n = n->next) {
+        m_nodes.erase(n->id);
+        fired.push_back(n);
+      }
+      m_wheel[0][idx] = NULL;
+    }
+
+    if (!fired.empty()) {
+      // Bez blokady - funkcje moga dodawac i anulowac
+      m_lock.unlock();
+      for (size_t i = 0; i < fired.size(); ++i) {
+        fired[i]->fn(fired[i]->data);
+        delete fired[i];
+      }
+      fired.clear();
+      m_lock.lock();
+      continue;
+    }
+
+    uint64_t at = wakeup();
+    if (at) m_cond.wait(m_lock, at * TickMs);
+    else m_cond.wait(m_lock);
+  }
+}
+
@@ -0,0 +1,86 @@
+/**
+ * @brief Odliczanie czasu dla wielu zadan - hierarchiczne kolo czasu.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_SCHEDULER_HH__
+#define __RS_SCHEDULER_HH__
+
+#include <stdint.h>
+#include <cstdlib>
+#include <tr1/unordered_map>
+
+#include <rs/Mutex.hh>
+#include <rs/Condition.hh>
+
+/**
+ * Klasa singleton z jednym watkiem. Czekajace zadanie to wpis w kole
+ * (Levels poziomow po Slots przegrodek, poziom n liczy w krokach
+ * TickMs * Slots^n), a nie watek. Dodanie, anulowanie i przesuniecie to
+ * O(1); wpisy z wyzszego poziomu sa przenoszone nizej, gdy nizszy poziom
+ * zatoczy kolo.
+ *
+ * Watek spi na zmiennej warunkowej (zegar monotoniczny) do najblizszej
+ * niepustej przegrodki albo do przeniesienia z wyzszego poziomu - bez
+ * budzenia co tick, a bez wpisow wcale.
+ *
+ * Funkcje sa wolane z watku Scheduler-a bez jego blokady (moga dodawac
+ * i anulowac), wiec nie powinny dlugo trwac.
+ */
+class Scheduler {
+  public:
+    static Scheduler &instance(void);
+
+    typedef uint64_t Timer; // 0 - brak
+    typedef void (*timer_fn)(void *data);
+
+    static const unsigned TickMs = 100;
+    static const unsigned Bits = 6;
+    static const unsigned Slots = 1 << Bits;
+    static const unsigned Levels = 4; // ~ 19 dni - dalej odliczane od konca kola
+
+    // Wywolaj fn(data) za ms milisekund
+    Timer add(uint64_t ms, timer_fn fn, void *data) throw();
+    // false - juz wywolany albo nie ma takiego
+    bool cancel(Timer t) throw();
+    // Przesun na za ms milisekund od teraz, false - jak wyzej
+    bool reschedule(Timer t, uint64_t ms) throw();
+    // Ile ms zostalo (0 - nie ma albo zaraz)
+    uint64_t remaining(Timer t) throw();
+
+    size_t size(void) throw();
+
+  private:
+    Scheduler(void) throw();
+    Scheduler(const Scheduler &);
+
+    struct Node {
+      Timer id;
+      uint64_t expires; // w tickach
+      timer_fn fn;
+      void *data;
+      Node *prev, *next;
+      unsigned level, slot;
+    };
+
+    typedef std::tr1::unordered_map<Timer, Node*> Nodes;
+
+    Mutex m_lock;
+    Condition m_cond;
+    Node *m_wheel[Levels][Slots];
+    Nodes m_nodes;
+    uint64_t m_tick;  // ostatni obsluzony tick
+    Timer m_next;
+    pthread_t m_pth;
+
+    static uint64_t now(void) throw();
+    void link(Node *n) throw();
+    void unlink(Node *n) throw();
+    void cascade(unsigned level) throw();
+    uint64_t wakeup(void) const throw();
+    void thread_fn(void) throw();
+    static void *s_thread_fn(void *);
+};
+
+#endif
+
@@ -0,0 +1,185 @@
+/**
+ * @brief Wyniki serwerow (mirrorow) - zmierzona predkosc, czas do
+ * pierwszego bajtu i awarie, pamietane miedzy uruchomieniami.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/Scoreboard.hh>
+#include <rs/Time.hh>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+Scoreboard &Scoreboard::instance(void)
+{
+  static Scoreboard scoreboard;
+  return scoreboard;
+}
+
+Scoreboard::Scoreboard(void) throw()
+  : m_explore(0.1), m_alpha(0.3), m_seed(Time::in_usec()) { }
+
+void Scoreboard::setPath(const std::string &path) throw()
+{
+  Lock l(m_lock);
+  m_path = path;
+  load();
+}
+
+bool Scoreboard::get(const std::string &name, Score &s) throw()
+{
+  Lock l(m_lock);
+  Scores::const_iterator it = m_scores.find(name);
+  if (it == m_scores.end()) return false;
+  s = it->second;
+  return true;
+}
+
+// Oczekiwany czas pobrania (sek), bez pomiarow predkosci - 0
+double Scoreboard::expected(const Score &s, uint64_t size) const throw()
+{
+  if (s.bps <= 0) return 0;
+  return s.ttfb/1000.0 + ((double)size)/s.bps;
+}
+
+namespace {
+  struct ByTime {
+    const std::vector<double> &t;
+    ByTime(const std::vector<double> &t) : t(t) { }
+    bool operator()(size_t a, size_t b) const { return t[a] < t[b]; }
+  };
+}
+
+void Scoreboard::rank(const std::vector<std::string> &names, uint64_t size,
+    std::vector<size_t> &order) throw()
+{
+  if (!size) size = 1000000; // rozmiar nieznany - porownujemy jak dla 1 MB
+
+  std::vector<double> t(names.size(), 0), fails(names.size(), 0);
+  std::vector<uint32_t> samples(names.size(), 0);
+  double known = 0;
+  unsigned nknown = 0;
+  double dice;
+
+  {
+    Lock l(m_lock);
+    for (size_t i = 0; i < names.size(); ++i) {
+      Scores::const_iterator it = m_scores.find(names[i]);
+      if (it == m_scores.end()) continue;
+      t[i] = expected(it->second, size);
+      fails[i] = it->second.fails;
+      samples[i] = it->second.samples;
+      if (t[i] > 0) { known += t[i]; ++nknown; }
+    }
+    dice = ((double)rand_r(&m_seed)) / RAND_MAX;
+  }
+
+  // Nieznane - jak srednia znanych; awarie wydluzaja czas (ponowienia)
+  double avg = nknown ? known/nknown : 1;
+  for (size_t i = 0; i < names.size(); ++i) {
+    if (t[i] <= 0) t[i] = avg;
+    t[i] /= std::max(1.0 - fails[i], 0.05);
+  }
+
+  order.clear();
+  for (size_t i = 0; i < names.size(); ++i) order.push_back(i);
+  // Rowne (np. bez pomiarow) zostaja w kolejnosci ulubionych
+  std::stable_sort(order.begin(), order.end(), ByTime(t));
+
+  if (order.size() < 2 || dice >= m_explore) return;
+
+  // Proba: najmniej sprawdzony z pozostalych idzie na poczatek
+  size_t pick = 1;
+  for (size_t i = 2; i < order.size(); ++i)
+    if (samples[order[i]] < samples[order[pick]]) pick = i;
+
+  size_t srv = order[pick];
+  order.erase(order.begin() + pick);
+  order.insert(order.begin(), srv);
+}
+
+void Scoreboard::success(const std::string &name, uint64_t bytes, uint64_t usecs, uint64_t ttfb) throw()
+{
+  if (!bytes || !usecs) return;
+
+  double bps = ((double)bytes) / ((double)usecs) * 1.0e6, ms = ttfb/1000.0;
+
+  Lock l(m_lock);
+  Score &s = m_scores[name]; // nowy - same zera
+
+  if (s.bps <= 0) { // pierwszy udany pomiar - bez usredniania z zerem
+    s.bps = bps;
+    s.ttfb = ms;
+  } else {
+    s.bps += m_alpha*(bps - s.bps);
+    s.ttfb += m_alpha*(ms - s.ttfb);
+  }
+  s.fails -= m_alpha*s.fails;
+  ++s.samples;
+  s.stamp = Time::in_sec();
+
+  save();
+}
+
+void Scoreboard::failure(const std::string &name) throw()
+{
+  Lock l(m_lock);
+  Score &s = m_scores[name];
+
+  s.fails += m_alpha*(1.0 - s.fails);
+  ++s.samples;
+  s.stamp = Time::in_sec();
+
+  save();
+}
+
+// Plik tekstowy, wiersz na serwer: nazwa<TAB>B/s<TAB>ttfb<TAB>awarie<TAB>pomiary<TAB>czas
+// (nazwy maja spacje, np. "Level(3) #2"). Wolane pod m_lock.
+void Scoreboard::load(void) throw()
+{
+  if (m_path.empty()) return;
+
+  FILE *f = fopen(m_path.c_str(), "r");
+  if (!f) return; // pierwsze uruchomienie
+
+  char line[512];
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#') continue;
+
+    char *tab = strchr(line, '\t');
+    if (!tab) continue;
+    *tab = '\0';
+
+    Score s;
+    unsigned samples, stamp;
+    if (sscanf(tab+1, "%lf\t%lf\t%lf\t%u\t%u", &s.bps, &s.ttfb, &s.fails, &samples, &stamp) != 5) 
+      continue;
+    s.samples = samples;
+    s.stamp = stamp;
+    m_scores[line] = s;
+  }
+
+  fclose(f);
+}
+
+// Calosc do pliku tymczasowego i przemianowanie - przerwany zapis nie
+// psuje poprzednich wynikow. Wolane pod m_lock.
+void Scoreboard::save(void) throw()
+{
+  if (m_path.empty()) return;
+
+  std::string tmp = m_path + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "w");
+  if (!f) return;
+
+  fprintf(f, "# serwer\tB/s\tttfb ms\tawarie\tpomiary\tczas\n");
+  for (Scores::const_iterator it = m_scores.begin(); it != m_scores.end(); ++it) {
+    const Score &s = it->second;
+    fprintf(f, "%s\t%.0f\t%.1f\t%.4f\t%u\t%u\n", it->first.c_str(), 
+        s.bps, s.ttfb, s.fails, (unsigned)s.samples, (unsigned)s.stamp);
+  }
+
+  if (fclose(f) == 0) rename(tmp.c_str(), m_path.c_str());
+}
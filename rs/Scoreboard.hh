@@ -0,0 +1,83 @@
+/**
+ * @brief Wyniki serwerow (mirrorow) - zmierzona predkosc, czas do
+ * pierwszego bajtu i awarie, pamietane miedzy uruchomieniami.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_SCOREBOARD_HH__
+#define __RS_SCOREBOARD_HH__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include <rs/Mutex.hh>
+
+/**
+ * Klasa singleton - wspolna dla wszystkich zadan. Po kazdym etapie 3
+ * zadanie zapisuje wynik serwera, z ktorego pobieralo (i awarie tych,
+ * z ktorych musialo uciec). Kazda wielkosc to srednia wykladnicza (EWMA),
+ * wiec stare pomiary wygasaja, a pojedyncza wpadka nie przekresla serwera.
+ *
+ * Serwery sa ukladane wedlug oczekiwanego czasu pobrania pliku danej
+ * wielkosci: ttfb + rozmiar / predkosc, z kara za awarie. Serwer bez
+ * pomiarow dostaje srednia znanych, a rowne wyniki zostaja w kolejnosci
+ * podanej (ulubione) - bez pomiarow wybor jest taki jak dotad. Co jakis
+ * czas (explore) na poczatek idzie inny serwer, najmniej sprawdzony, zeby
+ * pomiary nie utknely na pierwszym, ktory byl dobry.
+ */
+class Scoreboard {
+  public:
+    static Scoreboard &instance(void);
+
+    /**
+     * @brief Plik z wynikami: wczytaj teraz, zapisuj po kazdej zmianie.
+     * Pusta sciezka - tylko w pamieci.
+     */
+    void setPath(const std::string &path) throw();
+    // Jak czesto sprawdzac inny serwer (0 - nigdy), waga nowego pomiaru
+    void setExplore(double explore) throw() { m_explore = explore; }
+    void setAlpha(double alpha) throw() { m_alpha = alpha; }
+
+    /**
+     * @brief Kolejnosc serwerow (numery w names, od najlepszego) dla pliku
+     * o rozmiarze size B. names - w kolejnosci priorytetu (ulubione).
+     */
+    void rank(const std::vector<std::string> &names, uint64_t size,
+        std::vector<size_t> &order) throw();
+
+    // Pobieranie z serwera skonczone: bytes w usecs, pierwszy bajt po ttfb us
+    void success(const std::string &name, uint64_t bytes, uint64_t usecs, uint64_t ttfb) throw();
+    // Serwer stanal albo zwrocil blad
+    void failure(const std::string &name) throw();
+
+    struct Score {
+      double bps;      // predkosc (B/s), 0 - nie pobrano jeszcze nic
+      double ttfb;     // czas do pierwszego bajtu (ms)
+      double fails;    // udzial awarii (0..1)
+      uint32_t samples; // ile pomiarow (udanych i awarii)
+      uint32_t stamp;  // ostatni pomiar (Time::in_sec())
+    };
+
+    bool get(const std::string &name, Score &s) throw();
+
+  private:
+    Scoreboard(void) throw();
+    Scoreboard(const Scoreboard &);
+
+    typedef std::map<std::string, Score> Scores;
+
+    Mutex m_lock;
+    Scores m_scores;
+    std::string m_path;
+    double m_explore, m_alpha;
+    unsigned m_seed;
+
+    double expected(const Score &s, uint64_t size) const throw();
+    void load(void) throw();
+    void save(void) throw();
+};
+
+#endif
+
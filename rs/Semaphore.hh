@@ -30,6 +30,17 @@ class Semaphore {
           throw EInternal("Semaphore::p(): System error: %d, %s", errno, strerror(errno));
     }
 
+    // Bez czekania - false gdy semafor jest zerowy
+    bool tryp(void) throw()
+    {
+      while (sem_trywait(&sem))
+        if (EINTR != errno) {
+          if (EAGAIN == errno) return false;
+          throw EInternal("Semaphore::tryp(): System error: %d, %s", errno, strerror(errno));
+        }
+      return true;
+    }
+
     void v(void) throw()
     {
       if (sem_post(&sem)) 
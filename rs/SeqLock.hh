@@ -0,0 +1,72 @@
+/**
+ * @brief Seqlock - spojne odczyty struktury bez blokowania piszacego.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_SEQ_LOCK_HH__
+#define __RS_SEQ_LOCK_HH__
+
+#include <stdint.h>
+#include <cstring>
+#include <sched.h>
+
+/**
+ * Piszacy (jeden naraz) zmienia dane miedzy begin() i end() - licznik jest
+ * wtedy nieparzysty. Nigdy nie czeka, wiec mozna pisac z ujscia curl-a.
+ * Czytajacy kopiuje dane i sprawdza, czy licznik sie nie zmienil - jesli
+ * tak, probuje jeszcze raz. Czytajacych moze byc dowolnie wielu, nie
+ * zapisuja nic wspolnego.
+ *
+ * T - zwykla struktura (bez wskaznikow do wlasnych danych, np. std::string),
+ * bo jest kopiowana bajtami.
+ */
+template <typename T>
+class SeqLock {
+  public:
+    SeqLock(void) throw() : m_seq(0) { memset((void*)&m_data, 0, sizeof(m_data)); }
+
+    // Poczatek zmian (tylko piszacy)
+    T &begin(void) throw()
+    {
+      m_seq = m_seq + 1;
+      __sync_synchronize();
+      return m_data;
+    }
+
+    // Koniec zmian - czytajacy zobacza wszystko naraz
+    void end(void) throw()
+    {
+      __sync_synchronize();
+      m_seq = m_seq + 1;
+    }
+
+    // Dane bez kopiowania - tylko dla piszacego (nikt inny ich nie zmienia)
+    const T &get(void) const throw() { return m_data; }
+
+    // Spojna kopia danych (dowolny watek)
+    void read(T &out) const throw()
+    {
+      for (unsigned spins = 0; ; ++spins) {
+        uint32_t seq = m_seq;
+        __sync_synchronize();
+
+        if (!(seq & 1)) {
+          memcpy((void*)&out, (const void*)&m_data, sizeof(T));
+          __sync_synchronize();
+          if (m_seq == seq) return;
+        }
+
+        // Piszacy zostal wywlaszczony w srodku zmian - oddajmy mu procesor
+        if (spins > 64) sched_yield();
+      }
+    }
+
+  private:
+    SeqLock(const SeqLock &); /* non-copyable */
+
+    volatile uint32_t m_seq;
+    T m_data;
+};
+
+#endif
+
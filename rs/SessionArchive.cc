@@ -0,0 +1,357 @@
+/**
+ * @brief Archiwum sesji - strony i naglowki wszystkich etapow dopisywane
+ * do jednego pliku zamiast tysiecy malych.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/SessionArchive.hh>
+#include <rs/Rope.hh>
+#include <rs/Time.hh>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static bool write_all(int fd, const char *buf, size_t len) throw()
+{
+  size_t done = 0;
+
+  while (done < len) {
+    ssize_t wr = write(fd, buf+done, len-done);
+    if (wr < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      return false;
+    }
+    done += wr;
+  }
+
+  return true;
+}
+
+SessionArchive &SessionArchive::instance(void)
+{
+  // Nigdy nie niszczony - watek zapisujacy dziala do konca procesu
+  static SessionArchive *archive = new SessionArchive();
+  return *archive;
+}
+
+SessionArchive::SessionArchive(void) throw()
+  : m_queued(0), m_added(0), m_written(0), m_dropped(0), m_flush(false),
+  m_running(false), m_delay(100), m_segment(DefSegment), m_keep(0),
+  m_first(0), m_seg(0), m_data(-1), m_idx(-1), m_size(0) { }
+
+std::string SessionArchive::path(const std::string &dir, unsigned seg, bool idx)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/sessions.%06u%s", seg, idx ? ".idx" : "");
+  return dir + name;
+}
+
+// Numery segmentow w katalogu, rosnaco
+void SessionArchive::segments(const std::string &dir, std::vector<unsigned> &out) throw()
+{
+  out.clear();
+
+  DIR *d = opendir(dir.c_str());
+  if (!d) return;
+
+  while (struct dirent *e = readdir(d)) {
+    unsigned seg;
+    char rest;
+    // Tylko "sessions.NNNNNN" - bez ".idx" i innych
+    if (sscanf(e->d_name, "sessions.%u%c", &seg, &rest) == 1) out.push_back(seg);
+  }
+
+  closedir(d);
+  std::sort(out.begin(), out.end());
+}
+
+void SessionArchive::open(const std::string &dir, off_t segment, unsigned keep) throw()
+{
+  Lock l(m_lock);
+
+  if (m_running) return; // watek juz pisze - katalogu nie zmieniamy
+
+  m_dir = dir;
+  m_segment = segment > 0 ? segment : (off_t)DefSegment;
+  m_keep = keep;
+
+  std::vector<unsigned> segs;
+  segments(m_dir, segs);
+  m_first = segs.empty() ? 1 : segs.front();
+  m_seg = segs.empty() ? 0 : segs.back() - 1; // rotate() dopisze do ostatniego
+
+  pthread_t pth;
+  pthread_attr_t pat;
+  int ret;
+
+  if ((ret = pthread_attr_init(&pat)) != 0)
+    throw EInternal("pthread_attr_init: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_attr_setdetachstate(&pat, PTHREAD_CREATE_DETACHED)) != 0)
+    throw EInternal("pthread_attr_setdetachstate: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_create(&pth, &pat, SessionArchive::s_thread_fn, this)) != 0)
+    throw EInternal("pthread_create: %d, %s", ret, strerror(ret));
+  if ((ret = pthread_attr_destroy(&pat)) != 0)
+    throw EInternal("pthread_attr_destroy: %d, %s", ret, strerror(ret));
+
+  m_running = true;
+}
+
+void SessionArchive::add(const std::string &url, unsigned stage, Part part, const char *buf, size_t len) throw()
+{
+  Pending p;
+  p.url = url;
+  p.stage = stage;
+  p.part = part;
+  p.stamp = Time::in_sec();
+
+  Lock l(m_lock);
+  if (!m_running || m_queued + len > MaxPending) { ++m_dropped; return; }
+
+  m_queue.push_back(p);
+  m_queue.back().data.assign(buf, len); // bez kopiowania calego Pending
+  m_queued += len;
+  ++m_added;
+
+  if (m_queue.size() == 1 || m_queued >= MaxPending/4) m_work.signal();
+}
+
+void SessionArchive::add(const std::string &url, unsigned stage, Part part, const Rope &data) throw()
+{
+  if (data.spans() <= 1) {
+    size_t len = 0;
+    const char *buf = data.spans() ? data.span(0, len) : "";
+    add(url, stage, part, buf, len);
+    return;
+  }
+
+  std::string flat;
+  flat.reserve(data.size());
+  for (size_t i = 0, len; i < data.spans(); ++i) {
+    const char *span = data.span(i, len);
+    flat.append(span, len);
+  }
+  add(url, stage, part, flat.data(), flat.size());
+}
+
+void SessionArchive::flush(void) throw()
+{
+  Lock l(m_lock);
+  if (!m_running) return;
+
+  uint64_t want = m_added;
+  m_flush = true;
+  m_work.signal();
+  while (m_written < want) m_done.wait(m_lock);
+  m_flush = false;
+}
+
+uint64_t SessionArchive::dropped(void) throw()
+{
+  Lock l(m_lock);
+  return m_dropped;
+}
+
+void SessionArchive::close(void) throw()
+{
+  if (m_data >= 0) ::close(m_data);
+  if (m_idx >= 0) ::close(m_idx);
+  m_data = m_idx = -1;
+}
+
+// Nastepny segment (albo pierwszy po open - dopisujemy do ostatniego)
+bool SessionArchive::rotate(void) throw()
+{
+  close();
+  ++m_seg;
+
+  if (!reopen()) {
+    close();
+    --m_seg; // nastepna grupa sprobuje jeszcze raz ten sam
+    return false;
+  }
+
+  // Najstarsze ponad keep
+  while (m_keep && m_first + m_keep <= m_seg) {
+    unlink(path(m_dir, m_first, true).c_str());
+    unlink(path(m_dir, m_first, false).c_str());
+    ++m_first;
+  }
+
+  return true;
+}
+
+bool SessionArchive::reopen(void) throw()
+{
+  std::string dpath = path(m_dir, m_seg, false), ipath = path(m_dir, m_seg, true);
+
+  m_data = ::open(dpath.c_str(), O_WRONLY|O_APPEND|O_CREAT, 0644);
+  m_idx = ::open(ipath.c_str(), O_RDWR|O_APPEND|O_CREAT, 0644);
+  if (m_data < 0 || m_idx < 0) return false;
+
+  struct stat st;
+  if (fstat(m_data, &st)) return false;
+  m_size = st.st_size;
+
+  if (fstat(m_idx, &st)) return false;
+  if (st.st_size == 0) return write_all(m_idx, "RSA 1\n", 6);
+
+  // Urwana ostatnia linia - ucinamy, inaczej skleilaby sie z nastepna
+  off_t end = st.st_size;
+  char c;
+  while (end > 0 && pread(m_idx, &c, 1, end - 1) == 1 && c != '\n') --end;
+  if (end < st.st_size && ftruncate(m_idx, end)) return false;
+
+  return true;
+}
+
+// Zapis grupy wpisow, zwraca ile zgubiono (bez m_lock)
+size_t SessionArchive::commit(std::deque<Pending> &batch) throw()
+{
+  size_t lost = 0, i = 0;
+
+  while (i < batch.size()) {
+    if ((m_data < 0 || m_size >= m_segment) && !rotate()) {
+      lost += batch.size() - i;
+      break;
+    }
+
+    // Wpisy do konca segmentu: dane razem, potem ich linie indeksu
+    std::string data, index;
+    size_t j = i;
+    off_t pos = m_size;
+
+    while (j < batch.size() && (j == i || pos < m_segment)) {
+      const Pending &p = batch[j];
+      char line[128];
+      snprintf(line, sizeof(line), "%u %u %c %lld %llu ", p.stamp, p.stage, p.part,
+          (long long)pos, (unsigned long long)p.data.size());
+      index += line;
+      index += p.url;
+      index += '\n';
+      data += p.data;
+      pos += p.data.size();
+      ++j;
+    }
+
+    if (!write_all(m_data, data.data(), data.size()) || fdatasync(m_data) ||
+        !write_all(m_idx, index.data(), index.size()) || fdatasync(m_idx)) {
+      close(); // przy nastepnej grupie od nowa (ucinajac urwana linie)
+      --m_seg;
+      lost += j - i;
+    } else {
+      m_size = pos;
+    }
+
+    i = j;
+  }
+
+  return lost;
+}
+
+void *SessionArchive::s_thread_fn(void *ptr)
+{
+  ((SessionArchive*)ptr)->thread_fn();
+  return NULL;
+}
+
+void SessionArchive::thread_fn(void) throw()
+{
+  std::deque<Pending> batch;
+
+  m_lock.lock();
+
+  while (true) {
+    while (m_queue.empty()) m_work.wait(m_lock);
+
+    // Chwila na kolejne wpisy - jeden fdatasync dla calej grupy
+    uint64_t until = Time::mono_msec() + m_delay;
+    while (!m_flush && m_queued < MaxPending/4 && m_work.wait(m_lock, until)) ;
+
+    batch.swap(m_queue);
+    m_queued = 0;
+    uint64_t upto = m_written + batch.size();
+
+    m_lock.unlock();
+    size_t lost = commit(batch);
+    batch.clear();
+    m_lock.lock();
+
+    m_dropped += lost;
+    m_written = upto;
+    m_done.broadcast();
+  }
+}
+
+void SessionArchive::list(const std::string &dir, std::vector<Record> &out) throw()
+{
+  out.clear();
+
+  std::vector<unsigned> segs;
+  segments(dir, segs);
+
+  for (size_t s = 0; s < segs.size(); ++s) {
+    struct stat st;
+    if (stat(path(dir, segs[s], false).c_str(), &st)) continue;
+
+    FILE *f = fopen(path(dir, segs[s], true).c_str(), "r");
+    if (!f) continue;
+
+    char line[2048];
+    if (fgets(line, sizeof(line), f) && !strncmp(line, "RSA 1\n", 6)) {
+      while (fgets(line, sizeof(line), f)) {
+        char *nl = strchr(line, '\n');
+        if (!nl) break; // urwana linia
+        *nl = '\0';
+
+        Record r;
+        unsigned stamp, stage;
+        char part;
+        long long offset;
+        unsigned long long length;
+        int url;
+
+        if (sscanf(line, "%u %u %c %lld %llu %n", &stamp, &stage, &part, &offset, &length, &url) != 5)
+          continue;
+        if (offset < 0 || offset + (long long)length > (long long)st.st_size) continue;
+
+        r.stamp = stamp;
+        r.segment = segs[s];
+        r.stage = stage;
+        r.part = part;
+        r.offset = offset;
+        r.length = length;
+        r.url = line + url;
+        out.push_back(r);
+      }
+    }
+
+    fclose(f);
+  }
+}
+
+bool SessionArchive::read(const std::string &dir, const Record &r, std::string &data) throw()
+{
+  int fd = ::open(path(dir, r.segment, false).c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  data.resize(r.length);
+  size_t done = 0;
+
+  while (done < r.length) {
+    ssize_t rd = pread(fd, &data[0] + done, r.length - done, r.offset + done);
+    if (rd < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (rd <= 0) break;
+    done += rd;
+  }
+
+  ::close(fd);
+  return done == r.length;
+}
+
@@ -0,0 +1,127 @@
+/**
+ * @brief Archiwum sesji - strony i naglowki wszystkich etapow dopisywane
+ * do jednego pliku zamiast tysiecy malych.
+ * @author Piotr Truszkowski
+ */
+
+#ifndef __RS_SESSION_ARCHIVE_HH__
+#define __RS_SESSION_ARCHIVE_HH__
+
+#ifndef _FILE_OFFSET_BITS
+# define _FILE_OFFSET_BITS 64
+#elif _FILE_OFFSET_BITS != 64
+# error "_FILE_OFFSET_BITS != 64"
+#endif
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <rs/Mutex.hh>
+#include <rs/Condition.hh>
+
+class Rope;
+
+/**
+ * Katalog z segmentami "sessions.NNNNNN" (dane, tylko dopisywane) i ich
+ * indeksami "sessions.NNNNNN.idx" - plik tekstowy: "RSA 1", potem linia
+ * "<czas> <etap> <h|b> <przesuniecie> <dlugosc> <url>" na kazdy wpis.
+ * Urwana ostatnia linia (np. po padzie) jest pomijana.
+ *
+ * Klasa singleton z jednym watkiem. add() tylko kopiuje dane do kolejki,
+ * watek zbiera wpisy przez chwile (setDelay) i zapisuje je razem: dane
+ * jednym write, fdatasync, linie indeksu, fdatasync - indeks nigdy nie
+ * wskazuje danych, ktorych nie ma na dysku. Gdy segment przekroczy
+ * zadany rozmiar, zaczynany jest nastepny, a najstarsze ponad keep sa
+ * kasowane.
+ *
+ * Odczyt (list, read) jest statyczny - nie potrzebuje watku ani open(),
+ * moze isc z innego procesu.
+ */
+class SessionArchive {
+  public:
+    static SessionArchive &instance(void);
+
+    enum Part { Head = 'h', Body = 'b' };
+
+    static const off_t DefSegment = 64*1024*1024;
+    static const size_t MaxPending = 16*1024*1024; // wiecej w kolejce - wpisy gubione
+
+    /**
+     * @brief Pisz do katalogu dir (musi istniec), dopisujac do ostatniego
+     * segmentu. segment - rozmiar, po ktorym zaczac nastepny, keep - ile
+     * segmentow trzymac (0 - wszystkie).
+     */
+    void open(const std::string &dir, off_t segment = DefSegment, unsigned keep = 0) throw();
+
+    // Skopiuj dane do kolejki zapisu (nie czeka na dysk)
+    void add(const std::string &url, unsigned stage, Part part, const char *buf, size_t len) throw();
+    void add(const std::string &url, unsigned stage, Part part, const Rope &data) throw();
+
+    // Poczekaj, az wszystko dodane do teraz bedzie na dysku
+    void flush(void) throw();
+
+    // Jak dlugo zbierac wpisy przed zapisem (ms)
+    void setDelay(unsigned ms) throw() { m_delay = ms; }
+
+    // Ile wpisow zgubiono (pelna kolejka albo blad zapisu)
+    uint64_t dropped(void) throw();
+
+    struct Record {
+      uint32_t stamp;   // Time::in_sec()
+      unsigned segment; // numer segmentu
+      unsigned stage;
+      char part;        // Head albo Body
+      off_t offset;
+      size_t length;
+      std::string url;
+    };
+
+    // Wszystkie wpisy z katalogu, od najstarszych
+    static void list(const std::string &dir, std::vector<Record> &out) throw();
+    // Dane wpisu, false - nie da sie przeczytac
+    static bool read(const std::string &dir, const Record &r, std::string &data) throw();
+
+  private:
+    SessionArchive(void) throw();
+    SessionArchive(const SessionArchive &);
+
+    struct Pending {
+      std::string url;
+      unsigned stage;
+      char part;
+      uint32_t stamp;
+      std::string data;
+    };
+
+    Mutex m_lock;
+    Condition m_work, m_done;
+    std::deque<Pending> m_queue;
+    size_t m_queued;             // bajty w m_queue
+    uint64_t m_added, m_written; // licznik wpisow: dodane, zapisane (albo zgubione)
+    uint64_t m_dropped;
+    bool m_flush, m_running;
+    unsigned m_delay;
+
+    // Tylko watek zapisujacy (i open przed jego startem)
+    std::string m_dir;
+    off_t m_segment;
+    unsigned m_keep;
+    unsigned m_first, m_seg;   // najstarszy i biezacy segment
+    int m_data, m_idx;
+    off_t m_size;              // rozmiar biezacego segmentu
+
+    static std::string path(const std::string &dir, unsigned seg, bool idx);
+    static void segments(const std::string &dir, std::vector<unsigned> &out) throw();
+    bool rotate(void) throw();
+    bool reopen(void) throw();
+    void close(void) throw();
+    size_t commit(std::deque<Pending> &batch) throw();
+    void thread_fn(void) throw();
+    static void *s_thread_fn(void *);
+};
+
+#endif
+
@@ -47,9 +47,18 @@ class Time {
       return ((uint64_t)tv.tv_sec)*1000000ULL + ((uint64_t)tv.tv_usec);
     }
 
+    // Zegar monotoniczny - nie cofa sie przy zmianie czasu systemowego
+    static uint64_t mono_msec(void) throw()
+    {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ((uint64_t)ts.tv_sec)*1000ULL + ((uint64_t)ts.tv_nsec)/1000000ULL;
+    }
+
     static const char *stamp(void) throw()
     {
-      static char buf[stamp_length+1];
+      // Osobny bufor dla kazdego watku - zadania puli pisza logi naraz
+      static __thread char buf[stamp_length+1];
       return stamp(buf);
     }
 
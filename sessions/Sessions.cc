@@ -0,0 +1,106 @@
+/**
+ * @brief Przegladanie archiwum sesji (SessionArchive) - lista wpisow i
+ * wyciaganie stron i naglowkow.
+ * @author Piotr Truszkowski
+ */
+
+#include <rs/SessionArchive.hh>
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <unistd.h>
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+      "Uzycie: %s [opcje]\n"
+      "  -d KAT   katalog archiwum (./s/)\n"
+      "  -u TEKST tylko wpisy, ktorych url zawiera TEKST\n"
+      "  -s N     tylko etap N (1, 2, 3)\n"
+      "  -p h|b   tylko naglowki (h) albo strony (b)\n"
+      "  -x       wypisz dane wpisow na stdout (zamiast listy)\n"
+      "  -o KAT   zapisz wpisy jako pliki <nazwa>-<head|body>-<etap>.html\n", prog);
+  exit(1);
+}
+
+static const char *name_of(const std::string &url)
+{
+  const char *s = strrchr(url.c_str(), '/');
+  return s ? s + 1 : url.c_str();
+}
+
+int main(int argc, char **argv)
+{
+  std::string dir = "./s/", url, out;
+  unsigned stage = 0;
+  char part = 0;
+  bool extract = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:u:s:p:xo:h")) != -1) {
+    switch (opt) {
+      case 'd': dir = optarg; break;
+      case 'u': url = optarg; break;
+      case 's': stage = strtoul(optarg, NULL, 10); break;
+      case 'p': part = optarg[0]; break;
+      case 'x': extract = true; break;
+      case 'o': out = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if (part && part != SessionArchive::Head && part != SessionArchive::Body) usage(argv[0]);
+
+  std::vector<SessionArchive::Record> recs;
+  SessionArchive::list(dir, recs);
+
+  size_t shown = 0;
+
+  for (size_t i = 0; i < recs.size(); ++i) {
+    const SessionArchive::Record &r = recs[i];
+
+    if (!url.empty() && r.url.find(url) == std::string::npos) continue;
+    if (stage && r.stage != stage) continue;
+    if (part && r.part != part) continue;
+    ++shown;
+
+    if (!extract && out.empty()) {
+      char when[32];
+      time_t t = r.stamp;
+      struct tm lt;
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &lt));
+      printf("%s %u %s %8llu %s (%06u@%lld)\n", when, r.stage, 
+          r.part == SessionArchive::Head ? "head" : "body", 
+          (unsigned long long)r.length, r.url.c_str(), r.segment, (long long)r.offset);
+      continue;
+    }
+
+    std::string data;
+    if (!SessionArchive::read(dir, r, data)) {
+      fprintf(stderr, "Nie moge przeczytac wpisu %06u@%lld\n", r.segment, (long long)r.offset);
+      continue;
+    }
+
+    if (extract) fwrite(data.data(), 1, data.size(), stdout);
+
+    if (!out.empty()) {
+      char path[1024];
+      snprintf(path, sizeof(path), "%s/%s-%s-%u.html", out.c_str(), name_of(r.url),
+          r.part == SessionArchive::Head ? "head" : "body", r.stage);
+      FILE *f = fopen(path, "w");
+      if (!f || fwrite(data.data(), 1, data.size(), f) != data.size())
+        fprintf(stderr, "Nie moge zapisac '%s'\n", path);
+      if (f) fclose(f);
+    }
+  }
+
+  if (!extract && out.empty()) fprintf(stderr, "Wpisow: %llu z %llu\n", 
+      (unsigned long long)shown, (unsigned long long)recs.size());
+
+  return 0;
+}
@@ -0,0 +1,727 @@
+/**
+ * @brief Sprawdzenie czesci biblioteki, ktore da sie sprawdzic bez sieci.
+ * @author Piotr Truszkowski
+ *
+ * HttpSegments - z lokalnym serwerem (fork) z jednym powolnym zakresem:
+ * poczatkowy podzial, przejecie czesci powolnego kawalka i zawartosc pliku.
+ * Journal - scalanie zakresow, urwana linia, zgodnosc z plikiem danych i
+ * wersja.
+ * Rope - iteracja tam i z powrotem przez puste kawalki.
+ * HttpHeaders - dopisywanie linia po linii, kilka odpowiedzi po kolei.
+ * CookieJar - domeny, sciezki, Secure i wygasanie.
+ * Digest - ze znanymi wynikami i ze sklejaniem (combine).
+ * Matcher - z wyszukiwaniem naiwnym na losowych zestawach wzorcow i ze
+ * skanowaniem tego samego tekstu w dwoch kawalkach.
+ * Scheduler - czy kazdy termin przychodzi, nie za wczesnie i tylko raz.
+ * RetryPolicy::fit - z przeszukaniem po kolei na malych liczbach.
+ * Wynik: liczba bledow (0 - wszystko dobrze).
+ */
+
+#include <rs/HttpSegments.hh>
+#include <rs/Journal.hh>
+#include <rs/Rope.hh>
+#include <rs/HttpHeaders.hh>
+#include <rs/CookieJar.hh>
+#include <rs/Digest.hh>
+#include <rs/Matcher.hh>
+#include <rs/Scheduler.hh>
+#include <rs/Time.hh>
+#include <rs/RetryPolicy.hh>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static unsigned Failed = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+      ++Failed; \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+      fprintf(stderr, __VA_ARGS__); \
+      fprintf(stderr, "\n"); \
+    } \
+  } while (0)
+
+static unsigned s_seed = 1;
+
+static unsigned rnd(unsigned n) { return rand_r(&s_seed) % n; }
+
+// Male alfabety - duzo nakladajacych sie wzorcow i sufiksow
+static std::string random_text(size_t len, unsigned letters)
+{
+  std::string s(len, 'a');
+  for (size_t i = 0; i < len; ++i) s[i] = 'a' + rnd(letters);
+  return s;
+}
+
+static std::string temp_path(const char *name)
+{
+  char buf[256];
+  snprintf(buf, sizeof(buf), "/tmp/rs-tests.%d.%s", (int)getpid(), name);
+  return buf;
+}
+
+/*** HttpSegments ***/
+
+static const off_t SegSize = 16*HttpSegments::MinSegment;
+
+static bool send_all(int fd, const char *buf, size_t len)
+{
+  while (len) {
+    ssize_t wr = send(fd, buf, len, MSG_NOSIGNAL);
+    if (wr <= 0) return false;
+    buf += wr;
+    len -= wr;
+  }
+  return true;
+}
+
+// Jedno zadanie na polaczenie. Tresc: bajt i to i % 251. Zakres od zera
+// (pierwszy kawalek) idzie powoli, zeby reszta miala co przejac.
+static void respond(int fd, const char *log)
+{
+  std::string req;
+  char buf[4096];
+
+  while (req.find("\r\n\r\n") == std::string::npos) {
+    ssize_t rd = read(fd, buf, sizeof(buf));
+    if (rd <= 0) return;
+    req.append(buf, rd);
+  }
+
+  bool head = req.compare(0, 5, "HEAD ") == 0;
+  long long from = 0, to = SegSize - 1;
+  const char *range = strcasestr(req.c_str(), "\r\nRange: bytes=");
+  bool ranged = range && sscanf(range + 15, "%lld-%lld", &from, &to) == 2 &&
+    from <= to && to < SegSize;
+
+  int lfd = open(log, O_WRONLY|O_APPEND|O_CREAT, 0644);
+  int n = snprintf(buf, sizeof(buf), "%s %lld %lld\n", head ? "HEAD" : ranged ? "RANGE" : "ALL", from, to);
+  if (lfd >= 0 && write(lfd, buf, n) != n) { }
+  if (lfd >= 0) close(lfd);
+
+  if (ranged)
+    n = snprintf(buf, sizeof(buf), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%lld\r\n",
+        from, to, (long long)SegSize);
+  else {
+    from = 0;
+    to = SegSize - 1;
+    n = snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\n");
+  }
+  n += snprintf(buf + n, sizeof(buf) - n,
+      "Content-Length: %lld\r\nAccept-Ranges: bytes\r\nConnection: close\r\n\r\n", to - from + 1);
+  if (!send_all(fd, buf, n) || head) return;
+
+  bool slow = ranged && from == 0 && to > 0;
+  for (long long pos = from; pos <= to; ) {
+    size_t len = 0;
+    while (len < sizeof(buf) && pos <= to) buf[len++] = (char)(pos++ % 251);
+    if (!send_all(fd, buf, len)) return;
+    if (slow) usleep(5000);
+  }
+}
+
+static void serve(int ls, const char *log)
+{
+  signal(SIGCHLD, SIG_IGN);
+
+  for (;;) {
+    int fd = accept(ls, NULL, NULL);
+    if (fd < 0) continue;
+    if (fork() == 0) {
+      close(ls);
+      respond(fd, log);
+      close(fd);
+      _exit(0);
+    }
+    close(fd);
+  }
+}
+
+static void check_segments(void)
+{
+  std::string path = temp_path("segments"), log = temp_path("segments.log");
+
+  int ls = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in sa;
+  socklen_t salen = sizeof(sa);
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (ls < 0 || bind(ls, (struct sockaddr*)&sa, sizeof(sa)) || listen(ls, 16) ||
+      getsockname(ls, (struct sockaddr*)&sa, &salen)) {
+    CHECK(false, "HttpSegments: nie ma gniazda na serwer");
+    if (ls >= 0) close(ls);
+    return;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    setpgid(0, 0); // razem z procesami polaczen do zabicia na koniec
+    serve(ls, log.c_str());
+  }
+  close(ls);
+
+  char url[64];
+  snprintf(url, sizeof(url), "http://127.0.0.1:%d/file", ntohs(sa.sin_port));
+  unsetenv("http_proxy");
+
+  off_t got;
+  {
+    HttpSegments hs;
+    got = hs.get(path.c_str(), url, NULL, NULL, 4);
+    CHECK(got == SegSize, "HttpSegments::get: %lld zamiast %lld (%s)",
+        (long long)got, (long long)SegSize, hs.error());
+  }
+
+  kill(-pid, SIGKILL);
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+
+  FILE *f = fopen(path.c_str(), "r");
+  off_t bad = -1, pos = 0;
+  for (int c; f && (c = getc(f)) != EOF; ++pos)
+    if (bad < 0 && (char)c != (char)(pos % 251)) bad = pos;
+  if (f) fclose(f);
+  CHECK(pos == SegSize && bad < 0, "HttpSegments: plik ma %lld bajtow, pierwszy zly %lld",
+      (long long)pos, (long long)bad);
+
+  // Cztery rowne kawalki na poczatek, potem przejecia od srodka reszty
+  std::vector<off_t> starts;
+  unsigned stolen = 0;
+  f = fopen(log.c_str(), "r");
+  char kind[16];
+  long long from, to;
+  while (f && fscanf(f, "%15s %lld %lld", kind, &from, &to) == 3) {
+    if (strcmp(kind, "RANGE") || from == to) continue;
+    if (from % (SegSize/4) == 0) starts.push_back(from);
+    else ++stolen;
+  }
+  if (f) fclose(f);
+
+  std::sort(starts.begin(), starts.end());
+  CHECK(starts.size() == 4 && starts[0] == 0 && starts[3] == 3*SegSize/4,
+      "HttpSegments: %zu zakresow poczatkowych zamiast 4", starts.size());
+  CHECK(stolen > 0, "HttpSegments: nic nie przejeto od powolnego kawalka");
+
+  unlink(path.c_str());
+  unlink(log.c_str());
+}
+
+/*** Journal ***/
+
+static bool ranges_are(const std::vector<Journal::Range> &v, const off_t *want, size_t n)
+{
+  if (v.size() != n/2) return false;
+  for (size_t i = 0; i < v.size(); ++i)
+    if (v[i].first != want[2*i] || v[i].second != want[2*i+1]) return false;
+  return true;
+}
+
+static bool resize(const std::string &path, off_t size)
+{
+  int fd = open(path.c_str(), O_WRONLY|O_CREAT, 0644);
+  bool ok = fd >= 0 && !ftruncate(fd, size);
+  if (fd >= 0) close(fd);
+  return ok;
+}
+
+static void check_journal(void)
+{
+  std::string path = temp_path("journal"), data = temp_path("part");
+  const std::string v1 = "\"etag-1\"", v2 = "Tue, 01 Jan 2030 00:00:00 GMT";
+  Journal j;
+
+  Journal::remove(path.c_str());
+  unlink(data.c_str());
+
+  // Pliku danych nie ma - dziennik nic nie znaczy
+  CHECK(!j.open(path.c_str(), 1000, v1, data.c_str()), "Journal: open bez pliku danych");
+  j.close();
+  Journal::remove(path.c_str());
+  CHECK(resize(data, 1000), "Journal: nie ma pliku danych");
+
+  CHECK(!j.open(path.c_str(), 1000, v1, data.c_str()), "Journal: open nowego dziennika");
+  CHECK(j.ranges().empty() && j.done() == 0, "Journal: nowy dziennik nie jest pusty");
+
+  CHECK(j.add(0, 100) && j.add(200, 300) && j.add(100, 200) && j.add(500, 600),
+      "Journal::add");
+  static const off_t merged[] = { 0, 300, 500, 600 }, gaps[] = { 300, 500, 600, 1000 };
+  CHECK(ranges_are(j.ranges(), merged, 4), "Journal: zle scalone zakresy");
+  CHECK(ranges_are(j.missing(), gaps, 4), "Journal::missing");
+  CHECK(j.done() == 400, "Journal::done: %lld zamiast 400", (long long)j.done());
+  j.close();
+
+  // Urwana ostatnia linia (pad w trakcie zapisu) jest pomijana
+  FILE *f = fopen(path.c_str(), "a");
+  if (f) { fputs("700 8", f); fclose(f); }
+
+  CHECK(j.open(path.c_str(), 1000, v1, data.c_str()), "Journal: ponowne open");
+  CHECK(ranges_are(j.ranges(), merged, 4), "Journal: po ponownym open inne zakresy");
+  j.close();
+
+  // Inny rozmiar - od zera, a stary dziennik juz nie wraca
+  CHECK(!j.open(path.c_str(), 2000, v1, data.c_str()) && j.ranges().empty(),
+      "Journal: open z innym rozmiarem");
+  j.close();
+  CHECK(!j.open(path.c_str(), 1000, v1, data.c_str()) && j.ranges().empty(),
+      "Journal: dziennik nie zaczety od nowa");
+  CHECK(j.add(0, 100), "Journal::add");
+  j.close();
+
+  // Plik danych innego rozmiaru albo inna wersja na serwerze - tez od zera
+  CHECK(resize(data, 999), "Journal: nie da sie skrocic pliku danych");
+  CHECK(!j.open(path.c_str(), 1000, v1, data.c_str()) && j.ranges().empty(),
+      "Journal: open z plikiem danych innego rozmiaru");
+  CHECK(resize(data, 1000), "Journal: nie da sie wydluzyc pliku danych");
+  CHECK(j.add(10, 20), "Journal::add");
+  j.close();
+  CHECK(!j.open(path.c_str(), 1000, v2, data.c_str()) && j.ranges().empty(),
+      "Journal: open z inna wersja");
+  CHECK(j.add(10, 20), "Journal::add");
+  j.close();
+  CHECK(j.open(path.c_str(), 1000, v2, data.c_str()) && j.done() == 10,
+      "Journal: wersja z dziennika nie pasuje do zapisanej");
+  j.close();
+
+  Journal::remove(path.c_str());
+  unlink(data.c_str());
+}
+
+/*** Rope ***/
+
+static void check_rope(unsigned rounds)
+{
+  for (unsigned r = 0; r < rounds; ++r) {
+    Rope rope;
+    std::string want;
+
+    // reserve(0) na pustym - pusty pierwszy kawalek, reserve bez dopisania -
+    // pusty ostatni
+    if (rnd(2)) rope.reserve(0);
+    for (unsigned n = rnd(6); n; --n) {
+      if (rnd(3)) {
+        std::string s = random_text(rnd(3*Rope::SlabSize/2), 26);
+        rope.append(s.data(), s.size());
+        want += s;
+      } else rope.reserve(rnd(1000));
+    }
+    if (rnd(2)) rope.reserve(1 + rnd(1000));
+
+    CHECK(rope.size() == want.size(), "Rope: rozmiar %zu zamiast %zu", rope.size(), want.size());
+
+    std::string fwd(rope.begin(), rope.end());
+    CHECK(fwd == want, "Rope: runda %u, do przodu inna tresc (%zu bajtow, %zu kawalkow)",
+        r, fwd.size(), rope.spans());
+
+    std::string back;
+    for (Rope::const_iterator i = rope.end(); i != rope.begin(); ) back += *--i;
+    std::reverse(back.begin(), back.end());
+    CHECK(back == want, "Rope: runda %u, do tylu inna tresc (%zu kawalkow)", r, rope.spans());
+
+    for (unsigned k = 0; k < 10 && !want.empty(); ++k) {
+      size_t pos = rnd(want.size());
+      Rope::const_iterator i = rope.at(pos);
+      CHECK(i.offset() == pos && *i == want[pos], "Rope::at(%zu)", pos);
+    }
+    CHECK(rope.at(want.size()) == rope.end(), "Rope::at(size())");
+
+    const char *flat = rope.flatten();
+    CHECK(flat && std::string(flat, rope.size()) == want, "Rope::flatten");
+  }
+}
+
+/*** HttpHeaders ***/
+
+static void check_headers(void)
+{
+  HttpHeaders h;
+  std::string raw;
+
+  static const char *first[] = {
+    "HTTP/1.1 100 Continue\r\n", "\r\n",
+    "HTTP/1.1 302 Found\r\n", "Location: /next\r\n", "Set-Cookie: old=1\r\n", "\r\n",
+  };
+  for (size_t i = 0; i < sizeof(first)/sizeof(first[0]); ++i) {
+    CHECK(h.feed(first[i], strlen(first[i])), "HttpHeaders::feed");
+    raw += first[i];
+  }
+  CHECK(h.status() == 302 && h.location() && !strcmp(h.location(), "/next"),
+      "HttpHeaders: przekierowanie %d", h.status());
+
+  // Dosc pol, zeby bufory urosly kilka razy - przesuniecia musza przetrwac
+  static const char *last[] = {
+    "HTTP/1.1 206 Partial Content\r\n", "Content-Length: 100\r\n",
+    "Content-Range: bytes 100-199/1000\r\n", "accept-ranges: bytes\r\n",
+    "ETag:  \"abc\" \r\n", "Set-Cookie: a=1\r\n", "Set-Cookie: b=2\r\n",
+  };
+  for (size_t i = 0; i < sizeof(last)/sizeof(last[0]); ++i) {
+    CHECK(h.feed(last[i], strlen(last[i])), "HttpHeaders::feed");
+    raw += last[i];
+  }
+  for (unsigned i = 0; i < 300; ++i) {
+    char line[128];
+    int n = snprintf(line, sizeof(line), "X-Pad-%u: %s\r\n", i, random_text(1 + rnd(60), 26).c_str());
+    CHECK(h.feed(line, n), "HttpHeaders::feed");
+    raw.append(line, n);
+  }
+  CHECK(h.feed("x-pad-7: again\r\n", 16) && h.feed("\r\n", 2), "HttpHeaders::feed");
+  raw += "x-pad-7: again\r\n\r\n";
+
+  CHECK(h.raw() && raw == h.raw() && h.length() == raw.size(), "HttpHeaders::raw");
+  CHECK(h.status() == 206, "HttpHeaders::status: %d zamiast 206", h.status());
+  CHECK(!h.location(), "HttpHeaders: Location z poprzedniej odpowiedzi");
+  CHECK(h.contentLength() == 100, "HttpHeaders::contentLength");
+
+  off_t from = 0, to = 0, total = 0;
+  CHECK(h.contentRange(from, to, total) && from == 100 && to == 199 && total == 1000,
+      "HttpHeaders::contentRange");
+  CHECK(h.acceptRanges(), "HttpHeaders::acceptRanges");
+  CHECK(h.etag() && !strcmp(h.etag(), "\"abc\""), "HttpHeaders::etag: [%s]", h.etag());
+  CHECK(h.setCookie(0) && !strcmp(h.setCookie(0), "a=1") &&
+      h.setCookie(1) && !strcmp(h.setCookie(1), "b=2") && !h.setCookie(2), "HttpHeaders::setCookie");
+  CHECK(h.count() == 307, "HttpHeaders::count: %zu zamiast 307", h.count());
+
+  const char *v = h.find("X-PAD-7", 1);
+  CHECK(v && !strcmp(v, "again"), "HttpHeaders::find: drugie X-Pad-7");
+  v = h.find("x-pad-299");
+  CHECK(v && *v && !h.find("x-pad-300"), "HttpHeaders::find: X-Pad-299");
+
+  h.clear();
+  CHECK(!h.raw() && h.status() == 0 && h.count() == 0, "HttpHeaders::clear");
+}
+
+/*** CookieJar ***/
+
+// Czy w "a=b; c=d" jest dokladnie takie ciastko
+static bool has_cookie(CookieJar &jar, const char *url, const char *cookie)
+{
+  std::string h;
+  if (!jar.header(url, h)) return false;
+  h = "; " + h + "; ";
+  return h.find(std::string("; ") + cookie + "; ") != std::string::npos;
+}
+
+static void check_cookies(void)
+{
+  CookieJar jar;
+
+  jar.set("http://www.example.com/a/b", "id=1; Path=/a");
+  CHECK(has_cookie(jar, "http://www.example.com/a", "id=1"), "CookieJar: Path=/a pod /a");
+  CHECK(has_cookie(jar, "http://www.example.com:8080/a/c?x=/b", "id=1"), "CookieJar: Path=/a pod /a/c");
+  CHECK(!has_cookie(jar, "http://www.example.com/ab", "id=1"), "CookieJar: Path=/a pod /ab");
+  CHECK(!has_cookie(jar, "http://example.com/a", "id=1"), "CookieJar: ciastko hosta w domenie nadrzednej");
+  CHECK(!has_cookie(jar, "http://x.www.example.com/a", "id=1"), "CookieJar: ciastko hosta w poddomenie");
+
+  jar.set("http://www.example.com/a/b", "id=2; Path=/a");
+  CHECK(has_cookie(jar, "http://www.example.com/a", "id=2") &&
+      !has_cookie(jar, "http://www.example.com/a", "id=1"), "CookieJar: ciastko nie zastapione");
+
+  jar.set("http://WWW.Example.com/", "dom=1; Domain=.EXAMPLE.com");
+  CHECK(has_cookie(jar, "http://x.example.com/", "dom=1") && has_cookie(jar, "http://example.com/x", "dom=1"),
+      "CookieJar: Domain=example.com");
+  CHECK(!has_cookie(jar, "http://badexample.com/", "dom=1"), "CookieJar: Domain=example.com w badexample.com");
+
+  size_t n = jar.size();
+  jar.set("http://www.example.com/", "evil=1; Domain=other.com");
+  jar.set("http://www.example.com/", "evil=1; Domain=ww.example.com");
+  CHECK(jar.size() == n, "CookieJar: przyjete ciastko z cudza domena");
+
+  // Bez Path - katalog sciezki zadania
+  jar.set("http://h.org/d/e/page", "p=1");
+  CHECK(has_cookie(jar, "http://h.org/d/e/other", "p=1") && !has_cookie(jar, "http://h.org/d/other", "p=1"),
+      "CookieJar: domyslna sciezka");
+
+  jar.set("https://h.org/", "s=1; Secure; Path=/");
+  CHECK(has_cookie(jar, "https://h.org/", "s=1") && !has_cookie(jar, "http://h.org/", "s=1"), "CookieJar: Secure");
+
+  // Wygasanie: data w przeszlosci i Max-Age <= 0 usuwaja, Max-Age wygrywa z Expires
+  jar.set("http://h.org/", "old=1; Path=/; Max-Age=-1");
+  jar.set("http://h.org/", "far=1; Path=/; Expires=Fri, 01 Jan 2100 00:00:00 GMT");
+  jar.set("http://h.org/", "soon=1; Path=/; Expires=Fri, 01 Jan 2100 00:00:00 GMT; Max-Age=1");
+  CHECK(!has_cookie(jar, "http://h.org/", "old=1") && has_cookie(jar, "http://h.org/", "far=1") &&
+      has_cookie(jar, "http://h.org/", "soon=1"), "CookieJar: Expires/Max-Age");
+
+  n = jar.size();
+  jar.set("http://www.example.com/", "dom=1; Domain=example.com; Expires=Thu, 01 Jan 1970 00:00:01 GMT");
+  CHECK(jar.size() == n - 1 && !has_cookie(jar, "http://x.example.com/", "dom=1"),
+      "CookieJar: data w przeszlosci nie usunela ciastka");
+
+  sleep(2);
+  CHECK(!has_cookie(jar, "http://h.org/", "soon=1"), "CookieJar: Max-Age=1 po 2 s");
+  jar.expire();
+  CHECK(jar.size() == n - 2, "CookieJar::expire: zostalo %zu zamiast %zu", jar.size(), n - 2);
+
+  jar.clear();
+  std::string h;
+  CHECK(jar.size() == 0 && !jar.header("http://h.org/", h) && h.empty(), "CookieJar::clear");
+}
+
+/*** Digest ***/
+
+static void check_digest(void)
+{
+  static const struct { const char *name, *text, *hex; } known[] = {
+    { "crc32c", "", "00000000" },
+    { "crc32c", "123456789", "e3069283" },
+    { "xxh64", "", "ef46db3751d8e999" },
+    { "xxh64", "abc", "44bc2cf5ad770999" },
+    { "sha256", "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { "sha256", "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { "sha256", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+      "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+  };
+
+  for (size_t i = 0; i < sizeof(known)/sizeof(known[0]); ++i) {
+    Digest *d = Digest::create(known[i].name);
+    CHECK(d, "Digest::create(%s)", known[i].name);
+    if (!d) continue;
+    d->update(known[i].text, strlen(known[i].text));
+    CHECK(d->hex() == known[i].hex, "%s(\"%s\"): %s zamiast %s",
+        known[i].name, known[i].text, d->hex().c_str(), known[i].hex);
+    delete d;
+  }
+
+  // Dluzsze dane: po kawalku, w calosci i (gdzie sie da) sklejane
+  std::string data = random_text(100000, 26);
+  const char *names[] = { "crc32c", "xxh64", "sha256" };
+
+  for (size_t i = 0; i < sizeof(names)/sizeof(names[0]); ++i) {
+    Digest *whole = Digest::create(names[i]), *parts = whole->clone();
+    whole->update(data.data(), data.size());
+
+    for (size_t at = 0; at < data.size(); ) {
+      size_t n = std::min(data.size() - at, (size_t)1 + rnd(300));
+      parts->update(data.data() + at, n);
+      at += n;
+    }
+    CHECK(parts->hex() == whole->hex(), "%s: kawalkami %s, w calosci %s",
+        names[i], parts->hex().c_str(), whole->hex().c_str());
+
+    size_t cut = rnd(data.size() + 1);
+    Digest *head = whole->clone(), *tail = whole->clone();
+    head->update(data.data(), cut);
+    tail->update(data.data() + cut, data.size() - cut);
+    if (head->combine(*tail, data.size() - cut))
+      CHECK(head->hex() == whole->hex(), "%s: sklejony w %zu %s, w calosci %s",
+          names[i], cut, head->hex().c_str(), whole->hex().c_str());
+
+    delete head;
+    delete tail;
+    delete parts;
+    delete whole;
+  }
+}
+
+/*** Matcher ***/
+
+static bool hit_less(const Matcher::Hit &a, const Matcher::Hit &b)
+{
+  return a.offset != b.offset ? a.offset < b.offset : a.id < b.id;
+}
+
+static bool hit_same(const Matcher::Hit &a, const Matcher::Hit &b)
+{
+  return a.offset == b.offset && a.id == b.id;
+}
+
+static bool hits_equal(const std::vector<Matcher::Hit> &a, const std::vector<Matcher::Hit> &b)
+{
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), hit_same);
+}
+
+static void check_matcher(unsigned sets)
+{
+  for (unsigned set = 0; set < sets; ++set) {
+    unsigned letters = 2 + rnd(4);
+    std::vector<std::string> pats;
+    Matcher m;
+
+    for (unsigned n = 1 + rnd(12); pats.size() < n; ) {
+      std::string p = random_text(1 + rnd(6), letters);
+      if (std::find(pats.begin(), pats.end(), p) != pats.end()) continue;
+      CHECK(m.add(p) == pats.size(), "Matcher::add: zly numer wzorca");
+      pats.push_back(p);
+    }
+    m.compile();
+
+    std::string text = random_text(rnd(400), letters);
+
+    // Naiwnie: kazdy wzorzec od kazdej pozycji
+    std::vector<Matcher::Hit> want;
+    for (size_t i = 0; i < text.size(); ++i)
+      for (unsigned id = 0; id < pats.size(); ++id)
+        if (!text.compare(i, pats[id].size(), pats[id])) {
+          Matcher::Hit h = { id, i };
+          want.push_back(h);
+        }
+
+    std::vector<Matcher::Hit> got;
+    m.scan(text.data(), text.size(), got);
+
+    // Kolejnosc jest wedlug konca wzorca - porownujemy zbiory
+    std::vector<Matcher::Hit> sorted(got);
+    std::sort(sorted.begin(), sorted.end(), hit_less);
+    CHECK(hits_equal(sorted, want), "Matcher: zestaw %u, %zu trafien zamiast %zu",
+        set, got.size(), want.size());
+
+    for (size_t i = 1; i < got.size(); ++i)
+      CHECK(got[i-1].offset + pats[got[i-1].id].size() <= got[i].offset + pats[got[i].id].size(),
+          "Matcher: zestaw %u, trafienia nie po kolei", set);
+
+    // Ten sam tekst w dwoch kawalkach - wynik dokladnie taki sam
+    size_t cut = text.empty() ? 0 : rnd(text.size() + 1);
+    std::vector<Matcher::Hit> split;
+    unsigned state = 0;
+    size_t pos = 0;
+    m.scan(text.data(), cut, split, state, pos);
+    m.scan(text.data() + cut, text.size() - cut, split, state, pos);
+    CHECK(pos == text.size(), "Matcher: pos %zu po %zu bajtach", pos, text.size());
+    CHECK(hits_equal(split, got), "Matcher: zestaw %u, podzial w %zu zmienia wynik", set, cut);
+  }
+}
+
+/*** Scheduler ***/
+
+struct Alarm {
+  uint64_t due, fired;
+  unsigned count;
+  Scheduler::Timer timer;
+};
+
+static void alarm_fn(void *data)
+{
+  Alarm *a = (Alarm*)data;
+  a->fired = Time::mono_msec();
+  __sync_fetch_and_add(&a->count, 1);
+}
+
+static void check_scheduler(unsigned timers)
+{
+  Scheduler &s = Scheduler::instance();
+  std::vector<Alarm> alarms(timers);
+  uint64_t start = Time::mono_msec(), last = 0;
+
+  for (unsigned i = 0; i < timers; ++i) {
+    Alarm &a = alarms[i];
+    uint64_t ms = rnd(1500);
+    a.count = 0;
+    a.due = Time::mono_msec() + ms;
+    a.timer = s.add(ms, alarm_fn, &a);
+  }
+
+  // Co trzeci anulowany, co piaty przesuniety
+  for (unsigned i = 0; i < timers; ++i) {
+    Alarm &a = alarms[i];
+    if (i % 3 == 0) {
+      if (s.cancel(a.timer)) a.due = 0;
+    } else if (i % 5 == 0) {
+      uint64_t ms = rnd(1500);
+      uint64_t due = Time::mono_msec() + ms;
+      if (s.reschedule(a.timer, ms)) a.due = due;
+    }
+    last = std::max(last, a.due);
+  }
+
+  while (Time::mono_msec() < last + 2*Scheduler::TickMs + 100) usleep(50000);
+
+  uint64_t late = 0;
+  for (unsigned i = 0; i < timers; ++i) {
+    Alarm &a = alarms[i];
+    if (!a.due) {
+      CHECK(a.count == 0, "Scheduler: anulowany %u przyszedl", i);
+      continue;
+    }
+    CHECK(a.count == 1, "Scheduler: %u przyszedl %u razy", i, a.count);
+    if (a.count != 1) continue;
+    CHECK(a.fired >= a.due, "Scheduler: %u za wczesnie o %llu ms", i,
+        (unsigned long long)(a.due - a.fired));
+    if (a.fired > a.due) late = std::max(late, a.fired - a.due);
+  }
+  CHECK(late <= 2*Scheduler::TickMs, "Scheduler: spoznienie %llu ms", (unsigned long long)late);
+  CHECK(s.size() == 0, "Scheduler: zostalo %zu wpisow", s.size());
+
+  printf("Scheduler: %u terminow w %llu ms, najwieksze spoznienie %llu ms\n", timers,
+      (unsigned long long)(Time::mono_msec() - start), (unsigned long long)late);
+}
+
+/*** RetryPolicy::fit ***/
+
+// Czy t mozna dolozyc: kazde okno [s, s+window) z t ma mniej niz tries z q
+static bool fits(const std::vector<uint64_t> &q, uint64_t t, uint64_t window, unsigned tries)
+{
+  std::vector<uint64_t> starts(q);
+  starts.push_back(t);
+
+  for (size_t i = 0; i < starts.size(); ++i) {
+    uint64_t s = starts[i];
+    if (s > t || s + window <= t) continue;
+    unsigned in = 0;
+    for (size_t k = 0; k < q.size(); ++k) if (q[k] >= s && q[k] < s + window) ++in;
+    if (in >= tries) return false;
+  }
+
+  return true;
+}
+
+static void check_fit(unsigned rounds)
+{
+  for (unsigned r = 0; r < rounds; ++r) {
+    uint64_t window = 1 + rnd(20);
+    unsigned tries = 1 + rnd(4);
+    std::vector<uint64_t> q;
+
+    // Kolejka budowana tak jak w next() - dokladana przez fit
+    for (unsigned n = rnd(30); n; --n) {
+      uint64_t t = rnd(100);
+      uint64_t want = t;
+      while (!fits(q, want, window, tries)) ++want;
+
+      uint64_t got = RetryPolicy::fit(q, t, window, tries);
+      CHECK(got == want, "RetryPolicy::fit(t=%llu, okno %llu, %u prob): %llu zamiast %llu",
+          (unsigned long long)t, (unsigned long long)window, tries,
+          (unsigned long long)got, (unsigned long long)want);
+
+      q.insert(std::upper_bound(q.begin(), q.end(), want), want);
+    }
+  }
+}
+
+// Wywolaj i wypisz ile bledow doszlo
+#define SECTION(name, call) do { \
+    unsigned before = Failed; \
+    call; \
+    printf("%s: %u bledow\n", name, Failed - before); \
+  } while (0)
+
+int main(int argc, char **argv)
+{
+  if (argc > 1) s_seed = atoi(argv[1]);
+  printf("Ziarno: %u\n", s_seed);
+
+  SECTION("HttpSegments", check_segments());
+  SECTION("Journal", check_journal());
+  SECTION("Rope", check_rope(100));
+  SECTION("HttpHeaders", check_headers());
+  SECTION("CookieJar", check_cookies());
+  SECTION("Digest", check_digest());
+  SECTION("Matcher", check_matcher(2000));
+  SECTION("Scheduler", check_scheduler(3000));
+  SECTION("RetryPolicy::fit", check_fit(2000));
+
+  printf(Failed ? "BLEDY: %u\n" : "Wszystko dobrze.\n", Failed);
+  return Failed ? 1 : 0;
+}